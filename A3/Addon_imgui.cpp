@@ -119,13 +119,8 @@ Addon_imgui::Addon_imgui( GLFWwindow* window, VulkanRenderBackend* vulkan, int32
         wd->Frames[ i ].Backbuffer = vulkan->swapChainImages[ i ];
         wd->Frames[ i ].BackbufferView = vulkan->swapChainImageViews[ i ];
         wd->Frames[ i ].Framebuffer = vulkan->framebuffers[ i ];
-        wd->Frames[ i ].CommandPool = vulkan->commandPools[ i ];
-        wd->Frames[ i ].CommandBuffer = vulkan->commandBuffers[ i ];
-        wd->Frames[ i ].Fence = vulkan->fences[ i ];
-
-        wd->FrameSemaphores[ i ].ImageAcquiredSemaphore = vulkan->imageAvailableSemaphores[ i ];
-        wd->FrameSemaphores[ i ].RenderCompleteSemaphore = vulkan->renderFinishedSemaphores[ i ];
     }
+    // Command buffers, fences and semaphores belong to the frames in flight of the backend, see renderFrame
 
     wd->RenderPass = vulkan->imguiRenderPass;
 
@@ -245,6 +240,15 @@ void Addon_imgui::renderFrame( GLFWwindow* window, VulkanRenderBackend* vulkan,
                 scene->markBufferUpdated();
             }
 
+            int rouletteMinDepth = static_cast<int>(scene->getImguiParam()->rouletteMinDepth);
+            if (ImGui::InputInt("Roulette min depth", &rouletteMinDepth)) {
+                if (rouletteMinDepth < 0) rouletteMinDepth = 0;
+                const int maxDepth = static_cast<int>(scene->getImguiParam()->maxDepth);
+                if (rouletteMinDepth > maxDepth) rouletteMinDepth = maxDepth;
+                scene->getImguiParam()->rouletteMinDepth = static_cast<uint32>(rouletteMinDepth);
+                scene->markBufferUpdated();
+            }
+
             bool p = scene->getImguiParam()->isProgressive;
             if (ImGui::Checkbox("Progressive", &p)) {
                 scene->getImguiParam()->isProgressive = static_cast<uint32>(p);
@@ -252,6 +256,24 @@ void Addon_imgui::renderFrame( GLFWwindow* window, VulkanRenderBackend* vulkan,
             }
         }
 
+        // Every combination has a prebuilt pipeline, switching only restarts the accumulation
+        ImGui::SeparatorText("Light Sampling");
+        {
+            const char* samplingModes[] = { "Brute force", "NEE" };
+            int samplingMode = static_cast<int>(scene->getImguiParam()->lightSamplingMode);
+            if (ImGui::Combo("Sampling mode", &samplingMode, samplingModes, IM_ARRAYSIZE(samplingModes))) {
+                scene->getImguiParam()->lightSamplingMode = static_cast<uint32>(samplingMode);
+                scene->markBufferUpdated();
+            }
+
+            const char* lightSelections[] = { "Light only", "Env map", "Both" };
+            int lightSelection = static_cast<int>(scene->getImguiParam()->lightSelection);
+            if (ImGui::Combo("Light selection", &lightSelection, lightSelections, IM_ARRAYSIZE(lightSelections))) {
+                scene->getImguiParam()->lightSelection = static_cast<uint32>(lightSelection);
+                scene->markBufferUpdated();
+            }
+        }
+
         bool lightExists = scene->getLightIndex().size();
         ImGui::BeginDisabled(!lightExists);
         ImGui::SeparatorText("Light");
@@ -274,7 +296,7 @@ void Addon_imgui::renderFrame( GLFWwindow* window, VulkanRenderBackend* vulkan,
             float p[3] = { lightPos.x, lightPos.y, lightPos.z };
             if (ImGui::SliderFloat3("Position", p, -3.0, 3.0)) {
                 light->setPosition(Vec3(p[0], p[1], p[2]));
-                scene->markPosUpdated();
+                scene->markTransformUpdated();
             }
 
             float emit = 0.0;
@@ -322,6 +344,14 @@ void Addon_imgui::renderFrame( GLFWwindow* window, VulkanRenderBackend* vulkan,
         ImGui::SeparatorText("Performance");
         ImGui::Text("Application average: %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
         ImGui::Text("Current frame: %u", vulkan->currentFrameCount);
+
+        const DeviceMemoryStats memoryStats = vulkan->getMemoryStats();
+        ImGui::Text("Device memory: %.1f / %.1f MB in %u blocks + %u dedicated",
+            memoryStats.usedBytes / (1024.0 * 1024.0), memoryStats.reservedBytes / (1024.0 * 1024.0),
+            memoryStats.blockCount, memoryStats.dedicatedAllocationCount);
+        ImGui::Text("Allocations: %u, fragmentation: %.1f%%", memoryStats.allocationCount, memoryStats.getFragmentation() * 100.0f);
+        ImGui::Text("BLAS compaction: %.2f MB -> %.2f MB",
+            vulkan->blasOriginalBytes / (1024.0 * 1024.0), vulkan->blasCompactedBytes / (1024.0 * 1024.0));
         ImGui::End();
     }
 
@@ -336,23 +366,21 @@ void Addon_imgui::renderFrame( GLFWwindow* window, VulkanRenderBackend* vulkan,
     wd->ClearValue.color.float32[ 3 ] = clear_color.w;
     
     {
-        VkSemaphore waitRT = vulkan->rtFinishedSemaphores[wd->SemaphoreIndex];
-        VkSemaphore signalPresent = wd->FrameSemaphores[ wd->SemaphoreIndex ].RenderCompleteSemaphore;
+        // Recorded into the current frame in flight, which beginFrame already waited for and reset.
+        // The framebuffer and the present semaphore follow the acquired swap chain image.
+        VkSemaphore waitRT = vulkan->rtFinishedSemaphores[ vulkan->frameIndex ];
+        VkSemaphore signalPresent = vulkan->renderFinishedSemaphores[ vulkan->imageIndex ];
+        VkCommandBuffer commandBuffer = vulkan->imguiCommandBuffers[ vulkan->frameIndex ];
+        VkFence frameFence = vulkan->fences[ vulkan->frameIndex ];
 
         VkResult err;
-        ImGui_ImplVulkanH_Frame* fd = &wd->Frames[ wd->FrameIndex ];
+        ImGui_ImplVulkanH_Frame* fd = &wd->Frames[ vulkan->imageIndex ];
         {
-            err = vkWaitForFences(vulkan->device, 1, &fd->Fence, VK_TRUE, UINT64_MAX);
-            check_vk_result(err);
-            err = vkResetFences(vulkan->device, 1, &fd->Fence);    // 다음 프레임 준비
-            check_vk_result(err);
-            err = vkResetCommandPool( vulkan->device, fd->CommandPool, 0 );
-            check_vk_result( err );
             VkCommandBufferBeginInfo info{
                 .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
                 .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
             };
-            err = vkBeginCommandBuffer( fd->CommandBuffer, &info );
+            err = vkBeginCommandBuffer( commandBuffer, &info );
             check_vk_result( err );
         }
         {
@@ -367,14 +395,14 @@ void Addon_imgui::renderFrame( GLFWwindow* window, VulkanRenderBackend* vulkan,
             info.renderArea.extent.height = wd->Height;
             info.clearValueCount = 1;
             info.pClearValues = &cv;
-            vkCmdBeginRenderPass( fd->CommandBuffer, &info, VK_SUBPASS_CONTENTS_INLINE );
+            vkCmdBeginRenderPass( commandBuffer, &info, VK_SUBPASS_CONTENTS_INLINE );
         }
 
         // Record dear imgui primitives into command buffer
-        ImGui_ImplVulkan_RenderDrawData( main_draw_data, fd->CommandBuffer );
+        ImGui_ImplVulkan_RenderDrawData( main_draw_data, commandBuffer );
 
         // Submit command buffer
-        vkCmdEndRenderPass( fd->CommandBuffer );
+        vkCmdEndRenderPass( commandBuffer );
         {
             VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
             VkSubmitInfo info = {};
@@ -383,18 +411,15 @@ void Addon_imgui::renderFrame( GLFWwindow* window, VulkanRenderBackend* vulkan,
             info.pWaitSemaphores = &waitRT;
             info.pWaitDstStageMask = &wait_stage;
             info.commandBufferCount = 1;
-            info.pCommandBuffers = &fd->CommandBuffer;
+            info.pCommandBuffers = &commandBuffer;
             info.signalSemaphoreCount = 1;
             info.pSignalSemaphores = &signalPresent;
 
-            err = vkEndCommandBuffer( fd->CommandBuffer );
+            err = vkEndCommandBuffer( commandBuffer );
             check_vk_result( err );
-            err = vkQueueSubmit( vulkan->graphicsQueue, 1, &info, fd->Fence);
+            err = vkQueueSubmit( vulkan->graphicsQueue, 1, &info, frameFence );
             check_vk_result( err );
         }
-
-        wd->SemaphoreIndex = ( wd->SemaphoreIndex + 1 ) % wd->SemaphoreCount; // Now we can use the next set of semaphores
-        wd->FrameIndex = ( wd->FrameIndex + 1 ) % 3; // @FIXME: Workaround
     }
 
     // Update and Render additional Platform Windows
@@ -0,0 +1,333 @@
+#include "BVH.h"
+#include "MeshResource.h"
+#include "ThreadPool.h"
+#include <atomic>
+
+using namespace A3;
+
+namespace
+{
+constexpr uint32 BIN_COUNT = 16;
+constexpr uint32 MAX_LEAF_SIZE = 8;
+constexpr float TRAVERSAL_COST = 1.0f;          // Relative to the cost of one triangle test
+constexpr uint32 TASK_THRESHOLD = 4096;         // Subtrees larger than this are built as separate tasks
+constexpr uint32 PARALLEL_THRESHOLD = 65536;    // Nodes larger than this are binned in parallel
+constexpr uint32 CHUNK_SIZE = 16384;
+
+float axisOf( const Vec3& v, uint32 axis )
+{
+    return axis == 0 ? v.x : ( axis == 1 ? v.y : v.z );
+}
+
+struct Bin
+{
+    AABB bounds;
+    uint32 count = 0;
+};
+
+struct BinSet
+{
+    Bin bins[ 3 ][ BIN_COUNT ];
+
+    void merge( const BinSet& other )
+    {
+        for( uint32 axis = 0; axis < 3; ++axis )
+        {
+            for( uint32 bin = 0; bin < BIN_COUNT; ++bin )
+            {
+                bins[ axis ][ bin ].bounds.grow( other.bins[ axis ][ bin ].bounds );
+                bins[ axis ][ bin ].count += other.bins[ axis ][ bin ].count;
+            }
+        }
+    }
+};
+
+// Maps a centroid to its bin along one axis of the centroid bounds
+struct BinMapping
+{
+    Vec3 origin;
+    float scale[ 3 ];
+
+    BinMapping( const AABB& centroidBounds )
+        : origin( centroidBounds.min )
+    {
+        const Vec3 extent = centroidBounds.max - centroidBounds.min;
+        for( uint32 axis = 0; axis < 3; ++axis )
+        {
+            const float axisExtent = axisOf( extent, axis );
+            scale[ axis ] = axisExtent > 1e-12f ? float( BIN_COUNT ) * ( 1.0f - 1e-6f ) / axisExtent : 0.0f;
+        }
+    }
+
+    uint32 binOf( const Vec3& centroid, uint32 axis ) const
+    {
+        const int32 bin = int32( ( axisOf( centroid, axis ) - axisOf( origin, axis ) ) * scale[ axis ] );
+        return uint32( std::clamp( bin, 0, int32( BIN_COUNT ) - 1 ) );
+    }
+};
+
+// Runs func( begin, end ) over [first, first + count), in parallel chunks for large ranges, and merges the results
+template<typename Result, typename Func, typename Merge>
+Result reduceRange( uint32 first, uint32 count, Func func, Merge merge )
+{
+    if( count < PARALLEL_THRESHOLD )
+        return func( first, first + count );
+
+    const uint32 chunkCount = ( count + CHUNK_SIZE - 1 ) / CHUNK_SIZE;
+    std::vector<Result> partials( chunkCount );
+    ThreadPool::get().parallelFor( chunkCount, 1, [ & ]( uint32 chunk )
+        {
+            const uint32 begin = first + chunk * CHUNK_SIZE;
+            partials[ chunk ] = func( begin, std::min( begin + CHUNK_SIZE, first + count ) );
+        } );
+
+    Result result = partials[ 0 ];
+    for( uint32 chunk = 1; chunk < chunkCount; ++chunk )
+        merge( result, partials[ chunk ] );
+    return result;
+}
+}
+
+struct BVH::BuildContext
+{
+    std::vector<AABB> triangleBounds;
+    std::vector<Vec3> centroids;
+    std::vector<BuildNode> buildNodes;
+    std::atomic<uint32> nodeCount = 0;
+    TaskGroup tasks;
+};
+
+void BVH::build( const MeshResource& mesh )
+{
+    build( mesh.positions, mesh.indices );
+}
+
+void BVH::build( const std::vector<VertexPosition>& positions, const std::vector<uint32>& indices )
+{
+    nodes.clear();
+    triangleIndices.clear();
+    depth = 0;
+
+    const uint32 triangleCount = static_cast< uint32 >( indices.size() / 3 );
+    if( triangleCount == 0 )
+        return;
+
+    BuildContext context;
+    context.triangleBounds.resize( triangleCount );
+    context.centroids.resize( triangleCount );
+    context.buildNodes.resize( triangleCount * 2 - 1 );
+    triangleIndices.resize( triangleCount );
+
+    ThreadPool::get().parallelFor( triangleCount, CHUNK_SIZE, [ & ]( uint32 triangleIndex )
+        {
+            AABB bounds;
+            for( uint32 corner = 0; corner < 3; ++corner )
+            {
+                const VertexPosition& p = positions[ indices[ triangleIndex * 3 + corner ] ];
+                bounds.grow( Vec3( p.x, p.y, p.z ) );
+            }
+            context.triangleBounds[ triangleIndex ] = bounds;
+            context.centroids[ triangleIndex ] = bounds.center();
+            triangleIndices[ triangleIndex ] = triangleIndex;
+        } );
+
+    context.nodeCount = 1;
+    buildNode( context, 0, 0, triangleCount );
+    context.tasks.wait();
+
+    // Re-emit the nodes depth-first, so traversal walks the array mostly forward
+    nodes.reserve( context.nodeCount );
+    flatten( context.buildNodes );
+}
+
+AABB BVH::getBounds() const
+{
+    AABB bounds;
+    if( !nodes.empty() )
+    {
+        bounds.min = nodes[ 0 ].boundsMin;
+        bounds.max = nodes[ 0 ].boundsMax;
+    }
+    return bounds;
+}
+
+void BVH::buildNode( BuildContext& context, uint32 nodeIndex, uint32 first, uint32 count )
+{
+    struct RangeBounds
+    {
+        AABB bounds;
+        AABB centroidBounds;
+    };
+
+    const RangeBounds range = reduceRange<RangeBounds>( first, count,
+        [ & ]( uint32 begin, uint32 end )
+        {
+            RangeBounds result;
+            for( uint32 index = begin; index < end; ++index )
+            {
+                const uint32 triangleIndex = triangleIndices[ index ];
+                result.bounds.grow( context.triangleBounds[ triangleIndex ] );
+                result.centroidBounds.grow( context.centroids[ triangleIndex ] );
+            }
+            return result;
+        },
+        []( RangeBounds& lhs, const RangeBounds& rhs )
+        {
+            lhs.bounds.grow( rhs.bounds );
+            lhs.centroidBounds.grow( rhs.centroidBounds );
+        } );
+
+    BuildNode& node = context.buildNodes[ nodeIndex ];
+    node.bounds = range.bounds;
+    node.left = 0;
+    node.first = first;
+    node.count = count;
+
+    if( count <= 2 )
+        return;
+
+    // Binned SAH over all three axes
+    const BinMapping mapping( range.centroidBounds );
+    const BinSet binSet = reduceRange<BinSet>( first, count,
+        [ & ]( uint32 begin, uint32 end )
+        {
+            BinSet result;
+            for( uint32 index = begin; index < end; ++index )
+            {
+                const uint32 triangleIndex = triangleIndices[ index ];
+                const Vec3& centroid = context.centroids[ triangleIndex ];
+                for( uint32 axis = 0; axis < 3; ++axis )
+                {
+                    Bin& bin = result.bins[ axis ][ mapping.binOf( centroid, axis ) ];
+                    bin.bounds.grow( context.triangleBounds[ triangleIndex ] );
+                    bin.count++;
+                }
+            }
+            return result;
+        },
+        []( BinSet& lhs, const BinSet& rhs ) { lhs.merge( rhs ); } );
+
+    float bestCost = FLT_MAX;
+    uint32 bestAxis = 0;
+    uint32 bestSplit = 0;
+    for( uint32 axis = 0; axis < 3; ++axis )
+    {
+        if( mapping.scale[ axis ] == 0.0f )
+            continue;
+
+        const Bin* bins = binSet.bins[ axis ];
+
+        // Right-to-left sweep keeps the area*count of the right side for every split plane
+        float rightCost[ BIN_COUNT ];
+        AABB rightBounds;
+        uint32 rightCount = 0;
+        for( uint32 bin = BIN_COUNT - 1; bin > 0; --bin )
+        {
+            rightBounds.grow( bins[ bin ].bounds );
+            rightCount += bins[ bin ].count;
+            rightCost[ bin ] = rightBounds.surfaceArea() * rightCount;
+        }
+
+        AABB leftBounds;
+        uint32 leftCount = 0;
+        for( uint32 split = 1; split < BIN_COUNT; ++split )
+        {
+            leftBounds.grow( bins[ split - 1 ].bounds );
+            leftCount += bins[ split - 1 ].count;
+            if( leftCount == 0 || leftCount == count )
+                continue;
+
+            const float cost = leftBounds.surfaceArea() * leftCount + rightCost[ split ];
+            if( cost < bestCost )
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    const float parentArea = std::max( range.bounds.surfaceArea(), 1e-20f );
+    const float splitCost = TRAVERSAL_COST + bestCost / parentArea;
+    const float leafCost = float( count );
+
+    uint32 middle;
+    if( bestSplit != 0 )
+    {
+        if( count <= MAX_LEAF_SIZE && leafCost <= splitCost )
+            return;
+
+        uint32* begin = triangleIndices.data() + first;
+        uint32* split = std::partition( begin, begin + count, [ & ]( uint32 triangleIndex )
+            {
+                return mapping.binOf( context.centroids[ triangleIndex ], bestAxis ) < bestSplit;
+            } );
+        middle = first + static_cast< uint32 >( split - begin );
+    }
+    else
+    {
+        // All centroids coincide, SAH cannot separate them
+        if( count <= MAX_LEAF_SIZE )
+            return;
+
+        middle = first + count / 2;
+    }
+
+    const uint32 leftIndex = context.nodeCount.fetch_add( 2 );
+    node.left = leftIndex;
+    node.count = 0;
+
+    const uint32 leftCount = middle - first;
+    if( leftCount > TASK_THRESHOLD )
+    {
+        context.tasks.run( [ this, &context, leftIndex, first, leftCount ]()
+            {
+                buildNode( context, leftIndex, first, leftCount );
+            } );
+    }
+    else
+    {
+        buildNode( context, leftIndex, first, leftCount );
+    }
+
+    buildNode( context, leftIndex + 1, middle, count - leftCount );
+}
+
+void BVH::flatten( const std::vector<BuildNode>& buildNodes )
+{
+    struct StackEntry
+    {
+        uint32 buildIndex;
+        uint32 parentIndex;     // Flat index of the parent whose right child this is, ~0u for left children and the root
+        uint32 depth;
+    };
+
+    std::vector<StackEntry> stack;
+    stack.push_back( { 0, ~0u, 1 } );
+    while( !stack.empty() )
+    {
+        const StackEntry entry = stack.back();
+        stack.pop_back();
+
+        const uint32 flatIndex = static_cast< uint32 >( nodes.size() );
+        if( entry.parentIndex != ~0u )
+            nodes[ entry.parentIndex ].rightOrFirst = flatIndex;
+
+        const BuildNode& buildNode = buildNodes[ entry.buildIndex ];
+        BVHNode& node = nodes.emplace_back();
+        node.boundsMin = buildNode.bounds.min;
+        node.boundsMax = buildNode.bounds.max;
+        depth = std::max( depth, entry.depth );
+
+        if( buildNode.count != 0 )
+        {
+            node.rightOrFirst = buildNode.first;
+            node.triangleCount = buildNode.count;
+            continue;
+        }
+
+        node.triangleCount = 0;
+        stack.push_back( { buildNode.left + 1, flatIndex, entry.depth + 1 } );
+        stack.push_back( { buildNode.left, ~0u, entry.depth + 1 } );
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "EngineTypes.h"
+#include "Vector.h"
+#include <vector>
+#include <cfloat>
+#include <algorithm>
+
+namespace A3
+{
+struct MeshResource;
+struct VertexPosition;
+
+struct AABB
+{
+    Vec3 min = Vec3( FLT_MAX );
+    Vec3 max = Vec3( -FLT_MAX );
+
+    void grow( const Vec3& p )
+    {
+        min = Vec3( std::min( min.x, p.x ), std::min( min.y, p.y ), std::min( min.z, p.z ) );
+        max = Vec3( std::max( max.x, p.x ), std::max( max.y, p.y ), std::max( max.z, p.z ) );
+    }
+
+    void grow( const AABB& other )
+    {
+        min = Vec3( std::min( min.x, other.min.x ), std::min( min.y, other.min.y ), std::min( min.z, other.min.z ) );
+        max = Vec3( std::max( max.x, other.max.x ), std::max( max.y, other.max.y ), std::max( max.z, other.max.z ) );
+    }
+
+    Vec3 center() const { return ( min + max ) * 0.5f; }
+
+    float surfaceArea() const
+    {
+        const Vec3 extent = max - min;
+        if( extent.x < 0.0f )
+            return 0.0f;
+        return 2.0f * ( extent.x * extent.y + extent.y * extent.z + extent.z * extent.x );
+    }
+};
+
+// 32 bytes, stored in depth-first order so that the left child of an inner node is always the next node
+struct BVHNode
+{
+    Vec3 boundsMin;
+    uint32 rightOrFirst;    // Right child index for inner nodes, first entry of triangleIndices for leaves
+    Vec3 boundsMax;
+    uint32 triangleCount;   // 0 for inner nodes
+
+    bool isLeaf() const { return triangleCount != 0; }
+};
+static_assert( sizeof( BVHNode ) == 32, "BVHNode must stay 32 bytes" );
+
+// Binary BVH over the triangles of a mesh, built with binned SAH.
+// Subtrees and the binning of large nodes are distributed over the ThreadPool.
+class BVH
+{
+public:
+    void build( const MeshResource& mesh );
+    void build( const std::vector<VertexPosition>& positions, const std::vector<uint32>& indices );
+
+    const std::vector<BVHNode>& getNodes() const { return nodes; }
+    const std::vector<uint32>& getTriangleIndices() const { return triangleIndices; }
+    AABB getBounds() const;
+
+    uint32 getDepth() const { return depth; }
+
+private:
+    struct BuildNode
+    {
+        AABB bounds;
+        uint32 left;
+        uint32 first;
+        uint32 count;
+    };
+
+    struct BuildContext;
+
+    void buildNode( BuildContext& context, uint32 nodeIndex, uint32 first, uint32 count );
+    void flatten( const std::vector<BuildNode>& buildNodes );
+
+private:
+    std::vector<BVHNode> nodes;
+    std::vector<uint32> triangleIndices;
+    uint32 depth = 0;
+};
+}
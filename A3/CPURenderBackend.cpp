@@ -0,0 +1,1030 @@
+#define _CRT_SECURE_NO_WARNINGS
+
+#include "CPURenderBackend.h"
+#include "RenderSettings.h"
+#include "ThreadPool.h"
+#include "AccelerationStructure.h"
+#include "PipelineStateObject.h"
+#include "PathTracingRenderer.h" // For LightData
+#include "MeshObject.h"
+#include "CameraObject.h"
+#include "Scene.h"
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <stdexcept>
+
+#include "stb_image.h"
+#include "stb_image_write.h"
+
+using namespace A3;
+
+namespace
+{
+constexpr float PI = 3.1415926535897932384626433832795f;
+constexpr float MIRROR_ROUGH = 0.015f;
+constexpr float INF_CLAMP = 1e30f;
+constexpr float RAY_T_MAX = 100.0f;
+constexpr uint32 TILE_SIZE = 16;
+
+//=========================
+//   Math helpers
+//=========================
+Vec3 transformPoint( const Mat4x4& m, const Vec3& p )
+{
+    return Vec3(
+        m.m00 * p.x + m.m01 * p.y + m.m02 * p.z + m.m03,
+        m.m10 * p.x + m.m11 * p.y + m.m12 * p.z + m.m13,
+        m.m20 * p.x + m.m21 * p.y + m.m22 * p.z + m.m23 );
+}
+
+Vec3 transformVector( const Mat4x4& m, const Vec3& v )
+{
+    return Vec3(
+        m.m00 * v.x + m.m01 * v.y + m.m02 * v.z,
+        m.m10 * v.x + m.m11 * v.y + m.m12 * v.z,
+        m.m20 * v.x + m.m21 * v.y + m.m22 * v.z );
+}
+
+Vec3 transformVector( const Mat3x3& m, const Vec3& v )
+{
+    return Vec3(
+        m.m00 * v.x + m.m01 * v.y + m.m02 * v.z,
+        m.m10 * v.x + m.m11 * v.y + m.m12 * v.z,
+        m.m20 * v.x + m.m21 * v.y + m.m22 * v.z );
+}
+
+// Inverse of an affine transform (rotation * scale + translation), which is all SceneObject produces
+Mat4x4 inverseAffine( const Mat4x4& m, Mat3x3& outInverse3x3 )
+{
+    const float c00 = m.m11 * m.m22 - m.m12 * m.m21;
+    const float c01 = m.m12 * m.m20 - m.m10 * m.m22;
+    const float c02 = m.m10 * m.m21 - m.m11 * m.m20;
+    const float det = m.m00 * c00 + m.m01 * c01 + m.m02 * c02;
+    const float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+
+    Mat3x3& r = outInverse3x3;
+    r.m00 = c00 * invDet;
+    r.m01 = ( m.m02 * m.m21 - m.m01 * m.m22 ) * invDet;
+    r.m02 = ( m.m01 * m.m12 - m.m02 * m.m11 ) * invDet;
+    r.m10 = c01 * invDet;
+    r.m11 = ( m.m00 * m.m22 - m.m02 * m.m20 ) * invDet;
+    r.m12 = ( m.m02 * m.m10 - m.m00 * m.m12 ) * invDet;
+    r.m20 = c02 * invDet;
+    r.m21 = ( m.m01 * m.m20 - m.m00 * m.m21 ) * invDet;
+    r.m22 = ( m.m00 * m.m11 - m.m01 * m.m10 ) * invDet;
+
+    const Vec3 t = transformVector( r, Vec3( m.m03, m.m13, m.m23 ) );
+
+    return Mat4x4{
+        r.m00, r.m01, r.m02, -t.x,
+        r.m10, r.m11, r.m12, -t.y,
+        r.m20, r.m21, r.m22, -t.z,
+        0.0f,  0.0f,  0.0f,  1.0f };
+}
+
+Mat3x3 transpose( const Mat3x3& m )
+{
+    return Mat3x3{
+        m.m00, m.m10, m.m20,
+        m.m01, m.m11, m.m21,
+        m.m02, m.m12, m.m22 };
+}
+
+Vec3 toVec3( const VertexPosition& p ) { return Vec3( p.x, p.y, p.z ); }
+
+float clamp( float value, float low, float high ) { return std::min( std::max( value, low ), high ); }
+float mix( float a, float b, float t ) { return a + ( b - a ) * t; }
+Vec3 mix( const Vec3& a, const Vec3& b, float t ) { return a + ( b - a ) * t; }
+Vec3 reflect( const Vec3& i, const Vec3& n ) { return i - n * ( 2.0f * dot( n, i ) ); }
+Vec3 minVec( const Vec3& v, float s ) { return Vec3( std::min( v.x, s ), std::min( v.y, s ), std::min( v.z, s ) ); }
+
+//=========================
+//   Sampler.glsl
+//=========================
+uint32 pcgHash( uint32 seed )
+{
+    const uint32 state = seed * 747796405u + 2891336453u;
+    const uint32 word = ( ( state >> ( ( state >> 28u ) + 4u ) ) ^ state ) * 277803737u;
+    return ( word >> 22u ) ^ word;
+}
+
+float random( uint32& rngState )
+{
+    rngState = pcgHash( rngState );
+    return float( rngState ) / float( 0xffffffffu );
+}
+
+float powerHeuristic( float pdfA, float pdfB )
+{
+    const float maxPdf = std::max( pdfA, pdfB );
+    const float a = pdfA / maxPdf;
+    const float b = pdfB / maxPdf;
+    return ( a * a ) / ( a * a + b * b );
+}
+
+// Columns of the tangent frame, same as mat3( T, B, N ) in GLSL
+struct TangentFrame
+{
+    Vec3 t;
+    Vec3 b;
+    Vec3 n;
+
+    Vec3 toWorld( const Vec3& v ) const { return t * v.x + b * v.y + n * v.z; }
+    Vec3 toLocal( const Vec3& v ) const { return Vec3( dot( t, v ), dot( b, v ), dot( n, v ) ); }
+};
+
+TangentFrame createTangentSpace( const Vec3& normal )
+{
+    const Vec3 up = std::fabs( normal.y ) < 0.999f ? Vec3( 0.0f, 1.0f, 0.0f ) : Vec3( 0.0f, 0.0f, 1.0f );
+    const Vec3 tangent = normalize( cross( up, normal ) );
+    const Vec3 bitangent = normalize( cross( normal, tangent ) );
+    return { tangent, bitangent, normal };
+}
+
+Vec3 randomCosineHemisphere( const Vec3& worldNormal, float xi0, float xi1 )
+{
+    const float r = std::sqrt( xi0 );
+    const float phi = 2.0f * 3.1415926f * xi1;
+    const float x = r * std::cos( phi );
+    const float y = r * std::sin( phi );
+    const float z = std::sqrt( std::max( 0.0f, 1.0f - x * x - y * y ) );
+    return normalize( createTangentSpace( worldNormal ).toWorld( Vec3( x, y, z ) ) );
+}
+
+Vec3 rotateY( float angle, const Vec3& v )
+{
+    const float c = std::cos( angle );
+    const float s = std::sin( angle );
+    return Vec3( c * v.x + s * v.z, v.y, -s * v.x + c * v.z );
+}
+
+//=========================
+//   BRDF.glsl
+//=========================
+Vec3 schlickF( const Vec3& viewDir, const Vec3& halfDir, const Vec3& F0 )
+{
+    const float dotHV = std::max( dot( viewDir, halfDir ), 0.0f );
+    return F0 + ( Vec3( 1.0f ) - F0 ) * std::pow( 1.0f - dotHV, 5.0f );
+}
+
+float ggxG1( const Vec3& normal, const Vec3& dir, float alpha )
+{
+    const float r = alpha + 1.0f;
+    const float k = ( r * r ) / 8.0f;
+    const float dotN = std::max( dot( normal, dir ), 1e-6f );
+    return dotN / ( dotN * ( 1.0f - k ) + k );
+}
+
+float ggxG2( const Vec3& normal, const Vec3& viewDir, const Vec3& lightDir, float alpha )
+{
+    return ggxG1( normal, viewDir, alpha ) * ggxG1( normal, lightDir, alpha );
+}
+
+float ggxD( const Vec3& normal, const Vec3& halfDir, float alpha )
+{
+    const float a2 = alpha * alpha;
+    const float dotNH = std::max( dot( normal, halfDir ), 1e-6f );
+    const float denom = dotNH * dotNH * ( a2 - 1.0f ) + 1.0f;
+    return a2 / ( PI * denom * denom );
+}
+
+Vec3 calculateBRDF( const Vec3& normal, const Vec3& viewDir, const Vec3& lightDir, const Vec3& halfDir, const Vec3& color, float metallic, float alpha )
+{
+    const float dotNV = std::max( dot( normal, viewDir ), 0.0f );
+    const float dotNL = std::max( dot( normal, lightDir ), 0.0f );
+
+    const Vec3 F0 = mix( Vec3( 0.04f ), color, metallic );
+
+    const float ndf = ggxD( normal, halfDir, alpha );
+    const float geometry = ggxG2( normal, viewDir, lightDir, alpha );
+    const Vec3 fresnel = schlickF( viewDir, halfDir, F0 );
+
+    const Vec3 num = minVec( fresnel * ( ndf * geometry ), INF_CLAMP );
+    const float denom = 4.0f * dotNV * dotNL;
+    const Vec3 specular = num / std::max( denom, 1e-6f );
+
+    const Vec3 diffuse = color * ( ( 1.0f - metallic ) / PI );
+
+    return diffuse + specular;
+}
+
+Vec3 sampleGGXVNDF( const Vec3& v, float alphaX, float alphaY, float u1, float u2 )
+{
+    const Vec3 vh = normalize( Vec3( alphaX * v.x, alphaY * v.y, v.z ) );
+
+    const float lenSq = vh.x * vh.x + vh.y * vh.y;
+    const Vec3 T1 = lenSq > 0.0f ? Vec3( -vh.y, vh.x, 0.0f ) * ( 1.0f / std::sqrt( lenSq ) ) : Vec3( 1.0f, 0.0f, 0.0f );
+    const Vec3 T2 = cross( vh, T1 );
+
+    const float r = std::sqrt( u1 );
+    const float phi = 2.0f * PI * u2;
+    const float t1 = r * std::cos( phi );
+    float t2 = r * std::sin( phi );
+    const float s = 0.5f * ( 1.0f + vh.z );
+    t2 = ( 1.0f - s ) * std::sqrt( 1.0f - t1 * t1 ) + s * t2;
+
+    const Vec3 nh = T1 * t1 + T2 * t2 + vh * std::sqrt( std::max( 0.0f, 1.0f - t1 * t1 - t2 * t2 ) );
+    return normalize( Vec3( alphaX * nh.x, alphaY * nh.y, std::max( 0.0f, nh.z ) ) );
+}
+
+float pdfGGXVNDF( const Vec3& normal, const Vec3& viewDir, const Vec3& halfDir, float alpha )
+{
+    const float D = ggxD( normal, halfDir, alpha );
+    const float dotHV = std::max( dot( viewDir, halfDir ), 1e-6f );
+    const float dotHN = std::max( dot( halfDir, normal ), 1e-6f );
+    return std::min( D * dotHN / ( 4.0f * dotHV ), INF_CLAMP );
+}
+
+TangentFrame computeTBN( const Vec3& worldNormal )
+{
+    const Vec3 up = std::fabs( worldNormal.z ) < 0.999f ? Vec3( 0.0f, 0.0f, 1.0f ) : Vec3( 0.0f, 1.0f, 0.0f );
+    const Vec3 T = normalize( cross( up, worldNormal ) );
+    const Vec3 B = cross( worldNormal, T );
+    return { T, B, worldNormal };
+}
+
+//=========================
+//   Intersection helpers
+//=========================
+bool intersectAABB( const AABB& box, const Vec3& origin, const Vec3& invDir, float tMin, float tMax )
+{
+    const float tx0 = ( box.min.x - origin.x ) * invDir.x;
+    const float tx1 = ( box.max.x - origin.x ) * invDir.x;
+    const float ty0 = ( box.min.y - origin.y ) * invDir.y;
+    const float ty1 = ( box.max.y - origin.y ) * invDir.y;
+    const float tz0 = ( box.min.z - origin.z ) * invDir.z;
+    const float tz1 = ( box.max.z - origin.z ) * invDir.z;
+
+    const float tNear = std::max( std::max( std::min( tx0, tx1 ), std::min( ty0, ty1 ) ), std::max( std::min( tz0, tz1 ), tMin ) );
+    const float tFar = std::min( std::min( std::max( tx0, tx1 ), std::max( ty0, ty1 ) ), std::min( std::max( tz0, tz1 ), tMax ) );
+    return tNear <= tFar;
+}
+
+Vec3 safeInverse( const Vec3& dir )
+{
+    auto inv = []( float x ) { return 1.0f / ( std::fabs( x ) > 1e-20f ? x : std::copysign( 1e-20f, x ) ); };
+    return Vec3( inv( dir.x ), inv( dir.y ), inv( dir.z ) );
+}
+
+WideRay toObjectRay( const CPURenderBackend::Instance& instance, const CPURenderBackend::Ray& ray, float tMax )
+{
+    const Vec3 origin = transformPoint( instance.worldToObject, ray.origin );
+    const Vec3 dir = transformVector( instance.worldToObject, ray.direction );
+    return { { origin.x, origin.y, origin.z }, { dir.x, dir.y, dir.z }, ray.tMin, tMax };
+}
+
+}
+
+CPURenderBackend::CPURenderBackend( int32 screenWidth, int32 screenHeight )
+    : width( screenWidth )
+    , height( screenHeight )
+    , maxDepth( 0 )
+    , rouletteMinDepth( 0 )
+    , numSamples( 1 )
+    , isProgressive( 1 )
+    , envmapRotDeg( 0.0f )
+    , yFovDegree( 60.0f )
+    , exposure( 1.0f )
+    , envWidth( 0 )
+    , envHeight( 0 )
+{
+}
+
+CPURenderBackend::~CPURenderBackend()
+{
+}
+
+void CPURenderBackend::beginFrame( int32 screenWidth, int32 screenHeight )
+{
+}
+
+void CPURenderBackend::endFrame()
+{
+}
+
+void CPURenderBackend::beginRaytracingPipeline( IRenderPipeline* inPipeline )
+{
+    const CPUPipeline* pipeline = static_cast< const CPUPipeline* >( inPipeline );
+    assert( pipeline != nullptr );
+
+    CameraObject* co = tempScenePointer->getCamera();
+    const Mat4x4& cameraToWorld = co->getLocalToWorld();
+    cameraPos = Vec3( cameraToWorld.m03, cameraToWorld.m13, cameraToWorld.m23 );
+    yFovDegree = co->getFov();
+    exposure = co->getExposure();
+
+    const uint32 tileCountX = ( width + TILE_SIZE - 1 ) / TILE_SIZE;
+    const uint32 tileCountY = ( height + TILE_SIZE - 1 ) / TILE_SIZE;
+    ThreadPool::get().parallelFor( tileCountX * tileCountY, 1, [ this, pipeline ]( uint32 tileIndex )
+        {
+            renderTile( *pipeline, tileIndex );
+        } );
+}
+
+void CPURenderBackend::rebuildAccelerationStructure()
+{
+    accumulationImage.assign( width * height, Vec3( 0.0f ) );
+    outImage.assign( width * height * 4, 0 );
+    createEnvironmentMap( RenderSettings::envMapPath );
+}
+
+IAccelerationStructureRef CPURenderBackend::createBLAS( const BLASBuildParams params )
+{
+    CPUAccelerationStructure* outBlas = new CPUAccelerationStructure();
+    outBlas->positions = params.positionData;
+    outBlas->attributes = params.attributeData;
+    outBlas->indices = params.indexData;
+    outBlas->cumulativeTriangleArea = params.cumulativeTriangleAreaData;
+    outBlas->bvh.build( outBlas->positions, outBlas->indices );
+
+    return IAccelerationStructureRef( outBlas );
+}
+
+std::vector<IAccelerationStructureRef> CPURenderBackend::createBLASes( const std::vector<BLASBuildParams>& params )
+{
+    std::vector<IAccelerationStructureRef> outBlases( params.size() );
+
+    // BVH builds are independent, one task per mesh
+    ThreadPool::get().parallelFor( static_cast< uint32 >( params.size() ), 1, [ & ]( uint32 index )
+        {
+            outBlases[ index ] = createBLAS( params[ index ] );
+        } );
+
+    return outBlases;
+}
+
+void CPURenderBackend::createTLAS( const std::vector<BLASBatch*>& batches )
+{
+    instances.clear();
+
+    // Instance order matches the GPU TLAS, so that instance index == custom index == SBT record offset
+    for( int32 batchIndex = 0; batchIndex < batches.size(); ++batchIndex )
+    {
+        BLASBatch* batch = batches[ batchIndex ];
+        const CPUAccelerationStructure* blas = static_cast< const CPUAccelerationStructure* >( batch->blas.get() );
+
+        for( int32 instanceIndex = 0; instanceIndex < batch->transforms.size(); ++instanceIndex )
+        {
+            Instance instance;
+            instance.blas = blas;
+            instances.push_back( instance );
+        }
+    }
+
+    updateTLAS( batches );
+}
+
+void CPURenderBackend::updateTLAS( const std::vector<BLASBatch*>& batches )
+{
+    sceneBounds = AABB();
+
+    for( int32 batchIndex = 0, objectIndex = 0; batchIndex < batches.size(); ++batchIndex )
+    {
+        BLASBatch* batch = batches[ batchIndex ];
+
+        for( int32 instanceIndex = 0; instanceIndex < batch->transforms.size(); ++instanceIndex, ++objectIndex )
+        {
+            assert( objectIndex < instances.size() );
+            Instance& instance = instances[ objectIndex ];
+            instance.objectToWorld = batch->transforms[ instanceIndex ];
+
+            Mat3x3 inverse3x3;
+            instance.worldToObject = inverseAffine( instance.objectToWorld, inverse3x3 );
+            instance.normalMatrix = transpose( inverse3x3 );
+
+            instance.worldBounds = AABB();
+            const AABB local = instance.blas->bvh.getBounds();
+            for( uint32 corner = 0; corner < 8; ++corner )
+            {
+                const Vec3 p(
+                    ( corner & 1 ) ? local.max.x : local.min.x,
+                    ( corner & 2 ) ? local.max.y : local.min.y,
+                    ( corner & 4 ) ? local.max.z : local.min.z );
+                instance.worldBounds.grow( transformPoint( instance.objectToWorld, p ) );
+            }
+            sceneBounds.grow( instance.worldBounds );
+        }
+    }
+}
+
+IShaderModuleRef CPURenderBackend::createShaderModule( const ShaderDesc& desc )
+{
+    return IShaderModuleRef( new CPUShaderModule( desc ) );
+}
+
+IRenderPipelineRef CPURenderBackend::createRayTracingPipeline( const RaytracingPSODesc& psoDesc, RaytracingPSO* pso )
+{
+    CPUPipeline* outPipeline = new CPUPipeline();
+
+    for( const ShaderDesc& desc : psoDesc.shaders )
+    {
+        if( desc.type != SS_RayGeneration )
+            continue;
+
+        const bool bNEE = desc.specializationConstants[ SC_LightSamplingMode ] == imguiParam::NEE;
+        const bool bEnvMap = desc.specializationConstants[ SC_LightSelection ] != imguiParam::LightOnly;
+        if( bEnvMap )
+            outPipeline->integrator = bNEE ? CI_NEEEnvMap : CI_BruteForceEnvMap;
+        else
+            outPipeline->integrator = bNEE ? CI_NEELightOnly : CI_BruteForceLightOnly;
+    }
+
+    // Same material records as the hit group of the shader binding table
+    std::vector<MeshObject*> objects = tempScenePointer->collectMeshObjects();
+    outPipeline->materials.resize( objects.size() );
+    for( size_t i = 0; i < objects.size(); ++i )
+    {
+        outPipeline->materials[ i ] = { objects[ i ]->getBaseColor(), objects[ i ]->getMetallic(), objects[ i ]->getRoughness() };
+    }
+
+    return IRenderPipelineRef( outPipeline );
+}
+
+void CPURenderBackend::updateLightBuffer( const std::vector<LightData>& inLights )
+{
+    lights = inLights;
+
+    instanceLights.assign( instances.size(), INVALID_LIGHT_INDEX );
+    for( uint32 i = 0; i < lights.size(); ++i )
+    {
+        if( lights[ i ].instanceIndex < instanceLights.size() )
+            instanceLights[ lights[ i ].instanceIndex ] = i;
+    }
+}
+
+void CPURenderBackend::updateImguiBuffer()
+{
+    const imguiParam* param = tempScenePointer->getImguiParam();
+    maxDepth = param->maxDepth;
+    rouletteMinDepth = param->rouletteMinDepth;
+    numSamples = param->numSamples;
+    isProgressive = param->isProgressive;
+    envmapRotDeg = param->envmapRotDeg;
+}
+
+void CPURenderBackend::saveCurrentImage( const std::string& filename )
+{
+    std::string folder = "output_images";
+    std::string path = folder + "/" + filename;
+
+    if( !std::filesystem::exists( folder ) )
+        std::filesystem::create_directories( folder );
+
+    int result = stbi_write_png( path.c_str(), width, height, 4, outImage.data(), width * 4 );
+    if( result ) {
+        printf( "Image saved as: %s\n", path.c_str() );
+    } else {
+        printf( "Failed to save image: %s\n", path.c_str() );
+    }
+}
+
+//=========================
+//   Traversal
+//=========================
+bool CPURenderBackend::traceClosestHit( const Ray& ray, HitInfo& outHit ) const
+{
+    bool bHit = false;
+    float closestT = ray.tMax;
+    const Vec3 worldInvDir = safeInverse( ray.direction );
+
+    for( uint32 instanceIndex = 0; instanceIndex < instances.size(); ++instanceIndex )
+    {
+        const Instance& instance = instances[ instanceIndex ];
+        if( !intersectAABB( instance.worldBounds, ray.origin, worldInvDir, ray.tMin, closestT ) )
+            continue;
+
+        // The direction is not normalized in object space, so t stays comparable across instances
+        WideHit hit;
+        if( instance.blas->bvh.intersect( toObjectRay( instance, ray, closestT ), hit ) )
+        {
+            closestT = hit.t;
+            outHit = { hit.t, hit.u, hit.v, instanceIndex, hit.triangleIndex };
+            bHit = true;
+        }
+    }
+
+    return bHit;
+}
+
+bool CPURenderBackend::traceAnyHit( const Ray& ray ) const
+{
+    const Vec3 worldInvDir = safeInverse( ray.direction );
+
+    for( const Instance& instance : instances )
+    {
+        if( !intersectAABB( instance.worldBounds, ray.origin, worldInvDir, ray.tMin, ray.tMax ) )
+            continue;
+
+        if( instance.blas->bvh.occluded( toObjectRay( instance, ray, ray.tMax ) ) )
+            return true;
+    }
+
+    return false;
+}
+
+//=========================
+//   Ray generation
+//=========================
+void CPURenderBackend::renderTile( const CPUPipeline& pipeline, uint32 tileIndex )
+{
+    const Vec3 cameraX( 1.0f, 0.0f, 0.0f );
+    const Vec3 cameraY( 0.0f, -1.0f, 0.0f );
+    const Vec3 cameraZ( 0.0f, 0.0f, -1.0f );
+    const float aspectY = std::tan( yFovDegree * ( PI / 180.0f ) * 0.5f );
+    const float aspectX = aspectY * float( width ) / float( height );
+
+    const uint32 tileCountX = ( width + TILE_SIZE - 1 ) / TILE_SIZE;
+    const uint32 beginX = ( tileIndex % tileCountX ) * TILE_SIZE;
+    const uint32 beginY = ( tileIndex / tileCountX ) * TILE_SIZE;
+    const uint32 endX = std::min( beginX + TILE_SIZE, width );
+    const uint32 endY = std::min( beginY + TILE_SIZE, height );
+
+    for( uint32 y = beginY; y < endY; ++y )
+    {
+        for( uint32 x = beginX; x < endX; ++x )
+        {
+            const uint32 pixelIndex = y * width + x;
+            uint32 seed = pixelIndex;
+            if( isProgressive != 0 )
+                seed = pixelIndex + currentFrameCount * 1664525u;
+
+            uint32 rngState = pcgHash( seed );
+
+            // Anti-aliasing jitter
+            const float r1 = random( rngState );
+            const float r2 = random( rngState );
+            const float ndcX = ( float( x ) + r1 ) / float( width ) * 2.0f - 1.0f;
+            const float ndcY = ( float( y ) + r2 ) / float( height ) * 2.0f - 1.0f;
+            const Vec3 rayDir = normalize( cameraX * ( ndcX * aspectX ) + cameraY * ( ndcY * aspectY ) + cameraZ );
+
+            // Every sample is a full path through the same camera ray
+            const uint32 sampleCount = std::max( numSamples, 1u );
+            Vec3 currentSample( 0.0f );
+            for( uint32 i = 0; i < sampleCount; ++i )
+                currentSample += tracePath( pipeline, cameraPos, rayDir, rngState );
+            currentSample *= 1.0f / float( sampleCount );
+
+            Vec3 finalColor = currentSample;
+            if( isProgressive != 0 )
+            {
+                const Vec3 previousAccumulation = currentFrameCount > 1 ? accumulationImage[ pixelIndex ] : Vec3( 0.0f );
+                const Vec3 accumulated = ( previousAccumulation * float( currentFrameCount - 1 ) + currentSample ) / float( currentFrameCount );
+                accumulationImage[ pixelIndex ] = accumulated;
+                finalColor = accumulated;
+            }
+
+            const float channels[ 3 ] = { finalColor.x, finalColor.y, finalColor.z };
+            for( uint32 channel = 0; channel < 3; ++channel )
+            {
+                const float mapped = std::pow( 1.0f - std::exp( -exposure * channels[ channel ] ), 1.0f / 2.2f );
+                outImage[ pixelIndex * 4 + channel ] = static_cast< uint8 >( clamp( mapped, 0.0f, 1.0f ) * 255.0f + 0.5f );
+            }
+            outImage[ pixelIndex * 4 + 3 ] = 255;
+        }
+    }
+}
+
+// Radiance of one path starting with the camera ray, same loop as tracePath of SampleRaytracing.glsl
+Vec3 CPURenderBackend::tracePath( const CPUPipeline& pipeline, Vec3 rayOrigin, Vec3 rayDir, uint32& rngState ) const
+{
+    const bool bNEE = pipeline.integrator == CI_NEELightOnly || pipeline.integrator == CI_NEEEnvMap;
+    const bool bEnvMap = pipeline.integrator == CI_BruteForceEnvMap || pipeline.integrator == CI_NEEEnvMap;
+
+    Vec3 radiance( 0.0f );
+    Vec3 throughput( 1.0f );
+    float pdfBRDF = 0.0f;
+    float tMin = 0.0f;
+
+    for( uint32 depth = 0; ; ++depth )
+    {
+        HitInfo hit;
+        if( !traceClosestHit( { rayOrigin, rayDir, tMin, RAY_T_MAX }, hit ) )
+        {
+            if( bEnvMap && depth < maxDepth && !envPixels.empty() )
+            {
+                // get envmap pdf for MIS
+                float weight = 1.0f;
+                if( depth > 0 )
+                    weight = powerHeuristic( pdfBRDF, getEnvPdf( rayDir ) );
+                radiance += throughput * getEmitFromEnvmap( rayDir ) * weight;
+            }
+            break;
+        }
+
+        const SurfaceInfo surface = getSurfaceInfo( hit );
+        const CPUPipeline::Material& material = pipeline.materials[ hit.instanceIndex ];
+        const Vec3 viewDir = -rayDir;
+
+        if( !bEnvMap )
+        {
+            const uint32 hitLight = hit.instanceIndex < instanceLights.size() ? instanceLights[ hit.instanceIndex ] : INVALID_LIGHT_INDEX;
+            if( hitLight != INVALID_LIGHT_INDEX )
+            {
+                const Vec3 lightEmittance( lights[ hitLight ].emission );
+                if( bNEE )
+                {
+                    // Emitters are only seen directly by the camera, later bounces reach them through light sampling
+                    if( depth == 0 )
+                        radiance += throughput * lightEmittance;
+                    break;
+                }
+                radiance += throughput * lightEmittance;
+            }
+        }
+
+        if( depth >= maxDepth )
+            break;
+
+        if( bNEE )
+        {
+            const Vec3 direct = bEnvMap ? sampleEnvironmentDirect( surface, viewDir, material, rngState )
+                                        : sampleLightDirect( surface, viewDir, material, rngState );
+            radiance += throughput * direct;
+        }
+
+        const BounceSample bounce = sampleBounce( pipeline, surface.worldNormal, viewDir, material, rngState );
+        throughput = throughput * bounce.throughput;
+        pdfBRDF = bounce.pdfBRDF;
+
+        // Russian roulette, same survival rule as SampleRaytracing.glsl
+        if( depth + 1 >= rouletteMinDepth )
+        {
+            const float survival = std::min( std::max( throughput.x, std::max( throughput.y, throughput.z ) ), 0.95f );
+            if( random( rngState ) >= survival )
+                break;
+            throughput = throughput * ( 1.0f / survival );
+        }
+
+        rayOrigin = surface.worldPos;
+        rayDir = bounce.rayDir;
+        tMin = 0.0001f;
+    }
+
+    return radiance;
+}
+
+//=========================
+//   Closest hit
+//=========================
+CPURenderBackend::SurfaceInfo CPURenderBackend::getSurfaceInfo( const HitInfo& hit ) const
+{
+    const Instance& instance = instances[ hit.instanceIndex ];
+    const CPUAccelerationStructure& blas = *instance.blas;
+
+    const uint32 base = hit.primitiveIndex * 3;
+    const uint32 i0 = blas.indices[ base + 0 ];
+    const uint32 i1 = blas.indices[ base + 1 ];
+    const uint32 i2 = blas.indices[ base + 2 ];
+
+    const float u = hit.u;
+    const float v = hit.v;
+    const float w = 1.0f - u - v;
+    const Vec3 position = toVec3( blas.positions[ i0 ] ) * w + toVec3( blas.positions[ i1 ] ) * u + toVec3( blas.positions[ i2 ] ) * v;
+
+    auto normalOf = [ &blas ]( uint32 index )
+        {
+            const float* n = blas.attributes[ index ].normals;
+            return normalize( Vec3( n[ 0 ], n[ 1 ], n[ 2 ] ) );
+        };
+    const Vec3 normal = normalize( normalOf( i0 ) * w + normalOf( i1 ) * u + normalOf( i2 ) * v );
+
+    return { transformPoint( instance.objectToWorld, position ), normalize( transformVector( instance.normalMatrix, normal ) ) };
+}
+
+Vec3 CPURenderBackend::sampleBRDFDirection( const Vec3& worldNormal, const Vec3& viewDir, float alpha, float prob, uint32& rngState,
+                                            bool& outIsGGX, Vec3& outHalfDir, float& outPdfGGX, float& outPdfCosine ) const
+{
+    const float a = random( rngState );
+    const float r3 = random( rngState );
+    const float r4 = random( rngState );
+
+    Vec3 rayDir;
+    outIsGGX = ( a >= prob );
+    if( outIsGGX )
+    {
+        const TangentFrame TBN = computeTBN( worldNormal );
+        const Vec3 viewDirLocal = normalize( TBN.toLocal( viewDir ) );
+        const Vec3 halfDirLocal = sampleGGXVNDF( viewDirLocal, alpha, alpha, r3, r4 );
+        outHalfDir = normalize( TBN.toWorld( halfDirLocal ) );
+        rayDir = reflect( -viewDir, outHalfDir );
+
+        outPdfGGX = pdfGGXVNDF( worldNormal, viewDir, outHalfDir, alpha );
+        outPdfCosine = std::max( dot( worldNormal, rayDir ), 1e-6f ) / PI;
+    }
+    else
+    {
+        rayDir = randomCosineHemisphere( worldNormal, r3, r4 );
+        outPdfCosine = std::max( dot( worldNormal, rayDir ), 1e-6f ) / PI;
+
+        outHalfDir = normalize( viewDir + rayDir );
+        outPdfGGX = pdfGGXVNDF( worldNormal, viewDir, outHalfDir, alpha );
+    }
+
+    return rayDir;
+}
+
+// Next direction of the path and the throughput it carries, MIS weighted between the GGX and cosine strategies
+CPURenderBackend::BounceSample CPURenderBackend::sampleBounce( const CPUPipeline& pipeline, const Vec3& worldNormal, const Vec3& viewDir,
+                                                               const CPUPipeline::Material& material, uint32& rngState ) const
+{
+    const float metallic = clamp( material.metallic, 0.0f, 1.0f );
+    const float roughness = clamp( material.roughness, MIRROR_ROUGH, 1.0f );
+    const float alpha = roughness * roughness;
+
+    const float prob = mix( 0.2f, 0.8f, roughness );
+    const float probGGX = 1.0f - prob;
+    const float probCos = prob;
+
+    bool isGGX;
+    Vec3 halfDir;
+    float pdfGGXVal, pdfCosineVal;
+    const Vec3 rayDir = sampleBRDFDirection( worldNormal, viewDir, alpha, prob, rngState, isGGX, halfDir, pdfGGXVal, pdfCosineVal );
+
+    const Vec3 brdf = calculateBRDF( worldNormal, viewDir, rayDir, halfDir, material.color, metallic, alpha );
+    const float cosP = std::max( dot( worldNormal, rayDir ), 1e-6f );
+
+    BounceSample bounce;
+    bounce.rayDir = rayDir;
+    if( pipeline.integrator == CI_BruteForceEnvMap )
+    {
+        // Mixture pdf of both strategies
+        bounce.pdfBRDF = probGGX * pdfGGXVal + probCos * pdfCosineVal;
+        bounce.throughput = brdf * ( cosP / bounce.pdfBRDF );
+    }
+    else
+    {
+        pdfGGXVal = probGGX * pdfGGXVal;
+        pdfCosineVal = probCos * pdfCosineVal;
+
+        const float weight = isGGX ? powerHeuristic( pdfGGXVal, pdfCosineVal )
+                                   : powerHeuristic( pdfCosineVal, pdfGGXVal );
+        bounce.pdfBRDF = isGGX ? pdfGGXVal : pdfCosineVal;
+        bounce.throughput = brdf * ( cosP * weight / bounce.pdfBRDF );
+    }
+
+    return bounce;
+}
+
+// One light sample on an area light picked by power, MIS weighted against the BRDF strategies
+Vec3 CPURenderBackend::sampleLightDirect( const SurfaceInfo& surface, const Vec3& viewDir, const CPUPipeline::Material& material, uint32& rngState ) const
+{
+    if( lights.empty() )
+        return Vec3( 0.0f );
+
+    const Vec3& worldPos = surface.worldPos;
+    const Vec3& worldNormal = surface.worldNormal;
+    const float metallic = clamp( material.metallic, 0.0f, 1.0f );
+    const float roughness = clamp( material.roughness, MIRROR_ROUGH, 1.0f );
+    const float alpha = roughness * roughness;
+
+    const float prob = mix( 0.2f, 0.8f, roughness );
+    const float probGGX = 1.0f - prob;
+    const float probCos = prob;
+
+    const uint32 lightIdx = sampleLightIndex( rngState );
+    const LightData& light = lights[ lightIdx ];
+    const uint32 triangleIdx = sampleLightTriangle( lightIdx, light.area, rngState );
+
+    Vec3 pointOnTriangleWorld, normalOnTriangleWorld;
+    samplePointOnLight( lightIdx, triangleIdx, pointOnTriangleWorld, normalOnTriangleWorld, rngState );
+
+    const Vec3 r = pointOnTriangleWorld - worldPos;
+    const float distance = length( r );
+    const Vec3 shadowRayDir = r / distance;
+
+    // @NOTE: The GPU compares the any-hit position against the sampled point, an occlusion test up to the light is equivalent
+    const Ray shadowRay{ worldPos, shadowRayDir, 0.001f, std::min( distance * ( 1.0f - 1e-4f ), RAY_T_MAX ) };
+    const float visibility = traceAnyHit( shadowRay ) ? 0.0f : 1.0f;
+
+    const float cosQ = std::max( dot( normalOnTriangleWorld, -shadowRayDir ), 1e-6f );
+    const float cosP = std::max( dot( worldNormal, shadowRayDir ), 1e-6f );
+    const float pdfLight = light.selectionPdf * dot( r, r ) / ( cosQ * light.area );
+
+    const Vec3 halfDir = normalize( viewDir + shadowRayDir );
+    const Vec3 brdf = calculateBRDF( worldNormal, viewDir, shadowRayDir, halfDir, material.color, metallic, alpha );
+
+    const float pdfGGX = pdfGGXVNDF( worldNormal, viewDir, halfDir, alpha );
+    const float pdfCos = cosP / PI;
+    const float pdfBRDF = probGGX * pdfGGX + probCos * pdfCos;
+
+    const float w = powerHeuristic( pdfLight, pdfBRDF );
+
+    return brdf * Vec3( light.emission ) * ( visibility * cosP * w / pdfLight );
+}
+
+// One importance sampled environment direction, MIS weighted against the BRDF strategies
+Vec3 CPURenderBackend::sampleEnvironmentDirect( const SurfaceInfo& surface, const Vec3& viewDir, const CPUPipeline::Material& material, uint32& rngState ) const
+{
+    const float eps = 1e-4f;
+    const Vec3& worldPos = surface.worldPos;
+    const Vec3& worldNormal = surface.worldNormal;
+    const float metallic = clamp( material.metallic, 0.0f, 1.0f );
+    const float roughness = clamp( material.roughness, MIRROR_ROUGH, 1.0f );
+    const float alpha = roughness * roughness;
+
+    const float prob = mix( 0.2f, 0.8f, roughness );
+    const float probGGX = 1.0f - prob;
+    const float probCos = prob;
+
+    float pdfEnv;
+    const Vec3 rayDir = sampleEnvDirection( rngState, pdfEnv );
+    if( pdfEnv <= 0.0f )
+        return Vec3( 0.0f );
+
+    const float visibility = traceAnyHit( { worldPos, rayDir, eps, RAY_T_MAX } ) ? 0.0f : 1.0f;
+    const Vec3 emit = getEmitFromEnvmap( rayDir );
+
+    const float cosP = std::max( dot( worldNormal, rayDir ), 1e-6f );
+    const Vec3 halfDir = normalize( viewDir + rayDir );
+    const Vec3 brdf = calculateBRDF( worldNormal, viewDir, rayDir, halfDir, material.color, metallic, alpha );
+
+    const float pdfGGX = pdfGGXVNDF( worldNormal, viewDir, halfDir, alpha );
+    const float pdfCos = cosP / PI;
+    const float pdfBRDF = probGGX * pdfGGX + probCos * pdfCos;
+
+    const float w = powerHeuristic( pdfEnv, pdfBRDF );
+
+    const float charFunc = dot( viewDir, worldNormal ) > 0.0f ? 1.0f : 0.0f;
+
+    return brdf * emit * ( cosP * visibility * charFunc * w / pdfEnv );
+}
+
+//=========================
+//   NEELightSampling.glsl
+//=========================
+uint32 CPURenderBackend::sampleLightIndex( uint32& rngState ) const
+{
+    const uint32 lightCount = static_cast< uint32 >( lights.size() );
+    if( lightCount <= 1 )
+        return 0;
+
+    uint32 lightIdx = std::min( static_cast< uint32 >( random( rngState ) * lightCount ), lightCount - 1 );
+    if( random( rngState ) >= lights[ lightIdx ].selectionThreshold )
+        lightIdx = lights[ lightIdx ].selectionAlias;
+    return lightIdx;
+}
+
+uint32 CPURenderBackend::sampleLightTriangle( uint32 lightIndex, float lightArea, uint32& rngState ) const
+{
+    const std::vector<float>& sum = instances[ lights[ lightIndex ].instanceIndex ].blas->cumulativeTriangleArea;
+    const float target = random( rngState ) * lightArea;
+
+    // @NOTE: sum is 1-based (sum[0] == 0), so the triangle covering ( sum[mid - 1], sum[mid] ] is mid - 1
+    uint32 l = 1;
+    uint32 r = lights[ lightIndex ].triangleCount;
+    while( l <= r )
+    {
+        const uint32 mid = l + ( r - l ) / 2;
+        if( sum[ mid - 1 ] < target && target <= sum[ mid ] )
+            return mid - 1;
+        else if( target > sum[ mid ] )
+            l = mid + 1;
+        else
+            r = mid - 1;
+    }
+
+    return 0;
+}
+
+void CPURenderBackend::samplePointOnLight( uint32 lightIndex, uint32 triangleIndex, Vec3& outPointWorld, Vec3& outNormalWorld, uint32& rngState ) const
+{
+    const CPUAccelerationStructure& blas = *instances[ lights[ lightIndex ].instanceIndex ].blas;
+
+    const uint32 base = triangleIndex * 3;
+    const uint32 i0 = blas.indices[ base + 0 ];
+    const uint32 i1 = blas.indices[ base + 1 ];
+    const uint32 i2 = blas.indices[ base + 2 ];
+
+    auto normalOf = [ &blas ]( uint32 index )
+        {
+            const float* n = blas.attributes[ index ].normals;
+            return normalize( Vec3( n[ 0 ], n[ 1 ], n[ 2 ] ) );
+        };
+
+    const float xi0 = random( rngState );
+    const float xi1 = random( rngState );
+    const float su0 = std::sqrt( xi0 );
+    const float u = 1.0f - su0;
+    const float v = xi1 * su0;
+    const float w = 1.0f - u - v;
+
+    const Vec3 pointOnTriangle = toVec3( blas.positions[ i0 ] ) * w + toVec3( blas.positions[ i1 ] ) * u + toVec3( blas.positions[ i2 ] ) * v;
+    const Vec3 normalOnTriangle = normalize( normalOf( i0 ) * w + normalOf( i1 ) * u + normalOf( i2 ) * v );
+
+    const Mat4x4& localToWorld = lights[ lightIndex ].transform;
+    outPointWorld = transformPoint( localToWorld, pointOnTriangle );
+    outNormalWorld = normalize( transformVector( localToWorld, normalOnTriangle ) );
+}
+
+//=========================
+//   Environment map
+//=========================
+void CPURenderBackend::createEnvironmentMap( std::string_view hdrTexturePath )
+{
+    int w, h, channels;
+    if( hdrTexturePath.empty() )
+        hdrTexturePath = RenderSettings::envMapDefault;
+    float* pixels = stbi_loadf( hdrTexturePath.data(), &w, &h, &channels, 3 );
+    if( pixels == nullptr )
+    {
+        printf( "Failed to load environment map: %s\n", hdrTexturePath.data() );
+        envPixels.clear();
+        envAliasTable.clear();
+        envWidth = envHeight = 0;
+        return;
+    }
+
+    envWidth = w;
+    envHeight = h;
+    envPixels.assign( pixels, pixels + w * h * 3 );
+    stbi_image_free( pixels );
+
+    // Same table as the GPU, see Utility::buildEnvironmentAliasTable
+    Utility::buildEnvironmentAliasTable( envAliasTable, envPixels.data(), envWidth, envHeight );
+}
+
+Vec3 CPURenderBackend::getEmitFromEnvmap( const Vec3& rayDir ) const
+{
+    if( envPixels.empty() )
+        return Vec3( 0.0f );
+
+    const Vec3 dir = rotateY( envmapRotDeg * ( PI / 180.0f ), rayDir );
+    float u = std::atan2( dir.z, dir.x ) / ( 2.0f * PI );
+    const float v = std::acos( clamp( dir.y, -1.0f, 1.0f ) ) / PI;
+    if( u < 0.0f ) u += 1.0f;
+
+    // Bilinear filtering with repeat addressing, same as the environment map sampler
+    const float fx = u * envWidth - 0.5f;
+    const float fy = v * envHeight - 0.5f;
+    const float x0f = std::floor( fx );
+    const float y0f = std::floor( fy );
+    const float tx = fx - x0f;
+    const float ty = fy - y0f;
+
+    auto wrap = []( int32 value, int32 size ) { return ( ( value % size ) + size ) % size; };
+    const int32 x0 = wrap( int32( x0f ), envWidth );
+    const int32 x1 = wrap( int32( x0f ) + 1, envWidth );
+    const int32 y0 = wrap( int32( y0f ), envHeight );
+    const int32 y1 = wrap( int32( y0f ) + 1, envHeight );
+
+    auto texel = [ this ]( int32 x, int32 y )
+        {
+            const float* p = &envPixels[ ( y * envWidth + x ) * 3 ];
+            return Vec3( p[ 0 ], p[ 1 ], p[ 2 ] );
+        };
+
+    return mix( mix( texel( x0, y0 ), texel( x1, y0 ), tx ), mix( texel( x0, y1 ), texel( x1, y1 ), tx ), ty );
+}
+
+// Texels are sampled uniformly inside, so the solid angle pdf only differs by the sin(theta) of the equirectangular mapping
+float CPURenderBackend::envSolidAnglePdf( float texelPdf, float v ) const
+{
+    const float sinTheta = std::max( std::sin( PI * v ), 1e-6f );
+    return texelPdf * float( envWidth * envHeight ) / ( 2.0f * PI * PI * sinTheta );
+}
+
+// Solid angle pdf of rayDir, matching sampleEnvDirection
+float CPURenderBackend::getEnvPdf( const Vec3& rayDir ) const
+{
+    if( envPixels.empty() )
+        return 0.0f;
+
+    const Vec3 dir = rotateY( envmapRotDeg * ( PI / 180.0f ), rayDir );
+    float u = std::atan2( dir.z, dir.x ) / ( 2.0f * PI );
+    const float v = std::acos( clamp( dir.y, -1.0f, 1.0f ) ) / PI;
+    if( u < 0.0f ) u += 1.0f;
+
+    const uint32 x = std::min( uint32( u * envWidth ), envWidth - 1 );
+    const uint32 y = std::min( uint32( v * envHeight ), envHeight - 1 );
+    return envSolidAnglePdf( envAliasTable[ y * envWidth + x ].pdf, v );
+}
+
+Vec3 CPURenderBackend::sampleEnvDirection( uint32& rngState, float& outPdf ) const
+{
+    const float xiBucket = random( rngState );
+    const float xiAlias = random( rngState );
+    const float xiU = random( rngState );
+    const float xiV = random( rngState );
+    if( envPixels.empty() )
+    {
+        outPdf = 0.0f;
+        return Vec3( 0.0f, 1.0f, 0.0f );
+    }
+
+    // Pick a bucket uniformly, then keep its texel or take its alias
+    const uint32 texelCount = envWidth * envHeight;
+    uint32 texel = std::min( static_cast< uint32 >( xiBucket * texelCount ), texelCount - 1 );
+    if( xiAlias >= envAliasTable[ texel ].threshold )
+        texel = envAliasTable[ texel ].alias;
+
+    const float u = ( float( texel % envWidth ) + xiU ) / float( envWidth );
+    const float v = ( float( texel / envWidth ) + xiV ) / float( envHeight );
+    outPdf = envSolidAnglePdf( envAliasTable[ texel ].pdf, v );
+
+    const float phi = 2.0f * PI * u;
+    const float theta = PI * v;
+    const float sinTheta = std::sin( theta );
+    const Vec3 dir( sinTheta * std::cos( phi ), std::cos( theta ), sinTheta * std::sin( phi ) );
+    return normalize( rotateY( -envmapRotDeg * ( PI / 180.0f ), dir ) );
+}
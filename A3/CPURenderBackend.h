@@ -0,0 +1,142 @@
+#pragma once
+
+#include "EngineTypes.h"
+#include "RenderBackend.h"
+#include "CPUResource.h"
+#include "Matrix.h"
+#include "Vector.h"
+#include "Utility.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace A3
+{
+struct LightData;
+
+// Multi-threaded software path tracer implementing the same backend interface as VulkanRenderBackend.
+// Runs the integrators of shaders/SampleRaytracing.glsl on the CPU, so that frames can be rendered
+// on machines without a ray tracing capable GPU and used as a reference for the GPU output.
+class CPURenderBackend : public IRenderBackend
+{
+public:
+    CPURenderBackend( int32 screenWidth, int32 screenHeight );
+    ~CPURenderBackend();
+
+    virtual void beginFrame( int32 screenWidth, int32 screenHeight ) override;
+    virtual void endFrame() override;
+
+    virtual void beginRaytracingPipeline( IRenderPipeline* inPipeline ) override;
+
+    virtual void rebuildAccelerationStructure() override;
+
+    virtual IAccelerationStructureRef createBLAS( const BLASBuildParams params ) override;
+    virtual std::vector<IAccelerationStructureRef> createBLASes( const std::vector<BLASBuildParams>& params ) override;
+    virtual void createTLAS( const std::vector<BLASBatch*>& batches ) override;
+    virtual void updateTLAS( const std::vector<BLASBatch*>& batches ) override;
+    virtual IShaderModuleRef createShaderModule( const ShaderDesc& desc ) override;
+    virtual IRenderPipelineRef createRayTracingPipeline( const RaytracingPSODesc& psoDesc, RaytracingPSO* pso ) override;
+    virtual void updateLightBuffer( const std::vector<LightData>& lights ) override;
+    virtual void updateImguiBuffer() override;
+
+    void saveCurrentImage( const std::string& filename );
+
+    const std::vector<uint8>& getOutImage() const { return outImage; }
+
+public:
+    struct Ray
+    {
+        Vec3 origin;
+        Vec3 direction;
+        float tMin;
+        float tMax;
+    };
+
+    struct HitInfo
+    {
+        float t;
+        float u;
+        float v;
+        uint32 instanceIndex;
+        uint32 primitiveIndex;
+    };
+
+    struct Instance
+    {
+        const CPUAccelerationStructure* blas;
+        Mat4x4 objectToWorld;
+        Mat4x4 worldToObject;
+        Mat3x3 normalMatrix;
+        AABB worldBounds;
+    };
+
+    struct SurfaceInfo
+    {
+        Vec3 worldPos;
+        Vec3 worldNormal;
+    };
+
+    bool traceClosestHit( const Ray& ray, HitInfo& outHit ) const;
+    bool traceAnyHit( const Ray& ray ) const;
+
+private:
+    struct BounceSample
+    {
+        Vec3 rayDir;
+        Vec3 throughput;
+        float pdfBRDF;
+    };
+
+    void createEnvironmentMap( std::string_view hdrTexturePath );
+
+    void renderTile( const CPUPipeline& pipeline, uint32 tileIndex );
+
+    Vec3 tracePath( const CPUPipeline& pipeline, Vec3 rayOrigin, Vec3 rayDir, uint32& rngState ) const;
+
+    SurfaceInfo getSurfaceInfo( const HitInfo& hit ) const;
+    Vec3 sampleBRDFDirection( const Vec3& worldNormal, const Vec3& viewDir, float alpha, float prob, uint32& rngState,
+                              bool& outIsGGX, Vec3& outHalfDir, float& outPdfGGX, float& outPdfCosine ) const;
+    BounceSample sampleBounce( const CPUPipeline& pipeline, const Vec3& worldNormal, const Vec3& viewDir,
+                               const CPUPipeline::Material& material, uint32& rngState ) const;
+    Vec3 sampleLightDirect( const SurfaceInfo& surface, const Vec3& viewDir, const CPUPipeline::Material& material, uint32& rngState ) const;
+    Vec3 sampleEnvironmentDirect( const SurfaceInfo& surface, const Vec3& viewDir, const CPUPipeline::Material& material, uint32& rngState ) const;
+
+    uint32 sampleLightIndex( uint32& rngState ) const;
+    uint32 sampleLightTriangle( uint32 lightIndex, float lightArea, uint32& rngState ) const;
+    void samplePointOnLight( uint32 lightIndex, uint32 triangleIndex, Vec3& outPointWorld, Vec3& outNormalWorld, uint32& rngState ) const;
+
+    Vec3 getEmitFromEnvmap( const Vec3& rayDir ) const;
+    float envSolidAnglePdf( float texelPdf, float v ) const;
+    float getEnvPdf( const Vec3& rayDir ) const;
+    Vec3 sampleEnvDirection( uint32& rngState, float& outPdf ) const;
+
+private:
+    uint32 width;
+    uint32 height;
+
+    std::vector<Instance> instances;
+    AABB sceneBounds;
+
+    std::vector<LightData> lights;
+    std::vector<uint32> instanceLights;    // Light of every instance, INVALID_LIGHT_INDEX when it does not emit
+
+    uint32 maxDepth;
+    uint32 rouletteMinDepth;
+    uint32 numSamples;
+    uint32 isProgressive;
+    float envmapRotDeg;
+
+    Vec3 cameraPos;
+    float yFovDegree;
+    float exposure;
+
+    // Environment map and its alias table, one bucket per texel
+    uint32 envWidth;
+    uint32 envHeight;
+    std::vector<float> envPixels;
+    std::vector<Utility::EnvAliasEntry> envAliasTable;
+
+    std::vector<Vec3> accumulationImage;
+    std::vector<uint8> outImage;
+};
+}
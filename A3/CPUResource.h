@@ -0,0 +1,62 @@
+#pragma once
+
+#include "RenderResource.h"
+#include "MeshResource.h"
+#include "Shader.h"
+#include "Matrix.h"
+#include "WideBVH.h"
+#include <vector>
+
+namespace A3
+{
+struct CPUAccelerationStructure : public IAccelerationStructure
+{
+public:
+    virtual ~CPUAccelerationStructure()
+    {}
+
+public:
+    std::vector<VertexPosition> positions;
+    std::vector<VertexAttributes> attributes;
+    std::vector<uint32> indices;
+    std::vector<float> cumulativeTriangleArea;
+
+    WideBVH bvh;
+};
+
+struct CPUShaderModule : public IShaderModule
+{
+public:
+    CPUShaderModule( const ShaderDesc& inDesc )
+        : desc( inDesc )
+    {}
+
+public:
+    // The CPU backend has no shader code, createRayTracingPipeline picks the integrator from the specialization constants of the ray generation desc
+    ShaderDesc desc;
+};
+
+enum ECPUIntegrator
+{
+    CI_BruteForceLightOnly,
+    CI_NEELightOnly,
+    CI_BruteForceEnvMap,
+    CI_NEEEnvMap,
+};
+
+struct CPUPipeline : public IRenderPipeline
+{
+public:
+    struct Material
+    {
+        Vec3 color;
+        float metallic;
+        float roughness;
+    };
+
+    ECPUIntegrator integrator = CI_BruteForceLightOnly;
+
+    // Indexed by instance, same as the hit group records of the shader binding table
+    std::vector<Material> materials;
+};
+}
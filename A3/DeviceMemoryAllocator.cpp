@@ -0,0 +1,285 @@
+#include "DeviceMemoryAllocator.h"
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+using namespace A3;
+
+namespace
+{
+constexpr VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;
+
+VkDeviceSize alignUp( VkDeviceSize value, VkDeviceSize alignment )
+{
+    return ( value + alignment - 1 ) / alignment * alignment;
+}
+}
+
+float DeviceMemoryStats::getFragmentation() const
+{
+    const uint64 freeBytes = reservedBytes - usedBytes;
+    if( freeBytes == 0 || freeRangeCount == 0 )
+        return 0.0f;
+
+    return 1.0f - static_cast< float >( contiguousFreeBytes ) / static_cast< float >( freeBytes );
+}
+
+DeviceMemoryAllocator::DeviceMemoryAllocator()
+    : device( VK_NULL_HANDLE )
+    , memoryProperties{}
+    , dedicatedAllocationCount( 0 )
+    , dedicatedBytes( 0 )
+{}
+
+DeviceMemoryAllocator::~DeviceMemoryAllocator()
+{
+    shutdown();
+}
+
+void DeviceMemoryAllocator::initialize( VkPhysicalDevice physicalDevice, VkDevice inDevice )
+{
+    device = inDevice;
+    vkGetPhysicalDeviceMemoryProperties( physicalDevice, &memoryProperties );
+
+    pools.resize( memoryProperties.memoryTypeCount * 2 );
+    for( uint32 poolIndex = 0; poolIndex < pools.size(); ++poolIndex )
+    {
+        // Small heaps ( e.g. the 256 MB host visible device local one ) get smaller blocks
+        const VkMemoryType& memoryType = memoryProperties.memoryTypes[ poolIndex / 2 ];
+        const VkDeviceSize heapSize = memoryProperties.memoryHeaps[ memoryType.heapIndex ].size;
+        pools[ poolIndex ].blockSize = std::min( DEFAULT_BLOCK_SIZE, std::max<VkDeviceSize>( heapSize / 8, 1 << 20 ) );
+    }
+}
+
+void DeviceMemoryAllocator::shutdown()
+{
+    std::lock_guard<std::mutex> lock( allocatorMutex );
+
+    for( Pool& pool : pools )
+    {
+        for( Block& block : pool.blocks )
+        {
+            if( block.memory != VK_NULL_HANDLE )
+                vkFreeMemory( device, block.memory, nullptr );
+        }
+    }
+    pools.clear();
+}
+
+VkDeviceMemory DeviceMemoryAllocator::allocateDeviceMemory( VkDeviceSize size, uint32 memoryTypeIndex, bool bLinear, uint8*& outMappedData )
+{
+    VkMemoryAllocateInfo allocInfo{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = size,
+        .memoryTypeIndex = memoryTypeIndex,
+    };
+
+    // Any buffer placed in the block may ask for its device address
+    VkMemoryAllocateFlagsInfo flagsInfo{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR,
+    };
+    if( bLinear )
+        allocInfo.pNext = &flagsInfo;
+
+    VkDeviceMemory memory;
+    if( vkAllocateMemory( device, &allocInfo, nullptr, &memory ) != VK_SUCCESS )
+    {
+        throw std::runtime_error( "failed to allocate device memory!" );
+    }
+
+    outMappedData = nullptr;
+    if( memoryProperties.memoryTypes[ memoryTypeIndex ].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT )
+    {
+        void* mappedData;
+        vkMapMemory( device, memory, 0, VK_WHOLE_SIZE, 0, &mappedData );
+        outMappedData = static_cast< uint8* >( mappedData );
+    }
+
+    return memory;
+}
+
+bool DeviceMemoryAllocator::allocateFromBlock( Block& block, const VkMemoryRequirements& requirements, VkDeviceSize& outOffset )
+{
+    for( auto range = block.freeRanges.begin(); range != block.freeRanges.end(); ++range )
+    {
+        const VkDeviceSize rangeBegin = range->first;
+        const VkDeviceSize rangeEnd = range->first + range->second;
+        const VkDeviceSize offset = alignUp( rangeBegin, requirements.alignment );
+        if( offset + requirements.size > rangeEnd )
+            continue;
+
+        // Alignment padding in front stays free, the rest of the range after the allocation too
+        block.freeRanges.erase( range );
+        if( offset > rangeBegin )
+            block.freeRanges[ rangeBegin ] = offset - rangeBegin;
+        if( offset + requirements.size < rangeEnd )
+            block.freeRanges[ offset + requirements.size ] = rangeEnd - ( offset + requirements.size );
+
+        outOffset = offset;
+        return true;
+    }
+
+    return false;
+}
+
+DeviceAllocation DeviceMemoryAllocator::allocate( const VkMemoryRequirements& requirements, uint32 memoryTypeIndex, bool bLinear )
+{
+    std::lock_guard<std::mutex> lock( allocatorMutex );
+
+    DeviceAllocation allocation;
+    allocation.poolIndex = memoryTypeIndex * 2 + ( bLinear ? 1 : 0 );
+    allocation.size = requirements.size;
+
+    Pool& pool = pools[ allocation.poolIndex ];
+    if( requirements.size >= pool.blockSize / 2 )
+    {
+        uint8* mappedData;
+        allocation.memory = allocateDeviceMemory( requirements.size, memoryTypeIndex, bLinear, mappedData );
+        allocation.mappedData = mappedData;
+        allocation.blockIndex = DEDICATED_MEMORY_BLOCK;
+
+        ++dedicatedAllocationCount;
+        dedicatedBytes += requirements.size;
+        return allocation;
+    }
+
+    uint32 emptySlot = DEDICATED_MEMORY_BLOCK;
+    for( uint32 blockIndex = 0; blockIndex < pool.blocks.size(); ++blockIndex )
+    {
+        Block& block = pool.blocks[ blockIndex ];
+        if( block.memory == VK_NULL_HANDLE )
+        {
+            emptySlot = std::min( emptySlot, blockIndex );
+            continue;
+        }
+
+        if( allocateFromBlock( block, requirements, allocation.offset ) )
+        {
+            allocation.blockIndex = blockIndex;
+            break;
+        }
+    }
+
+    if( allocation.blockIndex == DEDICATED_MEMORY_BLOCK )
+    {
+        if( emptySlot == DEDICATED_MEMORY_BLOCK )
+        {
+            emptySlot = static_cast< uint32 >( pool.blocks.size() );
+            pool.blocks.emplace_back();
+        }
+
+        Block& block = pool.blocks[ emptySlot ];
+        block.size = pool.blockSize;
+        block.memory = allocateDeviceMemory( block.size, memoryTypeIndex, bLinear, block.mappedData );
+        block.freeRanges = { { 0, block.size } };
+        block.allocationCount = 0;
+
+        [[maybe_unused]] const bool bAllocated = allocateFromBlock( block, requirements, allocation.offset );
+        assert( bAllocated );
+        allocation.blockIndex = emptySlot;
+    }
+
+    Block& block = pool.blocks[ allocation.blockIndex ];
+    ++block.allocationCount;
+    allocation.memory = block.memory;
+    allocation.mappedData = block.mappedData ? block.mappedData + allocation.offset : nullptr;
+
+    return allocation;
+}
+
+void DeviceMemoryAllocator::free( const DeviceAllocation& allocation )
+{
+    if( allocation.memory == VK_NULL_HANDLE )
+        return;
+
+    std::lock_guard<std::mutex> lock( allocatorMutex );
+
+    if( allocation.blockIndex == DEDICATED_MEMORY_BLOCK )
+    {
+        vkFreeMemory( device, allocation.memory, nullptr );
+
+        --dedicatedAllocationCount;
+        dedicatedBytes -= allocation.size;
+        return;
+    }
+
+    Pool& pool = pools[ allocation.poolIndex ];
+    Block& block = pool.blocks[ allocation.blockIndex ];
+    assert( block.memory == allocation.memory );
+
+    // Merge with the free neighbours on both sides
+    VkDeviceSize offset = allocation.offset;
+    VkDeviceSize size = allocation.size;
+
+    auto next = block.freeRanges.lower_bound( offset );
+    if( next != block.freeRanges.end() && offset + size == next->first )
+    {
+        size += next->second;
+        next = block.freeRanges.erase( next );
+    }
+    if( next != block.freeRanges.begin() )
+    {
+        auto previous = std::prev( next );
+        if( previous->first + previous->second == offset )
+        {
+            offset = previous->first;
+            size += previous->second;
+            block.freeRanges.erase( previous );
+        }
+    }
+    block.freeRanges[ offset ] = size;
+
+    // Empty blocks are released while the pool still has another block to allocate from
+    if( --block.allocationCount == 0 )
+    {
+        const size_t liveBlockCount = std::count_if( pool.blocks.begin(), pool.blocks.end(), []( const Block& poolBlock )
+            {
+                return poolBlock.memory != VK_NULL_HANDLE;
+            } );
+
+        if( liveBlockCount > 1 )
+        {
+            vkFreeMemory( device, block.memory, nullptr );
+            block = Block();
+        }
+    }
+}
+
+DeviceMemoryStats DeviceMemoryAllocator::getStats() const
+{
+    std::lock_guard<std::mutex> lock( allocatorMutex );
+
+    DeviceMemoryStats stats;
+    stats.dedicatedAllocationCount = dedicatedAllocationCount;
+    stats.allocationCount = dedicatedAllocationCount;
+    stats.reservedBytes = dedicatedBytes;
+    stats.usedBytes = dedicatedBytes;
+
+    for( const Pool& pool : pools )
+    {
+        for( const Block& block : pool.blocks )
+        {
+            if( block.memory == VK_NULL_HANDLE )
+                continue;
+
+            VkDeviceSize freeBytes = 0;
+            VkDeviceSize largestFreeRange = 0;
+            for( const auto& [offset, size] : block.freeRanges )
+            {
+                freeBytes += size;
+                largestFreeRange = std::max( largestFreeRange, size );
+            }
+            stats.largestFreeRange = std::max<uint64>( stats.largestFreeRange, largestFreeRange );
+            stats.contiguousFreeBytes += largestFreeRange;
+
+            ++stats.blockCount;
+            stats.allocationCount += block.allocationCount;
+            stats.freeRangeCount += static_cast< uint32 >( block.freeRanges.size() );
+            stats.reservedBytes += block.size;
+            stats.usedBytes += block.size - freeBytes;
+        }
+    }
+
+    return stats;
+}
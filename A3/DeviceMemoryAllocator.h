@@ -0,0 +1,92 @@
+#pragma once
+
+#include "EngineTypes.h"
+#include <vulkan/vulkan.h>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace A3
+{
+constexpr uint32 DEDICATED_MEMORY_BLOCK = 0xFFFFFFFF;
+
+// Range of device memory handed out by DeviceMemoryAllocator. Resources are bound at memory + offset.
+struct DeviceAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+
+    // Points at offset inside a persistently mapped block, nullptr for memory which is not host visible
+    void* mappedData = nullptr;
+
+    uint32 poolIndex = 0;
+    uint32 blockIndex = DEDICATED_MEMORY_BLOCK;
+};
+
+struct DeviceMemoryStats
+{
+    uint32 blockCount = 0;
+    uint32 dedicatedAllocationCount = 0;
+    uint32 allocationCount = 0;
+    uint32 freeRangeCount = 0;
+
+    uint64 reservedBytes = 0;       // Every VkDeviceMemory, blocks and dedicated allocations
+    uint64 usedBytes = 0;
+    uint64 largestFreeRange = 0;
+    uint64 contiguousFreeBytes = 0; // Sum of the largest free range of every block
+
+    // 0 when the free space of every block is one range, towards 1 the more it is split into small holes
+    float getFragmentation() const;
+};
+
+// Sub-allocates buffers and images from large VkDeviceMemory blocks instead of one vkAllocateMemory per resource.
+// One pool per memory type and resource kind ( linear buffers, optimal images ) keeps bufferImageGranularity out of the blocks.
+// Each block keeps an offset ordered free list with first fit placement and coalescing on free.
+// Resources of at least half a block get a dedicated allocation.
+class DeviceMemoryAllocator
+{
+public:
+    DeviceMemoryAllocator();
+    ~DeviceMemoryAllocator();
+
+    void initialize( VkPhysicalDevice physicalDevice, VkDevice inDevice );
+    void shutdown();
+
+    DeviceAllocation allocate( const VkMemoryRequirements& requirements, uint32 memoryTypeIndex, bool bLinear );
+    void free( const DeviceAllocation& allocation );
+
+    DeviceMemoryStats getStats() const;
+
+private:
+    struct Block
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint8* mappedData = nullptr;
+
+        std::map<VkDeviceSize, VkDeviceSize> freeRanges;   // offset -> size
+        uint32 allocationCount = 0;
+    };
+
+    struct Pool
+    {
+        std::vector<Block> blocks;   // Released blocks stay as empty slots, so block indices remain stable
+        VkDeviceSize blockSize = 0;
+    };
+
+    bool allocateFromBlock( Block& block, const VkMemoryRequirements& requirements, VkDeviceSize& outOffset );
+    VkDeviceMemory allocateDeviceMemory( VkDeviceSize size, uint32 memoryTypeIndex, bool bLinear, uint8*& outMappedData );
+
+private:
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+
+    std::vector<Pool> pools;   // Indexed by memory type * 2 + bLinear
+
+    uint32 dedicatedAllocationCount;
+    uint64 dedicatedBytes;
+
+    mutable std::mutex allocatorMutex;
+};
+}
@@ -8,7 +8,9 @@
 #include <tuple>
 #include <bitset>
 #include <span>
+#include <chrono>
 #include "Vulkan.h"
+#include "CPURenderBackend.h"
 #include "PathTracingRenderer.h"
 #include "Addon_imgui.h"
 #include "Scene.h"
@@ -20,6 +22,14 @@ static void glfw_error_callback( int error, const char* description )
     fprintf( stderr, "GLFW Error %d: %s\n", error, description );
 }
 
+static void printSceneLoadProgress( uint32 loadedMeshCount, uint32 totalMeshCount )
+{
+    printf( "\rLoading meshes %u/%u", loadedMeshCount, totalMeshCount );
+    if( loadedMeshCount == totalMeshCount )
+        printf( "\n" );
+    fflush( stdout );
+}
+
 void Engine::Run()
 {
     glfwSetErrorCallback( glfw_error_callback );
@@ -46,7 +56,7 @@ void Engine::Run()
 
     {
         Scene scene;
-        scene.load(RenderSettings::sceneFiles[RenderSettings::sceneIdx]); // TODO: Separated ConfigManager & AppSettings class (constants as file paths, resolution, spp, camera info...)
+        scene.load(RenderSettings::sceneFiles[RenderSettings::sceneIdx], printSceneLoadProgress); // TODO: Separated ConfigManager & AppSettings class (constants as file paths, resolution, spp, camera info...)
         // TODO: Scene only handles objects, mesh, lightings from Json
 
         VulkanRenderBackend gfxBackend( window, extensions, screenWidth, screenHeight );
@@ -75,4 +85,36 @@ void Engine::Run()
     glfwDestroyWindow( window );
     glfwTerminate();
 }
+
+void Engine::RunHeadless( uint32 frameCount )
+{
+    Scene scene;
+    scene.load(RenderSettings::sceneFiles[RenderSettings::sceneIdx], printSceneLoadProgress);
+
+    if( frameCount == 0 )
+        frameCount = scene.getImguiParam()->frameCount;
+
+    CPURenderBackend cpuBackend( RenderSettings::screenWidth, RenderSettings::screenHeight );
+
+    PathTracingRenderer renderer( &cpuBackend );
+
+    const auto startTime = std::chrono::steady_clock::now();
+    for( uint32 frame = 0; frame < frameCount; ++frame )
+    {
+        scene.beginFrame();
+
+        renderer.beginFrame( RenderSettings::screenWidth, RenderSettings::screenHeight );
+        renderer.render( scene );
+        renderer.endFrame();
+
+        scene.endFrame();
+
+        printf( "\rCPU frame %u/%u", frame + 1, frameCount );
+        fflush( stdout );
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    printf( "\nRendered %u frames in %.2f s\n", frameCount, elapsed.count() );
+
+    cpuBackend.saveCurrentImage( "cpu_render.png" );
+}
 }
\ No newline at end of file
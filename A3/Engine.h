@@ -1,10 +1,15 @@
 #pragma once
 
+#include "EngineTypes.h"
+
 namespace A3
 {
 class Engine
 {
 public:
 	void Run();
+
+	// Renders the scene on the CPU backend without a window and saves the result to output_images/
+	void RunHeadless( uint32 frameCount );
 };
 }
\ No newline at end of file
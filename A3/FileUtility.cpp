@@ -19,4 +19,12 @@ void Utility::loadTextFile( std::string& outText, const std::string& filePath )
     file.seekg( 0, std::ios::beg );
     file.read( outText.data(), fileSize );
     file.close();
+}
+
+uint64 Utility::hashString( const std::string& text, uint64 seed )
+{
+    uint64 hash = seed;
+    for( const char c : text )
+        hash = ( hash ^ static_cast< uint8 >( c ) ) * 0x100000001B3ull;
+    return hash;
 }
\ No newline at end of file
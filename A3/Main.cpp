@@ -1,8 +1,19 @@
 #include "Engine.h"
+#include <cstdlib>
+#include <cstring>
 
-int main()
+int main( int argc, char** argv )
 {
     A3::Engine engine;
+
+    // --cpu [frameCount]: render headless on the CPU backend, frameCount defaults to the scene spp
+    if( argc > 1 && std::strcmp( argv[ 1 ], "--cpu" ) == 0 )
+    {
+        const uint32 frameCount = argc > 2 ? static_cast< uint32 >( std::atoi( argv[ 2 ] ) ) : 0;
+        engine.RunHeadless( frameCount );
+        return 0;
+    }
+
     engine.Run();
 
     return 0;
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "EngineTypes.h"
+#include <string>
+
+namespace A3
+{
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile( const MappedFile& ) = delete;
+    MappedFile& operator=( const MappedFile& ) = delete;
+
+    bool open( const std::string& filePath );
+    void close();
+
+    const uint8* getData() const { return data; }
+    uint64 getSize() const { return size; }
+
+private:
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#else
+    int32 fileDescriptor = -1;
+#endif
+    const uint8* data = nullptr;
+    uint64 size = 0;
+};
+}
@@ -19,14 +19,29 @@ public:
 
 	void createRenderResources( IRenderBackend* backend )
 	{
-		BLASBuildParams params = {
+		setBLAS( backend->createBLAS( getBLASBuildParams() ) );
+	}
+
+	BLASBuildParams getBLASBuildParams() const
+	{
+		return {
 			.positionData = resource->positions,
 			.attributeData = resource->attributes,
 			.indexData = resource->indices,
 			.cumulativeTriangleAreaData = resource->cumulativeTriangleArea,
 			.transformData = Mat3x4::identity
 		};
-		blasBatch.blas = backend->createBLAS( params );
+	}
+
+	// Takes a BLAS built from getBLASBuildParams, e.g. as part of a batched build
+	void setBLAS( IAccelerationStructureRef blas )
+	{
+		blasBatch.blas = std::move( blas );
+		blasBatch.transforms = { localToWorld };
+	}
+
+	void updateRenderTransforms()
+	{
 		blasBatch.transforms = { localToWorld };
 	}
 
@@ -1,135 +1,383 @@
 #include "Utility.h"
 #include "MeshResource.h"
+#include "MappedFile.h"
+#include "ObjParser.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
-
-#define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
-// Optional. define TINYOBJLOADER_USE_MAPBOX_EARCUT gives robust triangulation. Requires C++11
-//#define TINYOBJLOADER_USE_MAPBOX_EARCUT
-#include "tiny_obj_loader.h"
+#include <unordered_map>
 
 using namespace A3;
 
-tinyobj::ObjReaderConfig    tinyObjConfig;
-tinyobj::ObjReader          tinyObjReader;
+namespace
+{
+// OBJ corners referencing the same position, normal and texcoord are the same vertex
+struct VertexKey
+{
+    int32 vertexIndex;
+    int32 normalIndex;
+    int32 texcoordIndex;
+
+    bool operator==( const VertexKey& other ) const
+    {
+        return vertexIndex == other.vertexIndex && normalIndex == other.normalIndex && texcoordIndex == other.texcoordIndex;
+    }
+};
+
+struct VertexKeyHash
+{
+    size_t operator()( const VertexKey& key ) const
+    {
+        uint64 hash = static_cast< uint32 >( key.vertexIndex );
+        hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast< uint32 >( key.normalIndex );
+        hash = hash * 0x9E3779B97F4A7C15ull ^ static_cast< uint32 >( key.texcoordIndex );
+        return static_cast< size_t >( hash ^ ( hash >> 32 ) );
+    }
+};
+
+//=========================
+//   .a3mesh cache
+//=========================
+// Header followed by the positions, attributes and indices blobs, each aligned to MESH_CACHE_ALIGNMENT. The
+// cumulativeTriangleArea table is not cached, it depends on the object transform and is rebuilt at scene load.
+// The cache is only valid for the exact source file and loader options it was written with.
+constexpr char MESH_CACHE_MAGIC[ 4 ] = { 'A', '3', 'M', 'S' };
+constexpr uint32 MESH_CACHE_VERSION = 3;    // 2: quads are fan triangulated by ObjParser, 3: no area blob
+constexpr uint64 MESH_CACHE_ALIGNMENT = 64;
 
-void Utility::loadMeshFile( MeshResource& outMesh, const std::string& filePath )
+struct MeshCacheKey
 {
-    if( !tinyObjReader.ParseFromFile( filePath, tinyObjConfig ) )
+    uint64 sourceSize;
+    int64 sourceWriteTime;
+    uint64 sourcePathHash;
+    uint32 optionFlags;
+};
+
+struct MeshCacheHeader
+{
+    char magic[ 4 ];
+    uint32 version;
+    MeshCacheKey key;
+    uint32 triangleCount;
+    uint64 positionCount;
+    uint64 indexCount;
+    uint64 positionsOffset;
+    uint64 attributesOffset;
+    uint64 indicesOffset;
+};
+
+bool makeMeshCacheKey( const std::string& filePath, const Utility::MeshLoadOptions& options, MeshCacheKey& outKey )
+{
+    std::error_code error;
+    const std::filesystem::path path = std::filesystem::absolute( filePath, error ).lexically_normal();
+    const uint64 fileSize = std::filesystem::file_size( path, error );
+    if( error )
+        return false;
+
+    const auto writeTime = std::filesystem::last_write_time( path, error );
+    if( error )
+        return false;
+
+    outKey = {};
+    outKey.sourceSize = fileSize;
+    outKey.sourceWriteTime = static_cast< int64 >( writeTime.time_since_epoch().count() );
+    outKey.sourcePathHash = Utility::hashString( path.generic_string() );
+    outKey.optionFlags = ( options.bDeduplicateVertices ? 1u : 0u ) | ( options.bOptimizeVertexCache ? 2u : 0u );
+    return true;
+}
+
+uint64 alignCacheOffset( uint64 offset )
+{
+    return ( offset + MESH_CACHE_ALIGNMENT - 1 ) & ~( MESH_CACHE_ALIGNMENT - 1 );
+}
+
+template<typename T>
+bool readCacheBlob( const MappedFile& file, uint64 offset, uint64 count, std::vector<T>& outBlob )
+{
+    if( offset % MESH_CACHE_ALIGNMENT != 0 || offset > file.getSize() || count > ( file.getSize() - offset ) / sizeof( T ) )
+        return false;
+
+    const T* first = reinterpret_cast< const T* >( file.getData() + offset );
+    outBlob.assign( first, first + count );
+    return true;
+}
+
+bool loadMeshCache( MeshResource& outMesh, const std::string& cachePath, const MeshCacheKey& key )
+{
+    MappedFile file;
+    if( !file.open( cachePath ) || file.getSize() < sizeof( MeshCacheHeader ) )
+        return false;
+
+    MeshCacheHeader header;
+    std::memcpy( &header, file.getData(), sizeof( header ) );
+    if( std::memcmp( header.magic, MESH_CACHE_MAGIC, sizeof( MESH_CACHE_MAGIC ) ) != 0
+        || header.version != MESH_CACHE_VERSION
+        || header.key.sourceSize != key.sourceSize
+        || header.key.sourceWriteTime != key.sourceWriteTime
+        || header.key.sourcePathHash != key.sourcePathHash
+        || header.key.optionFlags != key.optionFlags )
+    {
+        return false;
+    }
+
+    MeshResource mesh;
+    if( !readCacheBlob( file, header.positionsOffset, header.positionCount, mesh.positions )
+        || !readCacheBlob( file, header.attributesOffset, header.positionCount, mesh.attributes )
+        || !readCacheBlob( file, header.indicesOffset, header.indexCount, mesh.indices ) )
+    {
+        return false;
+    }
+    mesh.triangleCount = header.triangleCount;
+    mesh.cumulativeTriangleArea.assign( mesh.triangleCount + 1, 0.0f );
+
+    outMesh = std::move( mesh );
+    return true;
+}
+
+void saveMeshCache( const MeshResource& mesh, const std::string& cachePath, const MeshCacheKey& key )
+{
+    MeshCacheHeader header = {};
+    std::memcpy( header.magic, MESH_CACHE_MAGIC, sizeof( MESH_CACHE_MAGIC ) );
+    header.version = MESH_CACHE_VERSION;
+    header.key = key;
+    header.triangleCount = mesh.triangleCount;
+    header.positionCount = mesh.positions.size();
+    header.indexCount = mesh.indices.size();
+    header.positionsOffset = alignCacheOffset( sizeof( MeshCacheHeader ) );
+    header.attributesOffset = alignCacheOffset( header.positionsOffset + mesh.positions.size() * sizeof( VertexPosition ) );
+    header.indicesOffset = alignCacheOffset( header.attributesOffset + mesh.attributes.size() * sizeof( VertexAttributes ) );
+
+    // Written to a temporary file first, so an interrupted write never leaves a truncated cache behind
+    const std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream file( tempPath, std::ios::binary | std::ios::trunc );
+        if( !file.is_open() )
+            return;
+
+        const char padding[ MESH_CACHE_ALIGNMENT ] = {};
+        auto writeBlob = [ & ]( uint64 offset, const void* blob, uint64 byteSize )
+            {
+                file.write( padding, static_cast< std::streamsize >( offset - static_cast< uint64 >( file.tellp() ) ) );
+                file.write( static_cast< const char* >( blob ), static_cast< std::streamsize >( byteSize ) );
+            };
+
+        file.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+        writeBlob( header.positionsOffset, mesh.positions.data(), mesh.positions.size() * sizeof( VertexPosition ) );
+        writeBlob( header.attributesOffset, mesh.attributes.data(), mesh.attributes.size() * sizeof( VertexAttributes ) );
+        writeBlob( header.indicesOffset, mesh.indices.data(), mesh.indices.size() * sizeof( uint32 ) );
+        if( !file.good() )
+            return;
+    }
+
+    std::error_code error;
+    std::filesystem::rename( tempPath, cachePath, error );
+    if( error )
+    {
+        std::cout << "Failed to write mesh cache " << cachePath << ": " << error.message() << "\n";
+        std::filesystem::remove( tempPath, error );
+    }
+}
+}
+
+bool Utility::loadMeshFile( MeshResource& outMesh, const std::string& filePath, std::string& outError, const MeshLoadOptions& options )
+{
+    const std::string cachePath = filePath + ".a3mesh";
+    MeshCacheKey cacheKey;
+    const bool bCacheable = options.bUseCache && makeMeshCacheKey( filePath, options, cacheKey );
+    if( bCacheable && loadMeshCache( outMesh, cachePath, cacheKey ) )
+        return true;
+
+    ObjData obj;
+    if( !parseObjFile( filePath, obj, outError ) )
+        return false;
+
+    const size_t cornerCount = obj.indices.size();
+    outMesh.indices.reserve( outMesh.indices.size() + cornerCount );
+    if( !options.bDeduplicateVertices )
+    {
+        outMesh.positions.reserve( outMesh.positions.size() + cornerCount );
+        outMesh.attributes.reserve( outMesh.attributes.size() + cornerCount );
+    }
+
+    std::unordered_map<VertexKey, uint32, VertexKeyHash> uniqueVertices;
+    if( options.bDeduplicateVertices )
+        uniqueVertices.reserve( cornerCount );
+
+    for( const ObjIndex& index : obj.indices )
     {
-        if( !tinyObjReader.Error().empty() )
+        if( options.bDeduplicateVertices )
+        {
+            const VertexKey key{ index.vertexIndex, index.normalIndex, index.texcoordIndex };
+            const auto [ it, bInserted ] = uniqueVertices.try_emplace( key, static_cast< uint32 >( outMesh.positions.size() ) );
+            if( !bInserted )
+            {
+                outMesh.indices.push_back( it->second );
+                continue;
+            }
+        }
+
+        VertexPosition positions;
+        VertexAttributes attributes{};
+
+        positions.x = obj.vertices[ 3 * index.vertexIndex + 0 ];
+        positions.y = obj.vertices[ 3 * index.vertexIndex + 1 ];
+        positions.z = obj.vertices[ 3 * index.vertexIndex + 2 ];
+
+        if( index.normalIndex >= 0 )
         {
-            std::cerr << "TinyObjReader: " << tinyObjReader.Error();
+            attributes.normals[ 0 ] = obj.normals[ 3 * index.normalIndex + 0 ];
+            attributes.normals[ 1 ] = obj.normals[ 3 * index.normalIndex + 1 ];
+            attributes.normals[ 2 ] = obj.normals[ 3 * index.normalIndex + 2 ];
         }
-        exit( 1 );
+
+        if( index.texcoordIndex >= 0 )
+        {
+            attributes.uvs[ 0 ] = obj.texcoords[ 2 * index.texcoordIndex + 0 ];
+            attributes.uvs[ 1 ] = obj.texcoords[ 2 * index.texcoordIndex + 1 ];
+        }
+
+        outMesh.indices.push_back( static_cast< uint32 >( outMesh.positions.size() ) );
+        outMesh.positions.push_back( positions );
+        outMesh.attributes.push_back( attributes );
     }
 
-    if( !tinyObjReader.Warning().empty() )
+    if( options.bOptimizeVertexCache )
     {
-        std::cout << "TinyObjReader: " << tinyObjReader.Warning();
+        optimizeVertexCache( outMesh.indices, static_cast< uint32 >( outMesh.positions.size() ) );
+        optimizeVertexFetch( outMesh );
     }
 
-    const tinyobj::attrib_t& attrib = tinyObjReader.GetAttrib();
-    const std::vector<tinyobj::shape_t>& shapes = tinyObjReader.GetShapes();
+    // Filled in world space by MeshObject::calculateTriangleArea()
+    outMesh.triangleCount = static_cast< uint32 >( outMesh.indices.size() / 3 );
+    outMesh.cumulativeTriangleArea.assign( outMesh.triangleCount + 1, 0.0f );
+
+    if( bCacheable )
+        saveMeshCache( outMesh, cachePath, cacheKey );
+
+    return true;
+}
 
-    uint32 sumIdx = 1;
-    for( const auto& shape : shapes )
+void Utility::optimizeVertexCache( std::vector<uint32>& indices, uint32 vertexCount, uint32 cacheSize )
+{
+    const uint32 triangleCount = static_cast< uint32 >( indices.size() / 3 );
+    if( triangleCount == 0 || vertexCount == 0 )
+        return;
+
+    // Vertex -> triangle adjacency in CSR form, liveCount tracks the triangles of a vertex not emitted yet
+    std::vector<uint32> liveCount( vertexCount, 0 );
+    for( uint32 index : indices )
+        liveCount[ index ]++;
+
+    std::vector<uint32> adjacencyOffset( vertexCount + 1, 0 );
+    for( uint32 vertex = 0; vertex < vertexCount; ++vertex )
+        adjacencyOffset[ vertex + 1 ] = adjacencyOffset[ vertex ] + liveCount[ vertex ];
+
+    std::vector<uint32> adjacency( adjacencyOffset[ vertexCount ] );
+    std::vector<uint32> fill( adjacencyOffset.begin(), adjacencyOffset.end() - 1 );
+    for( uint32 triangle = 0; triangle < triangleCount; ++triangle )
     {
-        outMesh.triangleCount = shape.mesh.num_face_vertices.size();
+        for( uint32 corner = 0; corner < 3; ++corner )
+            adjacency[ fill[ indices[ triangle * 3 + corner ] ]++ ] = triangle;
+    }
 
-        outMesh.positions.reserve( shape.mesh.indices.size() + outMesh.positions.size() );
-        outMesh.indices.reserve( shape.mesh.indices.size() + outMesh.indices.size() );
-        outMesh.cumulativeTriangleArea.resize( shape.mesh.num_face_vertices.size() 
-                                               + outMesh.cumulativeTriangleArea.size() + 1);
+    std::vector<uint32> cacheTime( vertexCount, 0 );
+    std::vector<bool> bEmitted( triangleCount, false );
+    std::vector<uint32> deadEnd;
+    std::vector<uint32> candidates;
+    std::vector<uint32> output;
+    output.reserve( indices.size() );
 
-        for( const auto& index : shape.mesh.indices )
+    uint32 time = cacheSize + 1;
+    uint32 cursor = 0;
+    int64 fanVertex = 0;
+    while( fanVertex >= 0 )
+    {
+        // Emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        const uint32 vertex = static_cast< uint32 >( fanVertex );
+        for( uint32 offset = adjacencyOffset[ vertex ]; offset < adjacencyOffset[ vertex + 1 ]; ++offset )
         {
-            VertexPosition positions;
-            VertexAttributes attributes;
-
-            positions.x = attrib.vertices[ 3 * index.vertex_index + 0 ];
-            positions.y = attrib.vertices[ 3 * index.vertex_index + 1 ];
-            positions.z = attrib.vertices[ 3 * index.vertex_index + 2 ];
+            const uint32 triangle = adjacency[ offset ];
+            if( bEmitted[ triangle ] )
+                continue;
 
-            if( !attrib.normals.empty() && index.normal_index >= 0 )
+            for( uint32 corner = 0; corner < 3; ++corner )
             {
-                attributes.normals[ 0 ] = attrib.normals[ 3 * index.normal_index + 0 ];
-                attributes.normals[ 1 ] = attrib.normals[ 3 * index.normal_index + 1 ];
-                attributes.normals[ 2 ] = attrib.normals[ 3 * index.normal_index + 2 ];
+                const uint32 v = indices[ triangle * 3 + corner ];
+                output.push_back( v );
+                deadEnd.push_back( v );
+                candidates.push_back( v );
+                liveCount[ v ]--;
+                if( time - cacheTime[ v ] > cacheSize )
+                    cacheTime[ v ] = time++;
             }
+            bEmitted[ triangle ] = true;
+        }
 
-            /*if( !attrib.colors.empty() )
-            {
-                v.color[ 0 ] = attrib.colors[ 3 * index.vertex_index + 0 ];
-                v.color[ 1 ] = attrib.colors[ 3 * index.vertex_index + 1 ];
-                v.color[ 2 ] = attrib.colors[ 3 * index.vertex_index + 2 ];
-            }*/
+        // Next fan: the candidate with live triangles that stays in the cache the longest
+        fanVertex = -1;
+        uint32 bestPriority = 0;
+        for( uint32 v : candidates )
+        {
+            if( liveCount[ v ] == 0 )
+                continue;
+
+            uint32 priority = 0;
+            if( time - cacheTime[ v ] + 2 * liveCount[ v ] <= cacheSize )
+                priority = time - cacheTime[ v ];
 
-            if( !attrib.texcoords.empty() && index.texcoord_index >= 0 )
+            if( fanVertex < 0 || priority > bestPriority )
             {
-                attributes.uvs[ 0 ] = attrib.texcoords[ 2 * index.texcoord_index + 0 ];
-                attributes.uvs[ 1 ] = attrib.texcoords[ 2 * index.texcoord_index + 1 ];
+                bestPriority = priority;
+                fanVertex = v;
             }
+        }
+
+        if( fanVertex >= 0 )
+            continue;
 
-            outMesh.positions.push_back( positions );
-            outMesh.attributes.push_back( attributes );
-            outMesh.indices.push_back( static_cast< uint32 >( outMesh.indices.size() ) ); // TODO: repeated vertex
-
-            //if (outMesh.indices.size() % 3 == 0) {
-            //    const int idx = outMesh.indices.size() - 1;
-            //    VertexPosition AB = outMesh.positions[idx - 0] - outMesh.positions[idx - 2];
-            //    VertexPosition AC = outMesh.positions[idx - 1] - outMesh.positions[idx - 2];
-            //    VertexPosition prod = 0.5f * AB.cross(AC);
-            //    outMesh.cumulativeTriangleArea[sumIdx] = outMesh.cumulativeTriangleArea[sumIdx - 1] + prod.length();
-            //    ++sumIdx;
-            //}
+        // Dead end, fall back to recently used vertices, then to the next unprocessed vertex in input order
+        while( !deadEnd.empty() && fanVertex < 0 )
+        {
+            const uint32 v = deadEnd.back();
+            deadEnd.pop_back();
+            if( liveCount[ v ] > 0 )
+                fanVertex = v;
+        }
+
+        while( fanVertex < 0 && cursor < vertexCount )
+        {
+            if( liveCount[ cursor ] > 0 )
+                fanVertex = cursor;
+            ++cursor;
         }
-        //std::cout << " " << "\n";
-
-        /*if (attrib.normals.empty()) {
-            for (size_t f = 0; f < shape.mesh.indices.size() / 3; f++) {
-                tinyobj::index_t idx0 = shape.mesh.indices[3 * f + 0];
-                tinyobj::index_t idx1 = shape.mesh.indices[3 * f + 1];
-                tinyobj::index_t idx2 = shape.mesh.indices[3 * f + 2];
-
-                float v0[3] = {
-                    attrib.vertices[3 * idx0.vertex_index + 0],
-                    attrib.vertices[3 * idx0.vertex_index + 1],
-                    attrib.vertices[3 * idx0.vertex_index + 2]
-                };
-                float v1[3] = {
-                    attrib.vertices[3 * idx1.vertex_index + 0],
-                    attrib.vertices[3 * idx1.vertex_index + 1],
-                    attrib.vertices[3 * idx1.vertex_index + 2]
-                };
-                float v2[3] = {
-                    attrib.vertices[3 * idx2.vertex_index + 0],
-                    attrib.vertices[3 * idx2.vertex_index + 1],
-                    attrib.vertices[3 * idx2.vertex_index + 2]
-                };
-
-                float e1[3] = { v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2] };
-                float e2[3] = { v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2] };
-                float normal[3] = {
-                    e1[1] * e2[2] - e1[2] * e2[1],
-                    e1[2] * e2[0] - e1[0] * e2[2],
-                    e1[0] * e2[1] - e1[1] * e2[0]
-                };
-
-                float len = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
-                if (len > 0) {
-                    normal[0] /= len;
-                    normal[1] /= len;
-                    normal[2] /= len;
-                }
-
-                for (int i = 0; i < 3; i++) {
-                    VertexAttributes& attr = outMesh.attributes[outMesh.indices.size() - 3 + i];
-                    attr.normals[0] = normal[0];
-                    attr.normals[1] = normal[1];
-                    attr.normals[2] = normal[2];
-                    attr.normals[3] = 0.0f;
-                }
-            }
-        }*/
     }
-}
\ No newline at end of file
+
+    indices.swap( output );
+}
+
+void Utility::optimizeVertexFetch( MeshResource& mesh )
+{
+    const uint32 vertexCount = static_cast< uint32 >( mesh.positions.size() );
+    std::vector<uint32> remap( vertexCount, ~0u );
+    std::vector<VertexPosition> positions;
+    std::vector<VertexAttributes> attributes;
+    positions.reserve( vertexCount );
+    attributes.reserve( vertexCount );
+
+    for( uint32& index : mesh.indices )
+    {
+        if( remap[ index ] == ~0u )
+        {
+            remap[ index ] = static_cast< uint32 >( positions.size() );
+            positions.push_back( mesh.positions[ index ] );
+            attributes.push_back( mesh.attributes[ index ] );
+        }
+        index = remap[ index ];
+    }
+
+    // Vertices no triangle refers to are dropped
+    mesh.positions.swap( positions );
+    mesh.attributes.swap( attributes );
+}
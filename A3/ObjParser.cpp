@@ -0,0 +1,313 @@
+#include "ObjParser.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <charconv>
+#include <string_view>
+
+using namespace A3;
+
+namespace
+{
+constexpr uint64 MIN_CHUNK_SIZE = 1 << 20;
+
+// Relative ( negative ) indices are resolved against the counts seen so far inside the chunk first,
+// and against the counts of all previous chunks once those are known
+constexpr uint8 RELATIVE_VERTEX = 1 << 0;
+constexpr uint8 RELATIVE_NORMAL = 1 << 1;
+constexpr uint8 RELATIVE_TEXCOORD = 1 << 2;
+
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+
+    std::vector<float> vertices;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    std::vector<ObjIndex> indices;
+    std::vector<uint8> relativeFlags;
+
+    std::string error;
+    uint32 errorLine = 0;
+};
+
+bool isBlank( char c )
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char* skipBlanks( const char* cursor, const char* end )
+{
+    while( cursor < end && isBlank( *cursor ) )
+        ++cursor;
+    return cursor;
+}
+
+bool parseFloat( const char*& cursor, const char* end, float& outValue )
+{
+    cursor = skipBlanks( cursor, end );
+    if( cursor < end && *cursor == '+' )
+        ++cursor;
+
+    const std::from_chars_result result = std::from_chars( cursor, end, outValue );
+    if( result.ec != std::errc() )
+        return false;
+
+    cursor = result.ptr;
+    return true;
+}
+
+bool parseInt( const char*& cursor, const char* end, int32& outValue )
+{
+    const std::from_chars_result result = std::from_chars( cursor, end, outValue );
+    if( result.ec != std::errc() )
+        return false;
+
+    cursor = result.ptr;
+    return true;
+}
+
+// One face corner: v, v/vt, v//vn or v/vt/vn. OBJ indices are one based, negative ones count back from the end.
+bool parseCorner( const char*& cursor, const char* end, const ObjChunk& chunk, ObjIndex& outIndex, uint8& outFlags )
+{
+    int32 values[ 3 ] = { 0, 0, 0 };
+    if( !parseInt( cursor, end, values[ 0 ] ) )
+        return false;
+
+    for( uint32 slot = 1; slot < 3 && cursor < end && *cursor == '/'; ++slot )
+    {
+        ++cursor;
+        if( cursor < end && *cursor != '/' && !isBlank( *cursor ) && *cursor != '\n' )
+        {
+            if( !parseInt( cursor, end, values[ slot ] ) )
+                return false;
+        }
+    }
+
+    const int32 counts[ 3 ] = {
+        static_cast< int32 >( chunk.vertices.size() / 3 ),
+        static_cast< int32 >( chunk.texcoords.size() / 2 ),
+        static_cast< int32 >( chunk.normals.size() / 3 ) };
+    const uint8 relativeBits[ 3 ] = { RELATIVE_VERTEX, RELATIVE_TEXCOORD, RELATIVE_NORMAL };
+
+    int32 resolved[ 3 ];
+    outFlags = 0;
+    for( uint32 slot = 0; slot < 3; ++slot )
+    {
+        if( values[ slot ] > 0 )
+        {
+            resolved[ slot ] = values[ slot ] - 1;
+        }
+        else if( values[ slot ] < 0 )
+        {
+            resolved[ slot ] = counts[ slot ] + values[ slot ];
+            outFlags |= relativeBits[ slot ];
+        }
+        else if( slot == 0 )
+        {
+            return false;
+        }
+        else
+        {
+            resolved[ slot ] = -1;
+        }
+    }
+
+    outIndex = { resolved[ 0 ], resolved[ 2 ], resolved[ 1 ] };
+    return true;
+}
+
+void parseChunk( ObjChunk& chunk )
+{
+    std::vector<ObjIndex> polygon;
+    std::vector<uint8> polygonFlags;
+
+    uint32 line = 0;
+    const char* cursor = chunk.begin;
+    while( cursor < chunk.end )
+    {
+        ++line;
+        const char* lineEnd = std::find( cursor, chunk.end, '\n' );
+        const char* next = lineEnd < chunk.end ? lineEnd + 1 : lineEnd;
+
+        cursor = skipBlanks( cursor, lineEnd );
+        const char* keywordEnd = cursor;
+        while( keywordEnd < lineEnd && !isBlank( *keywordEnd ) )
+            ++keywordEnd;
+        const std::string_view keyword( cursor, keywordEnd - cursor );
+
+        bool bValid = true;
+        float components[ 3 ] = { 0.0f, 0.0f, 0.0f };
+        const char* values = keywordEnd;
+        if( keyword == "v" )
+        {
+            // Optional vertex colors after xyz are ignored
+            bValid = parseFloat( values, lineEnd, components[ 0 ] ) && parseFloat( values, lineEnd, components[ 1 ] ) && parseFloat( values, lineEnd, components[ 2 ] );
+            chunk.vertices.insert( chunk.vertices.end(), components, components + 3 );
+        }
+        else if( keyword == "vn" )
+        {
+            bValid = parseFloat( values, lineEnd, components[ 0 ] ) && parseFloat( values, lineEnd, components[ 1 ] ) && parseFloat( values, lineEnd, components[ 2 ] );
+            chunk.normals.insert( chunk.normals.end(), components, components + 3 );
+        }
+        else if( keyword == "vt" )
+        {
+            // v and the w of 3D texcoords are optional
+            bValid = parseFloat( values, lineEnd, components[ 0 ] );
+            parseFloat( values, lineEnd, components[ 1 ] );
+            chunk.texcoords.insert( chunk.texcoords.end(), components, components + 2 );
+        }
+        else if( keyword == "f" )
+        {
+            polygon.clear();
+            polygonFlags.clear();
+
+            const char* corner = skipBlanks( keywordEnd, lineEnd );
+            while( bValid && corner < lineEnd )
+            {
+                ObjIndex index;
+                uint8 flags;
+                bValid = parseCorner( corner, lineEnd, chunk, index, flags );
+                polygon.push_back( index );
+                polygonFlags.push_back( flags );
+                corner = skipBlanks( corner, lineEnd );
+            }
+
+            bValid = bValid && polygon.size() >= 3;
+            for( size_t cornerIndex = 1; bValid && cornerIndex + 1 < polygon.size(); ++cornerIndex )
+            {
+                const size_t fan[ 3 ] = { 0, cornerIndex, cornerIndex + 1 };
+                for( size_t fanCorner : fan )
+                {
+                    chunk.indices.push_back( polygon[ fanCorner ] );
+                    chunk.relativeFlags.push_back( polygonFlags[ fanCorner ] );
+                }
+            }
+        }
+
+        if( !bValid )
+        {
+            chunk.error = "malformed statement: " + std::string( cursor, lineEnd );
+            chunk.errorLine = line;
+            return;
+        }
+
+        cursor = next;
+    }
+}
+}
+
+bool Utility::parseObjFile( const std::string& filePath, ObjData& outData, std::string& outError )
+{
+    MappedFile file;
+    if( !file.open( filePath ) )
+    {
+        outError = "cannot open file [" + filePath + "]";
+        return false;
+    }
+
+    // Split into chunks ending on a line break, so every chunk holds whole statements
+    const char* const fileBegin = reinterpret_cast< const char* >( file.getData() );
+    const char* const fileEnd = fileBegin + file.getSize();
+    const uint64 chunkCountHint = std::clamp<uint64>( file.getSize() / MIN_CHUNK_SIZE, 1, ThreadPool::get().getThreadCount() * 4 );
+    const uint64 chunkSize = file.getSize() / chunkCountHint + 1;
+
+    std::vector<ObjChunk> chunks;
+    for( const char* begin = fileBegin; begin < fileEnd; )
+    {
+        const char* end = begin + std::min<uint64>( chunkSize, fileEnd - begin );
+        end = std::find( end, fileEnd, '\n' );
+        end = end < fileEnd ? end + 1 : end;
+        chunks.push_back( { begin, end } );
+        begin = end;
+    }
+
+    ThreadPool::get().parallelFor( static_cast< uint32 >( chunks.size() ), 1, [ & ]( uint32 chunkIndex )
+        {
+            parseChunk( chunks[ chunkIndex ] );
+        } );
+
+    for( const ObjChunk& chunk : chunks )
+    {
+        if( !chunk.error.empty() )
+        {
+            const uint64 line = std::count( fileBegin, chunk.begin, '\n' ) + chunk.errorLine;
+            outError = filePath + "(" + std::to_string( line ) + "): " + chunk.error;
+            return false;
+        }
+    }
+
+    // Offsets of every chunk in the merged arrays
+    struct ChunkOffsets
+    {
+        size_t vertex;
+        size_t normal;
+        size_t texcoord;
+        size_t index;
+    };
+
+    std::vector<ChunkOffsets> offsets( chunks.size() + 1, ChunkOffsets{ 0, 0, 0, 0 } );
+    for( size_t chunkIndex = 0; chunkIndex < chunks.size(); ++chunkIndex )
+    {
+        const ObjChunk& chunk = chunks[ chunkIndex ];
+        offsets[ chunkIndex + 1 ] = {
+            offsets[ chunkIndex ].vertex + chunk.vertices.size(),
+            offsets[ chunkIndex ].normal + chunk.normals.size(),
+            offsets[ chunkIndex ].texcoord + chunk.texcoords.size(),
+            offsets[ chunkIndex ].index + chunk.indices.size() };
+    }
+
+    const ChunkOffsets& totals = offsets.back();
+    outData.vertices.resize( totals.vertex );
+    outData.normals.resize( totals.normal );
+    outData.texcoords.resize( totals.texcoord );
+    outData.indices.resize( totals.index );
+
+    const int32 vertexCount = static_cast< int32 >( totals.vertex / 3 );
+    const int32 normalCount = static_cast< int32 >( totals.normal / 3 );
+    const int32 texcoordCount = static_cast< int32 >( totals.texcoord / 2 );
+    std::atomic<bool> bIndicesValid = true;
+
+    ThreadPool::get().parallelFor( static_cast< uint32 >( chunks.size() ), 1, [ & ]( uint32 chunkIndex )
+        {
+            const ObjChunk& chunk = chunks[ chunkIndex ];
+            const ChunkOffsets& offset = offsets[ chunkIndex ];
+            std::copy( chunk.vertices.begin(), chunk.vertices.end(), outData.vertices.begin() + offset.vertex );
+            std::copy( chunk.normals.begin(), chunk.normals.end(), outData.normals.begin() + offset.normal );
+            std::copy( chunk.texcoords.begin(), chunk.texcoords.end(), outData.texcoords.begin() + offset.texcoord );
+
+            const int32 vertexBase = static_cast< int32 >( offset.vertex / 3 );
+            const int32 normalBase = static_cast< int32 >( offset.normal / 3 );
+            const int32 texcoordBase = static_cast< int32 >( offset.texcoord / 2 );
+            for( size_t index = 0; index < chunk.indices.size(); ++index )
+            {
+                ObjIndex objIndex = chunk.indices[ index ];
+                const uint8 flags = chunk.relativeFlags[ index ];
+                if( flags & RELATIVE_VERTEX )
+                    objIndex.vertexIndex += vertexBase;
+                if( flags & RELATIVE_NORMAL )
+                    objIndex.normalIndex += normalBase;
+                if( flags & RELATIVE_TEXCOORD )
+                    objIndex.texcoordIndex += texcoordBase;
+
+                if( objIndex.vertexIndex < 0 || objIndex.vertexIndex >= vertexCount
+                    || objIndex.normalIndex >= normalCount || objIndex.texcoordIndex >= texcoordCount
+                    || ( ( flags & RELATIVE_NORMAL ) && objIndex.normalIndex < 0 )
+                    || ( ( flags & RELATIVE_TEXCOORD ) && objIndex.texcoordIndex < 0 ) )
+                {
+                    bIndicesValid = false;
+                }
+
+                outData.indices[ offset.index + index ] = objIndex;
+            }
+        } );
+
+    if( !bIndicesValid )
+    {
+        outError = filePath + ": face index out of range";
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "EngineTypes.h"
+#include <string>
+#include <vector>
+
+namespace A3
+{
+// Zero based, -1 when the face corner has no normal or texcoord
+struct ObjIndex
+{
+    int32 vertexIndex;
+    int32 normalIndex;
+    int32 texcoordIndex;
+};
+
+// Raw OBJ attributes with all faces fan-triangulated into indices, 3 per triangle
+struct ObjData
+{
+    std::vector<float> vertices;    // xyz
+    std::vector<float> normals;     // xyz
+    std::vector<float> texcoords;   // uv
+    std::vector<ObjIndex> indices;
+};
+
+namespace Utility
+{
+// Parses the geometry of an OBJ file in line aligned chunks on the ThreadPool.
+// Holds no global state, so different files can be parsed concurrently.
+bool parseObjFile( const std::string& filePath, ObjData& outData, std::string& outError );
+}
+}
@@ -1,20 +1,23 @@
 #include <cassert>
 #include "PathTracingRenderer.h"
 #include "RenderSettings.h"
-#include "Vulkan.h"
+#include "RenderBackend.h"
 #include "Scene.h"
 #include "MeshObject.h"
 #include "MeshResource.h"
 #include "AccelerationStructure.h"
 #include "PipelineStateObject.h"
+#include "ThreadPool.h"
+#include "Utility.h"
+#include <algorithm>
 
 using namespace A3;
 
-PathTracingRenderer::PathTracingRenderer( VulkanRenderBackend* inBackend )
+PathTracingRenderer::PathTracingRenderer( IRenderBackend* inBackend )
 	: backend( inBackend )
-    , samplePSO( new RaytracingPSO() )
 {
-    
+    for( std::unique_ptr<RaytracingPSO>& samplePSO : samplePSOs )
+        samplePSO.reset( new RaytracingPSO() );
 }
 
 PathTracingRenderer::~PathTracingRenderer() {}
@@ -33,9 +36,16 @@ void PathTracingRenderer::render( Scene& scene )
             // TODO: temp
             backend->tempScenePointer = &scene;
             buildAccelerationStructure( scene );    // scene 전체가 바뀌면 build 다시해야함
-            buildSamplePSO();                       // 얘도 scene 전체가 바뀌면 빌드 해줘야함
+            buildSamplePSOs();                      // 얘도 scene 전체가 바뀌면 빌드 해줘야함
             
             scene.cleanPosUpdated();
+            scene.cleanTransformUpdated();
+        }
+        else if( scene.isTransformUpdated() )
+        {
+            updateInstanceTransforms( scene );
+
+            scene.cleanTransformUpdated();
         }
         // Reset frame count when scene changes
         frameCount = 0;
@@ -51,6 +61,8 @@ void PathTracingRenderer::render( Scene& scene )
     // Pass frame count to backend
     backend->currentFrameCount = frameCount;
     
+    const imguiParam* param = scene.getImguiParam();
+    const RaytracingPSO* samplePSO = samplePSOs[ getSamplePSOIndex( param->lightSamplingMode, param->lightSelection ) ].get();
     backend->beginRaytracingPipeline( samplePSO->pipeline.get() );
 }
 
@@ -59,71 +71,95 @@ void PathTracingRenderer::endFrame() const
     backend->endFrame();
 }
 
+namespace
+{
 // @NOTE: This is a function to create a sample PSO.
-void PathTracingRenderer::buildSamplePSO()
+RaytracingPSODesc makeSamplePSODesc( uint32 lightSamplingMode, uint32 lightSelectionMode )
 {
     std::string shaderName = "shaders/SampleRaytracing.glsl";
 
     RaytracingPSODesc psoDesc;
     {
-        std::string samplingMode;
-        switch (backend->tempScenePointer->getImguiParam()->lightSamplingMode)
-        {
-        case imguiParam::BruteForce:
-            samplingMode = "BRUTE_FORCE_";
-            break;
-        case imguiParam::NEE:
-            samplingMode = "NEE_";
-            break;
-        }
-
-        std::string lightSelection;
-        switch (backend->tempScenePointer->getImguiParam()->lightSelection)
-        {
-        case imguiParam::LightOnly:
-            lightSelection = "LIGHT_ONLY_";
-            break;
-        case imguiParam::EnvMap:
-            lightSelection = "ENV_MAP_";
-            break;
-        case imguiParam::Both:
-            lightSelection = "ENV_MAP_";
-        }
+        // Both uses the env map integrator
+        std::vector<uint32> integratorConstants( SC_COUNT );
+        integratorConstants[ SC_LightSamplingMode ] = lightSamplingMode;
+        integratorConstants[ SC_LightSelection ] = ( lightSelectionMode == imguiParam::LightOnly ? imguiParam::LightOnly : imguiParam::EnvMap );
 
+        // The bounce loop runs in the ray generation shader, closest hit only reports the surface and the miss shader the miss
         psoDesc.shaders.emplace_back( SS_RayGeneration, shaderName );
-        psoDesc.shaders.emplace_back( SS_Miss, shaderName, lightSelection + "ENVIRONMENT_" );
-        psoDesc.shaders.emplace_back( SS_ClosestHit, shaderName, samplingMode + lightSelection);
-        psoDesc.shaders.emplace_back( SS_AnyHit, shaderName );
-        psoDesc.shaders.emplace_back( SS_Miss, shaderName, "SHADOW_" );
+        psoDesc.shaders.emplace_back( SS_Miss, shaderName );
+        psoDesc.shaders.emplace_back( SS_ClosestHit, shaderName );
+        psoDesc.shaders[ 0 ].specializationConstants = integratorConstants;
         ShaderDesc& rayGeneration = psoDesc.shaders[ 0 ];
         rayGeneration.descriptors.emplace_back( SRD_AccelerationStructure, 0 );
         rayGeneration.descriptors.emplace_back( SRD_StorageImage, 1 );
-        rayGeneration.descriptors.emplace_back( SRD_UniformBuffer, 2 );
-        rayGeneration.descriptors.emplace_back( SRD_StorageBuffer, 4 ); // Light buffer
+        rayGeneration.descriptors.emplace_back( SRD_UniformBufferDynamic, 2 );
+        rayGeneration.descriptors.emplace_back( SRD_StorageBuffer, 3 );
+        rayGeneration.descriptors.emplace_back( SRD_StorageBufferDynamic, 4 ); // Light buffer
         rayGeneration.descriptors.emplace_back( SRD_StorageImage, 5 ); // Accumulation image
-        rayGeneration.descriptors.emplace_back( SRD_UniformBuffer, 7 ); // Imgui parameters
-        ShaderDesc& environmentMiss = psoDesc.shaders[1];
-        environmentMiss.descriptors.emplace_back( SRD_ImageSampler, 6 );
-        environmentMiss.descriptors.emplace_back( SRD_UniformBuffer, 7 ); // Imgui parameters
-        environmentMiss.descriptors.emplace_back(SRD_ImageSampler, 8); // environmentMap Sampling
-        environmentMiss.descriptors.emplace_back( SRD_ImageSampler, 9 ); // environmentMap HitPos PDF
+        rayGeneration.descriptors.emplace_back( SRD_ImageSampler, 6 );
+        rayGeneration.descriptors.emplace_back( SRD_UniformBufferDynamic, 7 ); // Imgui parameters
+        rayGeneration.descriptors.emplace_back( SRD_StorageBuffer, 8 ); // environmentMap alias table
+        rayGeneration.descriptors.emplace_back( SRD_StorageBufferDynamic, 10 ); // Light of every instance
         ShaderDesc& closestHit = psoDesc.shaders[ 2 ];
-        closestHit.descriptors.emplace_back( SRD_AccelerationStructure, 0 );
         closestHit.descriptors.emplace_back( SRD_StorageBuffer, 3 );
-        closestHit.descriptors.emplace_back( SRD_StorageBuffer, 4 ); // Light buffer
-        closestHit.descriptors.emplace_back( SRD_UniformBuffer, 7 ); // Imgui parameters
-        closestHit.descriptors.emplace_back( SRD_ImageSampler, 6 );
-        closestHit.descriptors.emplace_back( SRD_ImageSampler, 8 ); // environmentMap Sampling
     }
 
-    samplePSO->shaders.resize( psoDesc.shaders.size() );
-    for( int32 index = 0; index < psoDesc.shaders.size(); ++index )
+    return psoDesc;
+}
+}
+
+// Both uses the same specialization as EnvMap, so it shares its PSO
+uint32 PathTracingRenderer::getSamplePSOIndex( uint32 lightSamplingMode, uint32 lightSelection )
+{
+    return lightSamplingMode * 2 + ( lightSelection == imguiParam::LightOnly ? 0 : 1 );
+}
+
+// Builds the PSO of every light sampling mode and light selection, switching modes then only picks another one
+void PathTracingRenderer::buildSamplePSOs()
+{
+    std::vector<RaytracingPSODesc> psoDescs( SAMPLE_PSO_COUNT );
+    psoDescs[ getSamplePSOIndex( imguiParam::BruteForce, imguiParam::LightOnly ) ] = makeSamplePSODesc( imguiParam::BruteForce, imguiParam::LightOnly );
+    psoDescs[ getSamplePSOIndex( imguiParam::BruteForce, imguiParam::EnvMap ) ] = makeSamplePSODesc( imguiParam::BruteForce, imguiParam::EnvMap );
+    psoDescs[ getSamplePSOIndex( imguiParam::NEE, imguiParam::LightOnly ) ] = makeSamplePSODesc( imguiParam::NEE, imguiParam::LightOnly );
+    psoDescs[ getSamplePSOIndex( imguiParam::NEE, imguiParam::EnvMap ) ] = makeSamplePSODesc( imguiParam::NEE, imguiParam::EnvMap );
+
+    // Variants missing from the shader cache are compiled on the thread pool, the PSOs are assembled once all are ready
+    std::vector<const ShaderDesc*> missingShaders;
+    for( const RaytracingPSODesc& psoDesc : psoDescs )
     {
-        const ShaderDesc& shaderDesc = psoDesc.shaders[ index ];
-        samplePSO->shaders[ index ] = shaderCache.addShaderModule( shaderDesc, backend->createShaderModule( shaderDesc ) );
+        for( const ShaderDesc& shaderDesc : psoDesc.shaders )
+        {
+            const bool bQueued = std::any_of( missingShaders.begin(), missingShaders.end(), [ & ]( const ShaderDesc* missing )
+                {
+                    return *missing == shaderDesc;
+                } );
+
+            if( !bQueued && shaderCache.getShaderModule( shaderDesc ) == nullptr )
+                missingShaders.push_back( &shaderDesc );
+        }
     }
 
-    samplePSO->pipeline = backend->createRayTracingPipeline( psoDesc, samplePSO.get() );
+    std::vector<IShaderModuleRef> compiledShaders( missingShaders.size() );
+    ThreadPool::get().parallelFor( static_cast< uint32 >( missingShaders.size() ), 1, [ & ]( uint32 missingIndex )
+        {
+            compiledShaders[ missingIndex ] = backend->createShaderModule( *missingShaders[ missingIndex ] );
+        } );
+
+    for( uint32 missingIndex = 0; missingIndex < missingShaders.size(); ++missingIndex )
+        shaderCache.addShaderModule( *missingShaders[ missingIndex ], std::move( compiledShaders[ missingIndex ] ) );
+
+    for( uint32 psoIndex = 0; psoIndex < SAMPLE_PSO_COUNT; ++psoIndex )
+    {
+        const RaytracingPSODesc& psoDesc = psoDescs[ psoIndex ];
+        RaytracingPSO* samplePSO = samplePSOs[ psoIndex ].get();
+
+        samplePSO->shaders.resize( psoDesc.shaders.size() );
+        for( int32 index = 0; index < psoDesc.shaders.size(); ++index )
+            samplePSO->shaders[ index ] = shaderCache.getShaderModule( psoDesc.shaders[ index ] );
+
+        samplePSO->pipeline = backend->createRayTracingPipeline( psoDesc, samplePSO );
+    }
 }
 
 void PathTracingRenderer::buildAccelerationStructure( Scene& scene ) const
@@ -132,9 +168,16 @@ void PathTracingRenderer::buildAccelerationStructure( Scene& scene ) const
     std::vector<BLASBatch*> batches;
     batches.resize( meshObjects.size() );
 
+    // All BLASes go to the backend in one batch, so it can build them with a single submission
+    std::vector<BLASBuildParams> buildParams;
+    buildParams.reserve( meshObjects.size() );
+    for( MeshObject* meshObject : meshObjects )
+        buildParams.push_back( meshObject->getBLASBuildParams() );
+
+    std::vector<IAccelerationStructureRef> blases = backend->createBLASes( buildParams );
     for( int32 index = 0; index < meshObjects.size(); ++index )
     {
-        meshObjects[ index ]->createRenderResources( backend );
+        meshObjects[ index ]->setBLAS( std::move( blases[ index ] ) );
         batches[ index ] = meshObjects[ index ]->getBLASBatch();
     }
 
@@ -147,6 +190,22 @@ void PathTracingRenderer::buildAccelerationStructure( Scene& scene ) const
     }
 }
 
+// Transform only edits keep every BLAS, the pipeline and its descriptor sets, only the TLAS instances are rewritten
+void PathTracingRenderer::updateInstanceTransforms( Scene& scene ) const
+{
+    std::vector<MeshObject*> meshObjects = scene.collectMeshObjects();
+    std::vector<BLASBatch*> batches;
+    batches.resize( meshObjects.size() );
+
+    for( int32 index = 0; index < meshObjects.size(); ++index )
+    {
+        meshObjects[ index ]->updateRenderTransforms();
+        batches[ index ] = meshObjects[ index ]->getBLASBatch();
+    }
+
+    backend->updateTLAS( batches );
+}
+
 void PathTracingRenderer::updateLightBuffer( const Scene& scene )
 {
     lights.clear();
@@ -154,20 +213,37 @@ void PathTracingRenderer::updateLightBuffer( const Scene& scene )
     // Collect all mesh objects that are lights
     std::vector<MeshObject*> meshObjects = scene.collectMeshObjects();
     
+    std::vector<float> lightPowers;
+    double totalPower = 0.0;
     for( size_t i = 0; i < meshObjects.size(); ++i )
     {
         MeshObject* meshObj = meshObjects[i];
 
-        if( meshObj->isLight() ) // TODO: Only 1 light for now
+        if( meshObj->isLight() )
         {
+            const MeshResource* resource = meshObj->getResource();
+
             LightData light;
             light.transform = meshObj->getLocalToWorld();
             light.emission = meshObj->getEmittance();
-            light.triangleCount = meshObj->getResource()->triangleCount;
+            light.triangleCount = resource->triangleCount;
+            light.instanceIndex = static_cast< uint32 >( i );
+            light.area = resource->cumulativeTriangleArea[ resource->triangleCount ];
             
             lights.push_back( light );
+            lightPowers.push_back( light.emission * light.area );
+            totalPower += lightPowers.back();
         }
     }
+
+    std::vector<Utility::AliasTableEntry> selection;
+    Utility::buildAliasTable( selection, lightPowers, totalPower );
+    for( size_t i = 0; i < lights.size(); ++i )
+    {
+        lights[ i ].selectionPdf = totalPower > 0.0 ? static_cast< float >( lightPowers[ i ] / totalPower ) : 1.0f / lights.size();
+        lights[ i ].selectionThreshold = selection[ i ].threshold;
+        lights[ i ].selectionAlias = selection[ i ].alias;
+    }
     
     // Update light buffer in backend
     backend->updateLightBuffer( lights );
@@ -4,12 +4,13 @@
 #include "Shader.h"
 #include "Vector.h"
 #include "Matrix.h"
+#include <array>
 #include <memory>
 #include <vector>
 
 namespace A3
 {
-class VulkanRenderBackend;
+class IRenderBackend;
 class Scene;
 class MeshObject;
 struct RaytracingPSO;
@@ -19,14 +20,23 @@ struct LightData // TODO: scene or renderer?
 	Mat4x4 transform = Mat4x4::identity;
 	float emission = 0.0f;
 	uint32 triangleCount = 0;
-	uint32 padding1 = 0;
-	uint32 padding2 = 0;
+	uint32 instanceIndex = 0;
+	float area = 0.0f;
+
+	// Lights are picked proportionally to emission * area through an alias table over the light array
+	float selectionPdf = 0.0f;
+	float selectionThreshold = 1.0f;
+	uint32 selectionAlias = 0;
+	uint32 padding = 0;
 };
 
+// Light index of the instances that do not emit
+constexpr uint32 INVALID_LIGHT_INDEX = 0xFFFFFFFF;
+
 class PathTracingRenderer
 {
 public:
-	PathTracingRenderer( VulkanRenderBackend* inBackend );
+	PathTracingRenderer( IRenderBackend* inBackend );
 	~PathTracingRenderer();
 
 	void beginFrame( int32 screenWidth, int32 screenHeight ) const;
@@ -34,17 +44,20 @@ public:
 	void endFrame() const;
 
 private:
-	void buildSamplePSO();
+	static uint32 getSamplePSOIndex( uint32 lightSamplingMode, uint32 lightSelection );
+	void buildSamplePSOs();
 	void buildAccelerationStructure( Scene& scene ) const;
+	void updateInstanceTransforms( Scene& scene ) const;
 	void updateLightBuffer( const Scene& scene );
 
 private:
-	VulkanRenderBackend* backend;
+	IRenderBackend* backend;
 
 	ShaderCache shaderCache;
 
-	// @TODO: Move to global variable
-	std::unique_ptr<RaytracingPSO> samplePSO;
+	// One PSO per light sampling mode x light selection, indexed by getSamplePSOIndex
+	static constexpr uint32 SAMPLE_PSO_COUNT = 4;
+	std::array<std::unique_ptr<RaytracingPSO>, SAMPLE_PSO_COUNT> samplePSOs;
 	
 	// Variable for frame accumulation
 	mutable uint32 frameCount = 0;
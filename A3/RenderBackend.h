@@ -12,6 +12,7 @@ struct BLASBatch;
 struct RaytracingPSO;
 struct RaytracingPSODesc;
 struct LightData;
+class Scene;
 
 struct BLASBuildParams
 {
@@ -25,6 +26,8 @@ struct BLASBuildParams
 class IRenderBackend
 {
 public:
+    virtual ~IRenderBackend() {}
+
     virtual void beginFrame( int32 screenWidth, int32 screenHeight ) = 0;
     virtual void endFrame() = 0;
 
@@ -34,12 +37,24 @@ public:
 
     virtual IAccelerationStructureRef createBLAS( const BLASBuildParams params ) = 0;
 
+    // Builds every BLAS of the batch at once, results are in the order of params
+    virtual std::vector<IAccelerationStructureRef> createBLASes( const std::vector<BLASBuildParams>& params ) = 0;
+
     virtual void createTLAS( const std::vector<BLASBatch*>& batches ) = 0;
 
+    // Rewrites the instance transforms of the TLAS made by createTLAS, keeping its BLASes, instance order and pipeline bindings
+    virtual void updateTLAS( const std::vector<BLASBatch*>& batches ) = 0;
+
     virtual IShaderModuleRef createShaderModule( const ShaderDesc& desc ) = 0;
 
     virtual IRenderPipelineRef createRayTracingPipeline( const RaytracingPSODesc& psoDesc, RaytracingPSO* pso ) = 0;
     
     virtual void updateLightBuffer( const std::vector<LightData>& lights ) = 0;
+
+    virtual void updateImguiBuffer() = 0;
+
+    //@TODO: Move to renderer
+    const Scene* tempScenePointer = nullptr;
+    uint32 currentFrameCount = 0;
 };
 }
\ No newline at end of file
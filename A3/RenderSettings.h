@@ -11,7 +11,19 @@ struct RenderSettings
 
 	static constexpr uint32 shaderGroupHandleSize = 32;
 
-	static constexpr uint32 maxLightCounts = 16;
+	// Frames the CPU may record ahead of the GPU, each owns its command pool, fence and semaphores
+	static constexpr uint32 maxFramesInFlight = 2;
+
+	// Upper bound of the scratch memory shared by one group of batched BLAS builds
+	static constexpr uint64 blasScratchBudget = 256ull << 20;
+
+	// Copies freshly built BLASes into storage of their compacted size
+	static constexpr bool bCompactBLAS = true;
+
+	// Compiled SPIR-V is kept here, keyed by the preprocessed shader source
+	static constexpr bool bUseShaderCache = true;
+	static constexpr const char* shaderCacheDirectory = "ShaderCache";
+	static constexpr const char* pipelineCachePath = "ShaderCache/PipelineCache.bin";
 
 	static constexpr const char* sceneFiles[] = { "../Assets/bruteforce-local.json",
 												 "../Assets/nee-local.json",
@@ -23,5 +35,13 @@ struct RenderSettings
 	// static constexpr const char* envMapDefault = "../Assets/reichstag_1_4k.hdr";
 	static constexpr const char* envMapDefault = "../Assets/rogland_sunset_4k.hdr";
 	static inline std::string envMapPath = "";
+
+	// GPU format of the environment map, "format" of the scene's envmap ( "rgba32f", "rgba16f" or "bc6h" )
+	enum EnvMapFormat : uint32 {
+		EnvMapRGBA32F = 0,
+		EnvMapRGBA16F,
+		EnvMapBC6H
+	};
+	static inline uint32 envMapFormat = EnvMapRGBA32F;
 };
 }
\ No newline at end of file
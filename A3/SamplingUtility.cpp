@@ -0,0 +1,93 @@
+#include "Utility.h"
+#include "ThreadPool.h"
+#include <cmath>
+
+using namespace A3;
+
+void Utility::buildAliasTable( std::vector<AliasTableEntry>& outTable, const std::vector<float>& weights, double weightSum )
+{
+    const uint32 count = static_cast< uint32 >( weights.size() );
+    outTable.resize( count );
+    if( weightSum <= 0.0 )
+    {
+        for( uint32 i = 0; i < count; ++i )
+            outTable[ i ] = { 1.0f, i };
+        return;
+    }
+
+    // Every index gets a bucket of probability 1 / count. Indices below that fill the rest of their bucket
+    // with an index above it, which gives away exactly what was missing.
+    std::vector<double> scaledWeights( count );
+    std::vector<uint32> smallIndices;
+    std::vector<uint32> largeIndices;
+    smallIndices.reserve( count );
+    largeIndices.reserve( count );
+
+    for( uint32 i = 0; i < count; ++i )
+    {
+        scaledWeights[ i ] = weights[ i ] * count / weightSum;
+        ( scaledWeights[ i ] < 1.0 ? smallIndices : largeIndices ).push_back( i );
+    }
+
+    while( !smallIndices.empty() && !largeIndices.empty() )
+    {
+        const uint32 small = smallIndices.back();
+        smallIndices.pop_back();
+        const uint32 large = largeIndices.back();
+
+        outTable[ small ] = { static_cast< float >( scaledWeights[ small ] ), large };
+
+        scaledWeights[ large ] = ( scaledWeights[ large ] + scaledWeights[ small ] ) - 1.0;
+        if( scaledWeights[ large ] < 1.0 )
+        {
+            largeIndices.pop_back();
+            smallIndices.push_back( large );
+        }
+    }
+
+    // Whatever is left is 1 up to rounding error
+    for( uint32 i : largeIndices )
+        outTable[ i ] = { 1.0f, i };
+    for( uint32 i : smallIndices )
+        outTable[ i ] = { 1.0f, i };
+}
+
+void Utility::buildEnvironmentAliasTable( std::vector<EnvAliasEntry>& outTable, const float* rgbPixels, uint32 width, uint32 height )
+{
+    const uint32 texelCount = width * height;
+    std::vector<float> luminances( texelCount );
+    std::vector<double> rowSums( height );
+
+    // Luminance is softened by a 0.9 power, sin(theta) accounts for the rows shrinking towards the poles.
+    // Rows are independent, so they are spread over the thread pool.
+    const float gamma = 0.9f;
+    ThreadPool::get().parallelFor( height, 4, [ & ]( uint32 y )
+        {
+            const float sinTheta = std::sin( 3.14159265f * ( y + 0.5f ) / float( height ) );
+            const float* rowPixels = rgbPixels + size_t( y ) * width * 3;
+            float* rowLuminances = luminances.data() + size_t( y ) * width;
+
+            double rowSum = 0.0;
+            for( uint32 x = 0; x < width; ++x )
+            {
+                const float lum = std::pow( 0.2126f * rowPixels[ x * 3 + 0 ] + 0.7152f * rowPixels[ x * 3 + 1 ] + 0.0722f * rowPixels[ x * 3 + 2 ], gamma );
+                rowLuminances[ x ] = lum * sinTheta;
+                rowSum += rowLuminances[ x ];
+            }
+            rowSums[ y ] = rowSum;
+        } );
+
+    double luminanceSum = 0.0;
+    for( uint32 y = 0; y < height; ++y )
+        luminanceSum += rowSums[ y ];
+
+    if( luminanceSum <= 0.0 )
+        luminanceSum = 1e-6; // @TODO: Reject black maps instead
+
+    std::vector<AliasTableEntry> buckets;
+    buildAliasTable( buckets, luminances, luminanceSum );
+
+    outTable.resize( texelCount );
+    for( uint32 i = 0; i < texelCount; ++i )
+        outTable[ i ] = { buckets[ i ].threshold, buckets[ i ].alias, static_cast< float >( luminances[ i ] / luminanceSum ) };
+}
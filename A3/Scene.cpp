@@ -1,12 +1,16 @@
 #include "Scene.h"
 
 #include <fstream>
+#include <iostream>
+#include <atomic>
+#include <mutex>
 
 #include "Utility.h"
 #include "MeshObject.h"
 #include "MeshResource.h"
 #include "CameraObject.h"
 #include "RenderSettings.h"
+#include "ThreadPool.h"
 
 #include "Json.hpp"
 
@@ -14,7 +18,7 @@ using namespace A3;
 using Json = nlohmann::json;
 
 Scene::Scene()
-	: bSceneDirty(true), bBufferUpdated(true), bPosUpdated(true)
+	: bSceneDirty(true), bBufferUpdated(true), bPosUpdated(true), bTransformUpdated(false)
 {
 	this->imgui_param = std::make_unique<imguiParam>();
 }
@@ -25,7 +29,7 @@ Scene::~Scene() {
 	}
 }
 
-void Scene::load(const std::string& path) {
+void Scene::load(const std::string& path, const SceneLoadProgressCallback& onProgress) {
 	this->resources.clear();
 	this->lightIndex.clear();
 	this->objects.clear();
@@ -47,6 +51,7 @@ void Scene::load(const std::string& path) {
 		auto& lightSampling = camera["lightSampling"];
 		auto& maxDepth = camera["maxDepth"];
 		auto& spp = camera["spp"];
+		auto& rouletteMinDepth = camera["rouletteMinDepth"];
 		auto& exposure = camera["exposure"]; // TODO: add logic
 
 		this->camera = std::make_unique<CameraObject>();
@@ -57,6 +62,8 @@ void Scene::load(const std::string& path) {
 
 		this->imgui_param->frameCount = spp; // one sampling per frame
 		this->imgui_param->maxDepth = maxDepth;
+		if (rouletteMinDepth.is_number())
+			this->imgui_param->rouletteMinDepth = rouletteMinDepth;
 		this->imgui_param->lightSamplingMode = (sampling == "bruteforce" ? imguiParam::BruteForce : imguiParam::NEE);
 		this->imgui_param->lightSelection = (lightSampling == "light_only" ? imguiParam::LightOnly : imguiParam::EnvMap);
 	}
@@ -67,14 +74,66 @@ void Scene::load(const std::string& path) {
 		auto& envmapRotation = envMap["rotation"];			// TODO: add logic
 		auto& envmapEmittance = envMap["emittanceScale"];	// TODO: add logic
 
+		auto& envmapFormat = envMap["format"];
+
 		RenderSettings::envMapPath = "../Assets/" + static_cast<std::string>(envMapPath);
 		this->imgui_param->envmapRotDeg = envmapRotation;
+		if (envmapFormat.is_string())
+			RenderSettings::envMapFormat = (envmapFormat == "bc6h" ? RenderSettings::EnvMapBC6H
+				: envmapFormat == "rgba16f" ? RenderSettings::EnvMapRGBA16F : RenderSettings::EnvMapRGBA32F);
 	}
 
 	auto& materials = data["materials"];
 
 	auto& objects = data["sceneComponets"];
 	if (objects.is_object()) {
+		// Unique meshes are loaded concurrently up front, so the load time is bounded by the largest mesh instead of the sum
+		std::vector<std::string> meshNames;
+		for (auto& [name, object] : objects.items()) {
+			const std::string meshName = object["mesh"].get<std::string>();
+			if (resources.emplace(meshName, nullptr).second)
+				meshNames.push_back(meshName);
+		}
+
+		const uint32 meshCount = static_cast<uint32>(meshNames.size());
+		std::atomic<uint32> loadedMeshCount = 0;
+		std::vector<std::string> loadErrors(meshCount);
+		std::mutex progressMutex;
+		{
+			TaskGroup loadTasks;
+			for (uint32 meshIndex = 0; meshIndex < meshCount; ++meshIndex) {
+				const std::string& meshName = meshNames[meshIndex];
+				MeshResource* resource = new MeshResource();
+				resources[meshName] = resource;
+
+				// Failures are only recorded here, exiting from a pool worker would tear the pool down under itself
+				loadTasks.run([&, resource, meshName, meshIndex]() {
+					if (!Utility::loadMeshFile(*resource, "../Assets/" + meshName, loadErrors[meshIndex]))
+						return;
+
+					const uint32 loadedCount = ++loadedMeshCount;
+					if (onProgress) {
+						std::lock_guard<std::mutex> lock(progressMutex);
+						onProgress(loadedCount, meshCount);
+					}
+				});
+			}
+			loadTasks.wait();
+		}
+
+		bool bLoadFailed = false;
+		for (const std::string& error : loadErrors) {
+			if (!error.empty()) {
+				std::cerr << "ObjParser: " << error << "\n";
+				bLoadFailed = true;
+			}
+		}
+		if (bLoadFailed)
+			exit(1);
+
+		// Objects sharing a resource write the same triangle area table, so they are grouped per resource
+		std::unordered_map<MeshResource*, std::vector<MeshObject*>> objectsByResource;
+
 		int index = 0;
 		for (auto& [name, object] : objects.items())
 		{
@@ -88,17 +147,12 @@ void Scene::load(const std::string& path) {
 			auto& metallic = material["metallic"];
 			auto& roughness = material["roughness"];
 
-			if (resources.find(mesh) == resources.end()) {
-				MeshResource resource;
-				Utility::loadMeshFile(resource, "../Assets/" + ((std::string)mesh));
-				resources[mesh] = new MeshResource(resource);
-			}
-
-			MeshObject* mo = new MeshObject(resources[mesh]);
+			MeshResource* resource = resources[mesh];
+			MeshObject* mo = new MeshObject(resource);
 			mo->setPosition(Vec3(position[0], position[1], position[2]));
 			mo->setRotation(Vec3(rotation[0], rotation[1], rotation[2]));
 			mo->setScale(Vec3(scale[0], scale[1], scale[2]));
-			mo->calculateTriangleArea();
+			objectsByResource[resource].push_back(mo);
 
 			mo->setBaseColor(Vec3(baseColor[0], baseColor[1], baseColor[2]));
 			if (materialName == "light") {
@@ -114,6 +168,15 @@ void Scene::load(const std::string& path) {
 			this->objects.emplace_back(mo);
 			index++;
 		}
+
+		std::vector<std::vector<MeshObject*>*> resourceObjects;
+		for (auto& [resource, meshObjects] : objectsByResource)
+			resourceObjects.push_back(&meshObjects);
+
+		ThreadPool::get().parallelFor(static_cast<uint32>(resourceObjects.size()), 1, [&](uint32 resourceIndex) {
+			for (MeshObject* mo : *resourceObjects[resourceIndex])
+				mo->calculateTriangleArea();
+		});
 	}
 }
 
@@ -3,6 +3,7 @@
 #include <vector>
 #include <memory>
 #include <string>
+#include <functional>
 #include <unordered_map>
 #include "EngineTypes.h"
 #include "Vector.h"
@@ -19,7 +20,9 @@ struct imguiParam // TODO: right for being part of scene?
 	uint32 maxDepth = 5;
 	uint32 numSamples = 1;
 	uint32 isProgressive = 1;
-	float envmapRotDeg = 0.0f; // 여기까지만 GPU에 넘겨줌
+	float envmapRotDeg = 0.0f;
+	// Paths may be terminated by Russian roulette once they reach this many bounces
+	uint32 rouletteMinDepth = 3; // 여기까지만 GPU에 넘겨줌
 	// TODO: separate CPU side and GPU side
 
 	Vec3 lightPos = Vec3(0.0f);
@@ -39,6 +42,9 @@ struct imguiParam // TODO: right for being part of scene?
 	uint32 lightSelection = LightOnly;
 };
 
+// Called as each unique mesh of the scene finishes loading, calls are serialized but may come from worker threads
+using SceneLoadProgressCallback = std::function<void(uint32 loadedMeshCount, uint32 totalMeshCount)>;
+
 enum class SceneDirty : uint8 {
 	None		= 0,
 	Geometry	= 1 << 0,	// mesh 추가, 삭제
@@ -53,7 +59,7 @@ public:
 	~Scene();
 
 public:
-	void load(const std::string &path);
+	void load(const std::string &path, const SceneLoadProgressCallback& onProgress = nullptr);
     void save(const std::string &path) const;
 
 	void beginFrame();
@@ -76,10 +82,16 @@ public:
 	void cleanPosUpdated() { bPosUpdated = false; }
 	bool isPosUpdated() const { return bPosUpdated; }
 
+	// Only object transforms changed, BLASes and pipelines are kept and just the TLAS instances are updated
+	void markTransformUpdated() { bTransformUpdated = true; bBufferUpdated = true; }
+	void cleanTransformUpdated() { bTransformUpdated = false; }
+	bool isTransformUpdated() const { return bTransformUpdated; }
+
 private:
 	bool bSceneDirty;
 	bool bBufferUpdated;
 	bool bPosUpdated;
+	bool bTransformUpdated;
 
     std::unordered_map<std::string, MeshResource*> resources;
     std::vector<std::unique_ptr<SceneObject>> objects;
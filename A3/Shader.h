@@ -4,6 +4,7 @@
 #include "RenderResource.h"
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace A3
 {
@@ -27,6 +28,16 @@ enum EShaderResourceDescriptor
     SRD_StorageBuffer,
     SRD_AccelerationStructure,
     SRD_ImageSampler,
+    SRD_UniformBufferDynamic,   // Per frame constants, bound at the offset of the current frame
+    SRD_StorageBufferDynamic,
+};
+
+// constant_id of the specialization constants in the shaders
+enum ESpecializationConstant
+{
+    SC_LightSamplingMode,
+    SC_LightSelection,
+    SC_COUNT
 };
 
 struct ShaderResourceDescriptor
@@ -46,6 +57,10 @@ struct ShaderDesc
     // Does not support yet
     std::string entry;
 
+    // Indexed by ESpecializationConstant, applied when the pipeline is created. They do not change the SPIR-V,
+    // so they are not part of the module identity below and all specializations share one cached module.
+    std::vector<uint32> specializationConstants;
+
     bool operator==( const ShaderDesc& other ) const
     {
         return type == other.type 
@@ -1,12 +1,113 @@
 #include "Vulkan.h"
 #include "VulkanResource.h"
+#include "RenderSettings.h"
 #include "Utility.h"
 
 #include <glslang/Include/glslang_c_interface.h>
 #include <glslang/Public/resource_limits_c.h>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <thread>
 
 using namespace A3;
 
+namespace
+{
+//=========================
+//   SPIR-V cache
+//=========================
+// One <key>.spv file per compiled shader, a header followed by the SPIR-V words. The key hashes the preprocessed
+// source ( includes resolved, predefines inserted ) and the stage. Bump the version when the glslang targets change.
+constexpr char SPIRV_CACHE_MAGIC[ 4 ] = { 'A', '3', 'S', 'V' };
+constexpr uint32 SPIRV_CACHE_VERSION = 1;
+constexpr uint32 SPIRV_MAGIC = 0x07230203;
+
+struct SpirvCacheHeader
+{
+    char magic[ 4 ];
+    uint32 version;
+    uint64 sourceHash;
+    uint64 sourceCheckHash;   // Second hash with another seed, guards against key collisions
+    uint64 sourceSize;
+    uint32 stage;
+    uint32 wordCount;
+};
+
+SpirvCacheHeader makeSpirvCacheHeader( glslang_stage_t stage, const std::string& preprocessedSource )
+{
+    SpirvCacheHeader header = {};
+    memcpy( header.magic, SPIRV_CACHE_MAGIC, sizeof( header.magic ) );
+    header.version = SPIRV_CACHE_VERSION;
+    header.stage = static_cast< uint32 >( stage );
+    header.sourceHash = Utility::hashString( preprocessedSource, Utility::hashString( std::to_string( header.stage ) ) );
+    header.sourceCheckHash = Utility::hashString( preprocessedSource, 0x84222325CBF29CE4ull );
+    header.sourceSize = preprocessedSource.size();
+    return header;
+}
+
+std::filesystem::path getSpirvCachePath( const SpirvCacheHeader& header )
+{
+    return std::filesystem::path( RenderSettings::shaderCacheDirectory ) / std::format( "{:016x}.spv", header.sourceHash );
+}
+
+bool loadSpirvCache( const SpirvCacheHeader& expected, std::vector<uint32>& outSpirv )
+{
+    std::ifstream file( getSpirvCachePath( expected ), std::ios::binary );
+    if( !file.is_open() )
+        return false;
+
+    SpirvCacheHeader header;
+    if( !file.read( reinterpret_cast< char* >( &header ), sizeof( header ) ) || header.wordCount == 0 )
+        return false;
+
+    // Everything but the word count has to match exactly
+    SpirvCacheHeader comparable = expected;
+    comparable.wordCount = header.wordCount;
+    if( memcmp( &header, &comparable, sizeof( header ) ) != 0 )
+        return false;
+
+    std::vector<uint32> spirv( header.wordCount );
+    if( !file.read( reinterpret_cast< char* >( spirv.data() ), spirv.size() * sizeof( uint32 ) ) || spirv[ 0 ] != SPIRV_MAGIC )
+        return false;
+
+    outSpirv = std::move( spirv );
+    return true;
+}
+
+void saveSpirvCache( SpirvCacheHeader header, const std::vector<uint32>& spirv )
+{
+    const std::filesystem::path cachePath = getSpirvCachePath( header );
+    std::error_code error;
+    std::filesystem::create_directories( cachePath.parent_path(), error );
+
+    // Written to a file private to this thread and renamed, so readers never see a partial file
+    std::filesystem::path tempPath = cachePath;
+    tempPath += std::format( ".{}.tmp", std::hash<std::thread::id>()( std::this_thread::get_id() ) );
+    {
+        header.wordCount = static_cast< uint32 >( spirv.size() );
+
+        std::ofstream file( tempPath, std::ios::binary | std::ios::trunc );
+        if( !file.is_open() )
+            return;
+
+        file.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+        file.write( reinterpret_cast< const char* >( spirv.data() ), spirv.size() * sizeof( uint32 ) );
+        if( !file )
+        {
+            file.close();
+            std::filesystem::remove( tempPath, error );
+            return;
+        }
+    }
+
+    std::filesystem::rename( tempPath, cachePath, error );
+    if( error )
+        std::filesystem::remove( tempPath, error );
+}
+}
+
 std::vector<uint32_t> glsl2spv( glslang_stage_t stage, const char* shaderSource )
 {
     const glslang_input_t input = {
@@ -37,6 +138,20 @@ std::vector<uint32_t> glsl2spv( glslang_stage_t stage, const char* shaderSource
         return {};
     }
 
+    // Preprocessing is cheap, parsing, linking and SPIR-V generation are skipped when the cache has the result
+    SpirvCacheHeader cacheHeader;
+    if( RenderSettings::bUseShaderCache )
+    {
+        cacheHeader = makeSpirvCacheHeader( stage, glslang_shader_get_preprocessed_code( shader ) );
+
+        std::vector<uint32> cachedSpirv;
+        if( loadSpirvCache( cacheHeader, cachedSpirv ) )
+        {
+            glslang_shader_delete( shader );
+            return cachedSpirv;
+        }
+    }
+
     if( !glslang_shader_parse( shader, &input ) )
     {
         printf( "GLSL parsing failed (%d)\n", stage );
@@ -73,6 +188,9 @@ std::vector<uint32_t> glsl2spv( glslang_stage_t stage, const char* shaderSource
     glslang_program_delete( program );
     glslang_shader_delete( shader );
 
+    if( RenderSettings::bUseShaderCache && !spvBirary.empty() )
+        saveSpirvCache( cacheHeader, spvBirary );
+
     return spvBirary;
 }
 
@@ -124,6 +242,18 @@ std::string insertPredefines( const std::string& shaderText, const ShaderDesc& d
     return outText;
 }
 
+// glslang keeps per process tables, they have to exist before shaders are compiled on several threads at once
+void VulkanRenderBackend::initializeShaderCompiler()
+{
+    glslang_initialize_process();
+}
+
+void VulkanRenderBackend::finalizeShaderCompiler()
+{
+    glslang_finalize_process();
+}
+
+// Thread safe, every call works on its own glslang shader and program objects
 IShaderModuleRef VulkanRenderBackend::createShaderModule( const ShaderDesc& desc )
 {
     VulkanShaderModule* outModule = new VulkanShaderModule();
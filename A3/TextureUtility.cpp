@@ -0,0 +1,255 @@
+#include "Utility.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+using namespace A3;
+
+namespace
+{
+constexpr int32 MAX_FINITE_HALF = 0x7BFF;
+
+//=========================
+//   BC6H
+//=========================
+// Every block is written in mode 11: one region, two 10 bit RGB endpoints without delta transform and 4 bit indices.
+// BC6H interpolates the bit patterns of the halves, so endpoints are fitted in that ( roughly logarithmic ) domain.
+constexpr uint32 BC6H_BLOCK_SIZE = 16;
+constexpr int32 BC6H_WEIGHTS[ 16 ] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Half the decoder produces for a 10 bit endpoint interpolated with weight against the other one
+int32 unquantizeBC6HEndpoint( int32 endpoint )
+{
+    if( endpoint == 0 )
+        return 0;
+    if( endpoint == 1023 )
+        return 0xFFFF;
+    return ( ( endpoint << 16 ) + 0x8000 ) >> 10;
+}
+
+int32 quantizeBC6HEndpoint( int32 half )
+{
+    return std::clamp( half / 31, 0, 1023 );
+}
+
+struct BC6HEndpoints
+{
+    int32 endpoints[ 2 ][ 3 ];
+    uint8 indices[ 16 ];
+    int64 error;
+};
+
+// Picks the closest of the 16 palette entries for every texel
+void assignBC6HIndices( const int32 texels[ 16 ][ 3 ], BC6HEndpoints& block )
+{
+    int32 palette[ 16 ][ 3 ];
+    for( uint32 channel = 0; channel < 3; ++channel )
+    {
+        const int32 a = unquantizeBC6HEndpoint( block.endpoints[ 0 ][ channel ] );
+        const int32 b = unquantizeBC6HEndpoint( block.endpoints[ 1 ][ channel ] );
+        for( uint32 index = 0; index < 16; ++index )
+            palette[ index ][ channel ] = ( ( ( a * ( 64 - BC6H_WEIGHTS[ index ] ) + b * BC6H_WEIGHTS[ index ] + 32 ) >> 6 ) * 31 ) >> 6;
+    }
+
+    block.error = 0;
+    for( uint32 texel = 0; texel < 16; ++texel )
+    {
+        int64 bestError = INT64_MAX;
+        for( uint32 index = 0; index < 16; ++index )
+        {
+            int64 error = 0;
+            for( uint32 channel = 0; channel < 3; ++channel )
+            {
+                const int64 difference = palette[ index ][ channel ] - texels[ texel ][ channel ];
+                error += difference * difference;
+            }
+            if( error < bestError )
+            {
+                bestError = error;
+                block.indices[ texel ] = static_cast< uint8 >( index );
+            }
+        }
+        block.error += bestError;
+    }
+}
+
+// Least squares endpoints for the current indices, one 2x2 system shared by the three channels
+void refitBC6HEndpoints( const int32 texels[ 16 ][ 3 ], BC6HEndpoints& block )
+{
+    double aa = 0.0, ab = 0.0, bb = 0.0;
+    double ax[ 3 ] = {}, bx[ 3 ] = {};
+    for( uint32 texel = 0; texel < 16; ++texel )
+    {
+        const double t = BC6H_WEIGHTS[ block.indices[ texel ] ] / 64.0;
+        aa += ( 1.0 - t ) * ( 1.0 - t );
+        ab += ( 1.0 - t ) * t;
+        bb += t * t;
+        for( uint32 channel = 0; channel < 3; ++channel )
+        {
+            ax[ channel ] += ( 1.0 - t ) * texels[ texel ][ channel ];
+            bx[ channel ] += t * texels[ texel ][ channel ];
+        }
+    }
+
+    const double determinant = aa * bb - ab * ab;
+    if( determinant < 1e-6 )
+        return;
+
+    for( uint32 channel = 0; channel < 3; ++channel )
+    {
+        const double a = ( bb * ax[ channel ] - ab * bx[ channel ] ) / determinant;
+        const double b = ( aa * bx[ channel ] - ab * ax[ channel ] ) / determinant;
+        block.endpoints[ 0 ][ channel ] = quantizeBC6HEndpoint( static_cast< int32 >( std::clamp( a, 0.0, double( MAX_FINITE_HALF ) ) + 0.5 ) );
+        block.endpoints[ 1 ][ channel ] = quantizeBC6HEndpoint( static_cast< int32 >( std::clamp( b, 0.0, double( MAX_FINITE_HALF ) ) + 0.5 ) );
+    }
+}
+
+void encodeBC6HBlock( const int32 texels[ 16 ][ 3 ], uint8* outBlock )
+{
+    int32 minimum[ 3 ] = { MAX_FINITE_HALF, MAX_FINITE_HALF, MAX_FINITE_HALF };
+    int32 maximum[ 3 ] = { 0, 0, 0 };
+    for( uint32 texel = 0; texel < 16; ++texel )
+    {
+        for( uint32 channel = 0; channel < 3; ++channel )
+        {
+            minimum[ channel ] = std::min( minimum[ channel ], texels[ texel ][ channel ] );
+            maximum[ channel ] = std::max( maximum[ channel ], texels[ texel ][ channel ] );
+        }
+    }
+
+    // Tries the four diagonals of the bounding box, green and blue may run against red
+    BC6HEndpoints best;
+    best.error = INT64_MAX;
+    for( uint32 diagonal = 0; diagonal < 4; ++diagonal )
+    {
+        BC6HEndpoints candidate;
+        for( uint32 channel = 0; channel < 3; ++channel )
+        {
+            const bool bFlip = channel > 0 && ( diagonal & ( 1u << ( channel - 1 ) ) );
+            candidate.endpoints[ 0 ][ channel ] = quantizeBC6HEndpoint( bFlip ? maximum[ channel ] : minimum[ channel ] );
+            candidate.endpoints[ 1 ][ channel ] = quantizeBC6HEndpoint( bFlip ? minimum[ channel ] : maximum[ channel ] );
+        }
+        assignBC6HIndices( texels, candidate );
+        if( candidate.error < best.error )
+            best = candidate;
+    }
+
+    BC6HEndpoints refined = best;
+    refitBC6HEndpoints( texels, refined );
+    assignBC6HIndices( texels, refined );
+    if( refined.error < best.error )
+        best = refined;
+
+    // The first index is stored without its top bit, so it has to be below 8. Swapping the endpoints mirrors the weights.
+    if( best.indices[ 0 ] >= 8 )
+    {
+        for( uint32 channel = 0; channel < 3; ++channel )
+            std::swap( best.endpoints[ 0 ][ channel ], best.endpoints[ 1 ][ channel ] );
+        for( uint8& index : best.indices )
+            index = 15 - index;
+    }
+
+    uint64 bits[ 2 ] = {};
+    uint32 bitOffset = 0;
+    auto writeBits = [ & ]( uint64 value, uint32 count )
+        {
+            for( uint32 bit = 0; bit < count; ++bit, ++bitOffset )
+                bits[ bitOffset / 64 ] |= ( ( value >> bit ) & 1 ) << ( bitOffset % 64 );
+        };
+
+    writeBits( 0x03, 5 );
+    for( uint32 endpoint = 0; endpoint < 2; ++endpoint )
+        for( uint32 channel = 0; channel < 3; ++channel )
+            writeBits( best.endpoints[ endpoint ][ channel ], 10 );
+
+    writeBits( best.indices[ 0 ], 3 );
+    for( uint32 texel = 1; texel < 16; ++texel )
+        writeBits( best.indices[ texel ], 4 );
+
+    std::memcpy( outBlock, bits, BC6H_BLOCK_SIZE );
+}
+}
+
+uint16 Utility::floatToHalf( float value )
+{
+    uint32 bits;
+    std::memcpy( &bits, &value, sizeof( bits ) );
+
+    const uint32 sign = ( bits >> 16 ) & 0x8000;
+    bits &= 0x7FFFFFFF;
+
+    if( bits > 0x7F800000 )
+        return static_cast< uint16 >( sign | 0x7E00 );
+    if( bits >= 0x477FF000 )    // Rounds to 65520 or more, clamped instead of becoming infinity
+        return static_cast< uint16 >( sign | MAX_FINITE_HALF );
+    if( bits < 0x33000000 )     // Below half of the smallest subnormal
+        return static_cast< uint16 >( sign );
+
+    // Round to nearest even in both branches
+    uint32 half;
+    uint32 remainder;
+    uint32 halfway;
+    if( bits < 0x38800000 )
+    {
+        const uint32 shift = 126 - ( bits >> 23 );
+        const uint32 mantissa = ( bits & 0x7FFFFF ) | 0x800000;
+        half = mantissa >> shift;
+        remainder = mantissa & ( ( 1u << shift ) - 1 );
+        halfway = 1u << ( shift - 1 );
+    }
+    else
+    {
+        half = ( bits - 0x38000000 ) >> 13;
+        remainder = bits & 0x1FFF;
+        halfway = 0x1000;
+    }
+
+    if( remainder > halfway || ( remainder == halfway && ( half & 1 ) ) )
+        ++half;
+
+    return static_cast< uint16 >( sign | half );
+}
+
+void Utility::encodeRGBA16F( std::vector<uint8>& outTexels, const float* rgbPixels, uint32 width, uint32 height )
+{
+    outTexels.resize( size_t( width ) * height * 4 * sizeof( uint16 ) );
+    uint16* texels = reinterpret_cast< uint16* >( outTexels.data() );
+
+    ThreadPool::get().parallelFor( height, 16, [ & ]( uint32 y )
+        {
+            for( size_t i = size_t( y ) * width; i < size_t( y + 1 ) * width; ++i )
+            {
+                texels[ i * 4 + 0 ] = floatToHalf( rgbPixels[ i * 3 + 0 ] );
+                texels[ i * 4 + 1 ] = floatToHalf( rgbPixels[ i * 3 + 1 ] );
+                texels[ i * 4 + 2 ] = floatToHalf( rgbPixels[ i * 3 + 2 ] );
+                texels[ i * 4 + 3 ] = 0x3C00;
+            }
+        } );
+}
+
+void Utility::encodeBC6H( std::vector<uint8>& outBlocks, const float* rgbPixels, uint32 width, uint32 height )
+{
+    const uint32 blockCountX = ( width + 3 ) / 4;
+    const uint32 blockCountY = ( height + 3 ) / 4;
+    outBlocks.resize( size_t( blockCountX ) * blockCountY * BC6H_BLOCK_SIZE );
+
+    ThreadPool::get().parallelFor( blockCountY, 1, [ & ]( uint32 blockY )
+        {
+            for( uint32 blockX = 0; blockX < blockCountX; ++blockX )
+            {
+                // Blocks hanging over the edge repeat the last row and column
+                int32 texels[ 16 ][ 3 ];
+                for( uint32 texel = 0; texel < 16; ++texel )
+                {
+                    const uint32 x = std::min( blockX * 4 + texel % 4, width - 1 );
+                    const uint32 y = std::min( blockY * 4 + texel / 4, height - 1 );
+                    const float* pixel = rgbPixels + ( size_t( y ) * width + x ) * 3;
+                    for( uint32 channel = 0; channel < 3; ++channel )
+                        texels[ texel ][ channel ] = floatToHalf( pixel[ channel ] > 0.0f ? pixel[ channel ] : 0.0f );
+                }
+
+                encodeBC6HBlock( texels, outBlocks.data() + ( size_t( blockY ) * blockCountX + blockX ) * BC6H_BLOCK_SIZE );
+            }
+        } );
+}
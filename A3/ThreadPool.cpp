@@ -0,0 +1,162 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+using namespace A3;
+
+ThreadPool::ThreadPool( uint32 threadCount )
+    : bStopping( false )
+{
+    // The calling thread always participates, so spawn one worker less
+    const uint32 workerCount = std::max( threadCount, 1u ) - 1;
+    workers.reserve( workerCount );
+    for( uint32 index = 0; index < workerCount; ++index )
+    {
+        workers.emplace_back( &ThreadPool::workerLoop, this );
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock( queueMutex );
+        bStopping = true;
+    }
+    queueCondition.notify_all();
+
+    for( std::thread& worker : workers )
+        worker.join();
+}
+
+ThreadPool& ThreadPool::get()
+{
+    static ThreadPool pool( std::max( std::thread::hardware_concurrency(), 1u ) );
+    return pool;
+}
+
+void ThreadPool::submit( std::function<void()> task )
+{
+    {
+        std::lock_guard<std::mutex> lock( queueMutex );
+        tasks.push_back( std::move( task ) );
+    }
+    queueCondition.notify_one();
+}
+
+bool ThreadPool::tryRunPendingTask()
+{
+    std::function<void()> task;
+    {
+        std::lock_guard<std::mutex> lock( queueMutex );
+        if( tasks.empty() )
+            return false;
+
+        task = std::move( tasks.front() );
+        tasks.pop_front();
+    }
+
+    task();
+    return true;
+}
+
+void ThreadPool::parallelFor( uint32 count, uint32 grainSize, const std::function<void( uint32 )>& func )
+{
+    if( count == 0 )
+        return;
+
+    grainSize = std::max( grainSize, 1u );
+    const uint32 chunkCount = ( count + grainSize - 1 ) / grainSize;
+    if( chunkCount == 1 || workers.empty() )
+    {
+        for( uint32 index = 0; index < count; ++index )
+            func( index );
+        return;
+    }
+
+    // Chunks are handed out dynamically so that uneven work (e.g. tiles of different cost) balances out
+    std::atomic<uint32> nextChunk = 0;
+    auto runChunks = [ & ]()
+        {
+            for( uint32 chunk = nextChunk++; chunk < chunkCount; chunk = nextChunk++ )
+            {
+                const uint32 begin = chunk * grainSize;
+                const uint32 end = std::min( begin + grainSize, count );
+                for( uint32 index = begin; index < end; ++index )
+                    func( index );
+            }
+        };
+
+    TaskGroup group( *this );
+    const uint32 helperCount = std::min( chunkCount, getThreadCount() ) - 1;
+    for( uint32 helper = 0; helper < helperCount; ++helper )
+        group.run( runChunks );
+
+    runChunks();
+    group.wait();
+}
+
+void ThreadPool::workerLoop()
+{
+    while( true )
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock( queueMutex );
+            queueCondition.wait( lock, [ this ]() { return bStopping || !tasks.empty(); } );
+            if( bStopping && tasks.empty() )
+                return;
+
+            task = std::move( tasks.front() );
+            tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+void TaskGroup::run( std::function<void()> task )
+{
+    ++pendingCount;
+    pool.submit( [ this, task = std::move( task ) ]()
+        {
+            // The count has to drop even when the task throws, otherwise wait() spins forever
+            struct PendingGuard
+            {
+                std::atomic<uint32>& count;
+                ~PendingGuard() { --count; }
+            } guard{ pendingCount };
+
+            try
+            {
+                task();
+            }
+            catch( ... )
+            {
+                std::lock_guard<std::mutex> lock( exceptionMutex );
+                if( !firstException )
+                    firstException = std::current_exception();
+            }
+        } );
+}
+
+void TaskGroup::wait()
+{
+    waitForTasks();
+
+    std::exception_ptr exception;
+    {
+        std::lock_guard<std::mutex> lock( exceptionMutex );
+        std::swap( exception, firstException );
+    }
+
+    if( exception )
+        std::rethrow_exception( exception );
+}
+
+void TaskGroup::waitForTasks()
+{
+    while( pendingCount.load() > 0 )
+    {
+        if( !pool.tryRunPendingTask() )
+            std::this_thread::yield();
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "EngineTypes.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace A3
+{
+class ThreadPool
+{
+public:
+    explicit ThreadPool( uint32 threadCount );
+    ~ThreadPool();
+
+    // Shared pool sized to the number of hardware threads
+    static ThreadPool& get();
+
+    uint32 getThreadCount() const { return static_cast< uint32 >( workers.size() ) + 1; }
+
+    void submit( std::function<void()> task );
+
+    // Runs one queued task on the calling thread, so that waiting threads keep the pool busy instead of blocking it
+    bool tryRunPendingTask();
+
+    // Calls func( index ) for [0, count) split into chunks of grainSize, the calling thread participates
+    void parallelFor( uint32 count, uint32 grainSize, const std::function<void( uint32 )>& func );
+
+private:
+    void workerLoop();
+
+private:
+    std::vector<std::thread> workers;
+
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::deque<std::function<void()>> tasks;
+    bool bStopping;
+};
+
+// Group of tasks which can be waited on together. Tasks may spawn nested tasks into the same group.
+// The first exception thrown by a task is kept and rethrown from wait() once every task has finished.
+class TaskGroup
+{
+public:
+    explicit TaskGroup( ThreadPool& inPool = ThreadPool::get() )
+        : pool( inPool )
+        , pendingCount( 0 )
+    {}
+
+    // Only drains the group, an exception that was never collected by wait() is dropped
+    ~TaskGroup() { waitForTasks(); }
+
+    void run( std::function<void()> task );
+    void wait();
+
+private:
+    void waitForTasks();
+
+private:
+    ThreadPool& pool;
+    std::atomic<uint32> pendingCount;
+
+    std::mutex exceptionMutex;
+    std::exception_ptr firstException;
+};
+}
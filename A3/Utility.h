@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include "EngineTypes.h"
 
 namespace A3
 {
@@ -8,8 +10,59 @@ struct MeshResource;
 
 namespace Utility
 {
-void loadMeshFile( MeshResource& outMesh, const std::string& filePath );
+// One bucket of an alias table, see buildAliasTable
+struct AliasTableEntry
+{
+    float threshold;    // Probability of keeping the bucket's own index instead of alias
+    uint32 alias;
+};
+
+// One bucket per environment map texel, same layout as EnvAliasEntry in SharedStructs.glsl
+struct EnvAliasEntry
+{
+    float threshold;    // Probability of keeping this texel instead of jumping to alias
+    uint32 alias;
+    float pdf;          // Discrete probability of this texel, samplers convert it to solid angle
+};
+
+struct MeshLoadOptions
+{
+    // Merge corners sharing the same ( position, normal, texcoord ) indices into one vertex
+    bool bDeduplicateVertices = true;
+    // Reorder triangles for the post-transform vertex cache ( Tipsify ) and vertices for fetch locality
+    bool bOptimizeVertexCache = true;
+    // Load from and write to the binary <file>.a3mesh cache next to the source file
+    bool bUseCache = true;
+};
+
+// Returns false and fills outError when the file cannot be opened or parsed, safe to call from pool workers
+bool loadMeshFile( MeshResource& outMesh, const std::string& filePath, std::string& outError, const MeshLoadOptions& options = {} );
+
+// Tipsify ( Sander et al. 2007 ), reorders the triangles of an indexed list in place
+void optimizeVertexCache( std::vector<uint32>& indices, uint32 vertexCount, uint32 cacheSize = 16 );
+
+// Renumbers vertices in order of first use by the index buffer
+void optimizeVertexFetch( MeshResource& mesh );
 
 void loadTextFile( std::string& outText, const std::string& filePath );
+
+// 64 bit FNV-1a, pass the previous result as seed to hash several strings as one
+uint64 hashString( const std::string& text, uint64 seed = 0xCBF29CE484222325ull );
+
+// Vose's alias method. Picking a uniform bucket and keeping its index with probability threshold, alias otherwise,
+// samples index i with probability weights[ i ] / weightSum in O( 1 ). A weightSum of 0 gives a uniform table.
+void buildAliasTable( std::vector<AliasTableEntry>& outTable, const std::vector<float>& weights, double weightSum );
+
+// Alias table over the texels of an equirectangular RGB map, weighted by luminance^0.9 * sin(theta)
+void buildEnvironmentAliasTable( std::vector<EnvAliasEntry>& outTable, const float* rgbPixels, uint32 width, uint32 height );
+
+// IEEE half, rounded to nearest even. Values beyond the half range are clamped to the largest finite half.
+uint16 floatToHalf( float value );
+
+// RGB float texels to RGBA16F with alpha 1
+void encodeRGBA16F( std::vector<uint8>& outTexels, const float* rgbPixels, uint32 width, uint32 height );
+
+// RGB float texels to BC6H unsigned float blocks, 16 bytes per 4x4 texels. Negative values are clamped to 0.
+void encodeBC6H( std::vector<uint8>& outBlocks, const float* rgbPixels, uint32 width, uint32 height );
 }
 }
\ No newline at end of file
@@ -108,6 +108,24 @@ struct IVec4
 	int w;
 };
 
+inline Vec3 operator+(const Vec3& lhs, const Vec3& rhs) { return Vec3(lhs.x + rhs.x, lhs.y + rhs.y, lhs.z + rhs.z); }
+inline Vec3 operator-(const Vec3& lhs, const Vec3& rhs) { return Vec3(lhs.x - rhs.x, lhs.y - rhs.y, lhs.z - rhs.z); }
+inline Vec3 operator-(const Vec3& v) { return Vec3(-v.x, -v.y, -v.z); }
+inline Vec3 operator*(const Vec3& lhs, const Vec3& rhs) { return Vec3(lhs.x * rhs.x, lhs.y * rhs.y, lhs.z * rhs.z); }
+inline Vec3 operator*(const Vec3& v, float s) { return Vec3(v.x * s, v.y * s, v.z * s); }
+inline Vec3 operator*(float s, const Vec3& v) { return Vec3(v.x * s, v.y * s, v.z * s); }
+inline Vec3 operator/(const Vec3& v, float s) { return v * (1.0f / s); }
+inline Vec3& operator+=(Vec3& lhs, const Vec3& rhs) { lhs = lhs + rhs; return lhs; }
+inline Vec3& operator*=(Vec3& lhs, float s) { lhs = lhs * s; return lhs; }
+
+inline float dot(const Vec3& lhs, const Vec3& rhs) { return lhs.x * rhs.x + lhs.y * rhs.y + lhs.z * rhs.z; }
+inline Vec3 cross(const Vec3& lhs, const Vec3& rhs)
+{
+	return Vec3(lhs.y * rhs.z - lhs.z * rhs.y,
+				lhs.z * rhs.x - lhs.x * rhs.z,
+				lhs.x * rhs.y - lhs.y * rhs.x);
+}
+
 float lengthSquared(const Vec3& v);
 float length(const Vec3& v);
 Vec3 normalize(const Vec3& v);
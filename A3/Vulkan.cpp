@@ -13,8 +13,11 @@
 #include "Shader.h"
 #include "PipelineStateObject.h"
 #include "PathTracingRenderer.h" // For LightData
+#include "MappedFile.h"
+#include "Utility.h"
 #include <random>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -51,7 +54,7 @@ const char* getVkResultString(VkResult result) {
 using namespace A3;
 
 VulkanRenderBackend::VulkanRenderBackend( GLFWwindow* window, std::vector<const char*>& extensions, int32 screenWidth, int32 screenHeight )
-    : lightBuffer(VK_NULL_HANDLE), lightBufferMem(VK_NULL_HANDLE)
+    : frameConstantBuffer(VK_NULL_HANDLE)
 {
     createVkInstance( extensions );
     createVkPhysicalDevice();
@@ -61,6 +64,8 @@ VulkanRenderBackend::VulkanRenderBackend( GLFWwindow* window, std::vector<const
     createSwapChain();
     createImguiRenderPass( screenWidth, screenHeight );
     createCommandCenter();
+    createPipelineCache();
+    initializeShaderCompiler();
 
     //// 옮겨야함
     //createEnvironmentMap(RenderSettings::envMapPath);
@@ -68,8 +73,13 @@ VulkanRenderBackend::VulkanRenderBackend( GLFWwindow* window, std::vector<const
 
 VulkanRenderBackend::~VulkanRenderBackend()
 {
+    vkDeviceWaitIdle( device );
+    savePipelineCache();
+    vkDestroyPipelineCache( device, pipelineCache, nullptr );
+    memoryAllocator.shutdown();
+    finalizeShaderCompiler();
+
     // @TODO: restore
-    //vkDeviceWaitIdle( device );
 
     //vkDestroyBuffer( device, tlasBuffer, nullptr );
     //vkFreeMemory( device, tlasBufferMem, nullptr );
@@ -146,20 +156,21 @@ static bool IsExtensionAvailable( const std::vector<VkExtensionProperties>& prop
 }
 ////////////////////////////////////////////////
 
+// Only waits for the frame which used this slot maxFramesInFlight frames ago, the previous frames keep running on the GPU
 void VulkanRenderBackend::beginFrame( int32 screenWidth, int32 screenHeight )
 {
-    VkSemaphore image_acquired_semaphore = imageAvailableSemaphores[ semaphoreIndex ];
-    VkSemaphore render_complete_semaphore = renderFinishedSemaphores[ semaphoreIndex ];
-    VkResult err = vkAcquireNextImageKHR( device, swapChain, UINT64_MAX, image_acquired_semaphore, VK_NULL_HANDLE, &imageIndex );
+    VkResult err;
+    err = vkWaitForFences(device, 1, &fences[frameIndex], VK_TRUE, UINT64_MAX);    // wait indefinitely instead of periodically checking
+    check_vk_result(err);
 
-    {
-        VkResult err;
-        err = vkWaitForFences(device, 1, &fences[imageIndex], VK_TRUE, UINT64_MAX);    // wait indefinitely instead of periodically checking
-        check_vk_result(err);
+    err = vkResetFences(device, 1, &fences[frameIndex]);
+    check_vk_result(err);
 
-        err = vkResetFences(device, 1, &fences[imageIndex]);
-        check_vk_result(err);
-    }
+    err = vkResetCommandPool( device, commandPools[ frameIndex ], 0 );
+    check_vk_result( err );
+
+    err = vkAcquireNextImageKHR( device, swapChain, UINT64_MAX, imageAvailableSemaphores[ frameIndex ], VK_NULL_HANDLE, &imageIndex );
+    check_vk_result( err );
 }
 
 void VulkanRenderBackend::endFrame()
@@ -167,7 +178,7 @@ void VulkanRenderBackend::endFrame()
     VkPresentInfoKHR presentInfo{
         .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
         .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &renderFinishedSemaphores[ semaphoreIndex ],
+        .pWaitSemaphores = &renderFinishedSemaphores[ imageIndex ],
         .swapchainCount = 1,
         .pSwapchains = &swapChain,
         .pImageIndices = &imageIndex,
@@ -175,64 +186,66 @@ void VulkanRenderBackend::endFrame()
 
     vkQueuePresentKHR(graphicsQueue, &presentInfo);
 
-    semaphoreIndex = (semaphoreIndex + 1) % 3;
+    frameIndex = ( frameIndex + 1 ) % RenderSettings::maxFramesInFlight;
 }
 
 void VulkanRenderBackend::beginRaytracingPipeline( IRenderPipeline* inPipeline )
 {
     VulkanPipeline* pipeline = static_cast< VulkanPipeline* >( inPipeline );
     
-    // Update uniform buffer (including frame count)
-    updateCameraBuffer();
+    // Constants of this frame (including frame count) go to the slice of the current frame in flight
+    writeFrameConstants( frameIndex );
+    const std::vector<uint32> frameConstantOffsets( pipeline->dynamicBufferCount, static_cast< uint32 >( frameIndex * frameConstantSliceSize ) );
 
     VkCommandBufferBeginInfo info{
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
-    vkBeginCommandBuffer( commandBuffers[ imageIndex ], &info );
+    vkBeginCommandBuffer( commandBuffers[ frameIndex ], &info );
 
-    vkCmdBindPipeline( commandBuffers[ imageIndex ], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline->pipeline );
+    vkCmdBindPipeline( commandBuffers[ frameIndex ], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR, pipeline->pipeline );
     vkCmdBindDescriptorSets(
-        commandBuffers[ imageIndex ], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
-        pipeline->pipelineLayout, 0, 1, &pipeline->descriptorSet, 0, 0 );
+        commandBuffers[ frameIndex ], VK_PIPELINE_BIND_POINT_RAY_TRACING_KHR,
+        pipeline->pipelineLayout, 0, 1, &pipeline->descriptorSet,
+        ( uint32 )frameConstantOffsets.size(), frameConstantOffsets.data() );
 
     vkCmdTraceRaysKHR(
-        commandBuffers[ imageIndex ],
-        &rgenSbt,
-        &missSbt,
-        &hitgSbt,
-        &callSbt,
+        commandBuffers[ frameIndex ],
+        &pipeline->rgenSbt,
+        &pipeline->missSbt,
+        &pipeline->hitgSbt,
+        &pipeline->callSbt,
         RenderSettings::screenWidth, RenderSettings::screenHeight, 1 );
 
     setImageLayout(
-        commandBuffers[ imageIndex ],
+        commandBuffers[ frameIndex ],
         outImage,
         VK_IMAGE_LAYOUT_GENERAL,
         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
         subresourceRange );
 
     setImageLayout(
-        commandBuffers[ imageIndex ],
+        commandBuffers[ frameIndex ],
         swapChainImages[ imageIndex ],
         VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         subresourceRange );
 
     vkCmdCopyImage(
-        commandBuffers[ imageIndex ],
+        commandBuffers[ frameIndex ],
         outImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
         swapChainImages[ imageIndex ], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         1, &copyRegion );
 
     setImageLayout(
-        commandBuffers[ imageIndex ],
+        commandBuffers[ frameIndex ],
         outImage,
         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
         VK_IMAGE_LAYOUT_GENERAL,
         subresourceRange );
 
     setImageLayout(
-        commandBuffers[ imageIndex ],
+        commandBuffers[ frameIndex ],
         swapChainImages[ imageIndex ],
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
@@ -243,25 +256,26 @@ void VulkanRenderBackend::beginRaytracingPipeline( IRenderPipeline* inPipeline )
     {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
         .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &imageAvailableSemaphores[ semaphoreIndex ],
+        .pWaitSemaphores = &imageAvailableSemaphores[ frameIndex ],
         .pWaitDstStageMask = &wait_stage,
         .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffers[ imageIndex ],
+        .pCommandBuffers = &commandBuffers[ frameIndex ],
         .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &rtFinishedSemaphores[ semaphoreIndex ],
+        .pSignalSemaphores = &rtFinishedSemaphores[ frameIndex ],
     };
     //VkSubmitInfo submitInfo{
     //    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
     //    .commandBufferCount = 1,
-    //    .pCommandBuffers = &commandBuffers[imageIndex],
+    //    .pCommandBuffers = &commandBuffers[frameIndex],
     //};
 
-    VkResult endCmdResult = vkEndCommandBuffer( commandBuffers[ imageIndex ] );
+    VkResult endCmdResult = vkEndCommandBuffer( commandBuffers[ frameIndex ] );
     if (endCmdResult != VK_SUCCESS) {
         printf("ERROR: vkEndCommandBuffer failed with error: %s\n", getVkResultString(endCmdResult));
     }
 
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, fences[imageIndex]);
+    // The imgui pass is the last submit of the frame and signals its fence
+    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
 
     //VkResult submitResult = vkQueueSubmit( graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
     //if (submitResult != VK_SUCCESS) {
@@ -282,7 +296,6 @@ void VulkanRenderBackend::rebuildAccelerationStructure()
     createOutImage();
     createAccumulationImage();
     createUniformBuffer();
-    createLightBuffer();
     createEnvironmentMap(RenderSettings::envMapPath);
 }
 
@@ -294,10 +307,13 @@ void VulkanRenderBackend::loadDeviceExtensionFunctions( VkDevice device )
     vkDestroyAccelerationStructureKHR = ( PFN_vkDestroyAccelerationStructureKHR )( vkGetDeviceProcAddr( device, "vkDestroyAccelerationStructureKHR" ) );
     vkGetAccelerationStructureBuildSizesKHR = ( PFN_vkGetAccelerationStructureBuildSizesKHR )( vkGetDeviceProcAddr( device, "vkGetAccelerationStructureBuildSizesKHR" ) );
     vkCmdBuildAccelerationStructuresKHR = ( PFN_vkCmdBuildAccelerationStructuresKHR )( vkGetDeviceProcAddr( device, "vkCmdBuildAccelerationStructuresKHR" ) );
+    vkCmdWriteAccelerationStructuresPropertiesKHR = ( PFN_vkCmdWriteAccelerationStructuresPropertiesKHR )( vkGetDeviceProcAddr( device, "vkCmdWriteAccelerationStructuresPropertiesKHR" ) );
+    vkCmdCopyAccelerationStructureKHR = ( PFN_vkCmdCopyAccelerationStructureKHR )( vkGetDeviceProcAddr( device, "vkCmdCopyAccelerationStructureKHR" ) );
     vkCreateRayTracingPipelinesKHR = ( PFN_vkCreateRayTracingPipelinesKHR )( vkGetDeviceProcAddr( device, "vkCreateRayTracingPipelinesKHR" ) );
     vkGetRayTracingShaderGroupHandlesKHR = ( PFN_vkGetRayTracingShaderGroupHandlesKHR )( vkGetDeviceProcAddr( device, "vkGetRayTracingShaderGroupHandlesKHR" ) );
     vkCmdTraceRaysKHR = ( PFN_vkCmdTraceRaysKHR )( vkGetDeviceProcAddr( device, "vkCmdTraceRaysKHR" ) );
 
+    rtProperties.pNext = &asProperties;
     VkPhysicalDeviceProperties2 deviceProperties2{
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
         .pNext = &rtProperties,
@@ -656,6 +672,8 @@ void VulkanRenderBackend::createVkQueueFamily()
 
     // @TODO: Isolate function
     loadDeviceExtensionFunctions(device);
+
+    memoryAllocator.initialize(physicalDevice, device);
 }
 
 void VulkanRenderBackend::createVkDescriptorPools()
@@ -900,14 +918,15 @@ void VulkanRenderBackend::createCommandCenter()
         .flags = VK_FENCE_CREATE_SIGNALED_BIT,
     };
 
-    commandPools.resize( swapChainImages.size() );
-    commandBuffers.resize( swapChainImages.size() );
-    imageAvailableSemaphores.resize( swapChainImages.size() );
-    rtFinishedSemaphores.resize( swapChainImages.size() );
-    renderFinishedSemaphores.resize( swapChainImages.size() );
-    fences.resize( swapChainImages.size() );
+    const uint32 frameCount = RenderSettings::maxFramesInFlight;
+    commandPools.resize( frameCount );
+    commandBuffers.resize( frameCount );
+    imguiCommandBuffers.resize( frameCount );
+    imageAvailableSemaphores.resize( frameCount );
+    rtFinishedSemaphores.resize( frameCount );
+    fences.resize( frameCount );
 
-    for( uint32 i = 0; i < swapChainImages.size(); ++i )
+    for( uint32 i = 0; i < frameCount; ++i )
     {
         if( vkCreateCommandPool( device, &poolInfo, nullptr, &commandPools[ i ] ) != VK_SUCCESS )
         {
@@ -915,388 +934,385 @@ void VulkanRenderBackend::createCommandCenter()
         }
 
         allocInfo.commandPool = commandPools[ i ];
-        if( vkAllocateCommandBuffers( device, &allocInfo, &commandBuffers[ i ] ) != VK_SUCCESS )
+        if( vkAllocateCommandBuffers( device, &allocInfo, &commandBuffers[ i ] ) != VK_SUCCESS ||
+            vkAllocateCommandBuffers( device, &allocInfo, &imguiCommandBuffers[ i ] ) != VK_SUCCESS )
         {
             throw std::runtime_error( "failed to allocate command buffers!" );
         }
 
         if( vkCreateSemaphore( device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[ i ]) != VK_SUCCESS ||
             vkCreateSemaphore( device, &semaphoreInfo, nullptr, &rtFinishedSemaphores[ i ]) != VK_SUCCESS ||
-            vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
             vkCreateFence( device, &fenceInfo, nullptr, &fences[ i ] ) != VK_SUCCESS )
         {
             throw std::runtime_error( "failed to create synchronization objects for a frame!" );
         }
     }
+
+    renderFinishedSemaphores.resize( swapChainImages.size() );
+    for( uint32 i = 0; i < swapChainImages.size(); ++i )
+    {
+        if( vkCreateSemaphore( device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[ i ] ) != VK_SUCCESS )
+        {
+            throw std::runtime_error( "failed to create synchronization objects for a frame!" );
+        }
+    }
 }
 
-void A3::VulkanRenderBackend::createEnvironmentMap(std::string_view hdrTexturePath)
+// Loads the driver pipeline cache written by the last run. The blob is only handed to the driver when its header
+// matches this device, anything else ( other GPU, driver update, truncated file ) starts from an empty cache.
+void VulkanRenderBackend::createPipelineCache()
 {
-    int width, height, channels;
-    if (hdrTexturePath.empty())
-        hdrTexturePath = RenderSettings::envMapDefault;
-    float* pixels = stbi_loadf(hdrTexturePath.data(), &width, &height, &channels, 0);
-    assert(pixels && channels == 3);
-
-    VkDeviceSize imageSize = width * height * 4 * sizeof(float);
-    std::vector<float> rgbaPixels(width * height * 4);
-    for (int i = 0; i < width * height; ++i) {
-        rgbaPixels[i * 4 + 0] = pixels[i * 3 + 0];
-        rgbaPixels[i * 4 + 1] = pixels[i * 3 + 1];
-        rgbaPixels[i * 4 + 2] = pixels[i * 3 + 2];
-        rgbaPixels[i * 4 + 3] = 1.0f;
+    std::vector<char> cacheData;
+    {
+        std::ifstream file( RenderSettings::pipelineCachePath, std::ios::binary | std::ios::ate );
+        if( file.is_open() )
+        {
+            cacheData.resize( ( size_t )file.tellg() );
+            file.seekg( 0, std::ios::beg );
+            if( !file.read( cacheData.data(), cacheData.size() ) )
+                cacheData.clear();
+        }
     }
 
-    vkQueueWaitIdle(graphicsQueue);
-
-    std::tie( envImage, envImageMem ) = createImage(
-        { (uint32_t)width, (uint32_t)height },
-        VK_FORMAT_R32G32B32A32_SFLOAT,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-
-    auto [stagingBuffer, stagingMem] = createBuffer(
-        imageSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    if( !cacheData.empty() )
+    {
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties( physicalDevice, &deviceProperties );
 
-    void* data;
-    vkMapMemory(device, stagingMem, 0, imageSize, 0, &data);
-    memcpy(data, rgbaPixels.data(), static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingMem);
+        VkPipelineCacheHeaderVersionOne header = {};
+        if( cacheData.size() >= sizeof( header ) )
+            memcpy( &header, cacheData.data(), sizeof( header ) );
 
-    VkCommandBuffer& cmd = commandBuffers[imageIndex];
-    vkResetCommandBuffer(cmd, 0);
+        const bool bValid = header.headerSize >= sizeof( header )
+            && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+            && header.vendorID == deviceProperties.vendorID
+            && header.deviceID == deviceProperties.deviceID
+            && memcmp( header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE ) == 0;
 
-    VkCommandBufferBeginInfo beginInfo{ .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    vkBeginCommandBuffer(cmd, &beginInfo);
+        if( !bValid )
+            cacheData.clear();
+    }
 
-    VkImageSubresourceRange subresourceRange = {
-        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .baseMipLevel = 0,
-        .levelCount = 1,
-        .baseArrayLayer = 0,
-        .layerCount = 1,
+    VkPipelineCacheCreateInfo cacheInfo{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = cacheData.size(),
+        .pInitialData = cacheData.empty() ? nullptr : cacheData.data(),
     };
 
-    setImageLayout(cmd, envImage, VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    if( vkCreatePipelineCache( device, &cacheInfo, nullptr, &pipelineCache ) != VK_SUCCESS )
+    {
+        // A blob the driver rejects despite the header check is not fatal, start empty
+        cacheInfo.initialDataSize = 0;
+        cacheInfo.pInitialData = nullptr;
+        if( vkCreatePipelineCache( device, &cacheInfo, nullptr, &pipelineCache ) != VK_SUCCESS )
+        {
+            throw std::runtime_error( "failed to create pipeline cache!" );
+        }
+    }
+}
 
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.imageSubresource = {
-        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .mipLevel = 0,
-        .baseArrayLayer = 0,
-        .layerCount = 1,
-    };
-    region.imageExtent = { (uint32_t)width, (uint32_t)height, 1 };
+void VulkanRenderBackend::savePipelineCache()
+{
+    size_t cacheSize = 0;
+    if( vkGetPipelineCacheData( device, pipelineCache, &cacheSize, nullptr ) != VK_SUCCESS || cacheSize == 0 )
+        return;
 
-    vkCmdCopyBufferToImage(cmd, stagingBuffer, envImage,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    std::vector<char> cacheData( cacheSize );
+    if( vkGetPipelineCacheData( device, pipelineCache, &cacheSize, cacheData.data() ) != VK_SUCCESS )
+        return;
 
-    setImageLayout(cmd, envImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange,
-        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    // Written next to the final file and renamed, so an interrupted save never leaves a truncated cache behind
+    const std::filesystem::path cachePath = RenderSettings::pipelineCachePath;
+    std::filesystem::path tempPath = cachePath;
+    tempPath += ".tmp";
 
-    vkEndCommandBuffer(cmd);
+    std::error_code error;
+    std::filesystem::create_directories( cachePath.parent_path(), error );
+    {
+        std::ofstream file( tempPath, std::ios::binary | std::ios::trunc );
+        if( !file.is_open() || !file.write( cacheData.data(), cacheSize ) )
+            return;
+    }
+    std::filesystem::rename( tempPath, cachePath, error );
+}
 
-    VkSubmitInfo submitInfo{ .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO };
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &cmd;
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphicsQueue);
+namespace
+{
+//=========================
+//   .a3env cache
+//=========================
+// Header followed by the GPU ready texels and the alias table, each aligned to ENV_CACHE_ALIGNMENT so both can be
+// copied straight from the mapped file into the staging buffer. Only valid for the exact source file and texel format it was written with.
+constexpr char ENV_CACHE_MAGIC[ 4 ] = { 'A', '3', 'E', 'V' };
+constexpr uint32 ENV_CACHE_VERSION = 1;
+constexpr uint64 ENV_CACHE_ALIGNMENT = 64;
+
+struct EnvCacheKey
+{
+    uint64 sourceSize;
+    int64 sourceWriteTime;
+    uint64 sourcePathHash;
+};
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingMem, nullptr);
+struct EnvCacheHeader
+{
+    char magic[ 4 ];
+    uint32 version;
+    EnvCacheKey key;
+    uint32 width;
+    uint32 height;
+    uint32 texelFormat;     // VkFormat of the texel blob
+    uint64 texelsOffset;
+    uint64 texelsSize;
+    uint64 aliasTableOffset;
+    uint64 aliasTableSize;
+};
 
-    VkImageViewCreateInfo viewInfo{
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image = envImage,
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
-        .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-        .subresourceRange = subresourceRange,
-    };
-    vkCreateImageView(device, &viewInfo, nullptr, &envImageView );
+bool makeEnvCacheKey( const std::string& filePath, EnvCacheKey& outKey )
+{
+    std::error_code error;
+    const std::filesystem::path path = std::filesystem::absolute( filePath, error ).lexically_normal();
+    const uint64 fileSize = std::filesystem::file_size( path, error );
+    if( error )
+        return false;
+
+    const auto writeTime = std::filesystem::last_write_time( path, error );
+    if( error )
+        return false;
+
+    outKey = {};
+    outKey.sourceSize = fileSize;
+    outKey.sourceWriteTime = static_cast< int64 >( writeTime.time_since_epoch().count() );
+    outKey.sourcePathHash = Utility::hashString( path.generic_string() );
+    return true;
+}
 
-    VkSamplerCreateInfo samplerInfo{
-        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-        .magFilter = VK_FILTER_LINEAR,
-        .minFilter = VK_FILTER_LINEAR,
-        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-        .maxLod = FLT_MAX,
-    };
-    vkCreateSampler( device, &samplerInfo, nullptr, &envSampler );
+uint64 getEnvTexelsSize( VkFormat texelFormat, uint32 width, uint32 height )
+{
+    switch( texelFormat )
+    {
+        case VK_FORMAT_R16G16B16A16_SFLOAT: return uint64( width ) * height * 4 * sizeof( uint16 );
+        case VK_FORMAT_BC6H_UFLOAT_BLOCK:   return uint64( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * 16;
+        default:                            return uint64( width ) * height * 4 * sizeof( float );
+    }
+}
 
-    createEnvironmentMapImportanceSampling(pixels, width, height);
-    stbi_image_free(pixels);
+uint64 alignEnvCacheOffset( uint64 offset )
+{
+    return ( offset + ENV_CACHE_ALIGNMENT - 1 ) & ~( ENV_CACHE_ALIGNMENT - 1 );
 }
 
-void VulkanRenderBackend::createEnvironmentMapImportanceSampling(float* pixels, int width, int height)
+bool loadEnvCache( MappedFile& file, const std::string& cachePath, const EnvCacheKey& key, VkFormat texelFormat, EnvCacheHeader& outHeader )
 {
-    if (pixels == nullptr) return;
+    if( !file.open( cachePath ) || file.getSize() < sizeof( EnvCacheHeader ) )
+        return false;
 
-    struct EnvImportanceSampleData
-    {
-        Vec3 dir;
-        float pdf;
-    };
+    std::memcpy( &outHeader, file.getData(), sizeof( outHeader ) );
+    const uint64 texelCount = uint64( outHeader.width ) * outHeader.height;
+    auto isValidBlob = [ &file ]( uint64 offset, uint64 size )
+        {
+            return offset % ENV_CACHE_ALIGNMENT == 0 && offset <= file.getSize() && size <= file.getSize() - offset;
+        };
 
-    const uint32 texelCount = width * height;
-    std::vector<EnvImportanceSampleData> EnvData(texelCount);
-
-    std::vector<float> luminances(texelCount);
-    std::vector<float> sinTheta(height);
-    std::vector<float> marginalPdf(height);
-    std::vector<float> marginalCdf(height);
-    std::vector<float> conditionalCdf( texelCount );
-    std::vector<float> totalPdf( texelCount );
-
-    float luminanceSum = 0.0f;
-
-    // 1. Luminance × sin(theta) 계산 (soften: gamma 적용)
-    const float gamma = 0.9f;
-    for (int y = 0; y < height; ++y) {
-        float theta = 3.14159265f * (y + 0.5f) / float(height);
-        sinTheta[y] = std::sin(theta);
-        for (int x = 0; x < width; ++x) {
-            int i = y * width + x;
-            float r = pixels[i * 3 + 0];
-            float g = pixels[i * 3 + 1];
-            float b = pixels[i * 3 + 2];
-            float lum = std::pow(0.2126f * r + 0.7152f * g + 0.0722f * b, gamma);
-            luminances[i] = lum * sinTheta[y];
-            luminanceSum += luminances[i];
-        }
-    }
+    return std::memcmp( outHeader.magic, ENV_CACHE_MAGIC, sizeof( ENV_CACHE_MAGIC ) ) == 0
+        && outHeader.version == ENV_CACHE_VERSION
+        && outHeader.key.sourceSize == key.sourceSize
+        && outHeader.key.sourceWriteTime == key.sourceWriteTime
+        && outHeader.key.sourcePathHash == key.sourcePathHash
+        && outHeader.texelFormat == texelFormat
+        && texelCount > 0
+        && outHeader.texelsSize == getEnvTexelsSize( texelFormat, outHeader.width, outHeader.height )
+        && outHeader.aliasTableSize == texelCount * sizeof( Utility::EnvAliasEntry )
+        && isValidBlob( outHeader.texelsOffset, outHeader.texelsSize )
+        && isValidBlob( outHeader.aliasTableOffset, outHeader.aliasTableSize );
+}
 
-    if (luminanceSum <= 0.0f) luminanceSum = 1e-6f; // TODO: throw an exception instead
+void saveEnvCache( const std::string& cachePath, const EnvCacheKey& key, uint32 width, uint32 height,
+    VkFormat texelFormat, const std::vector<uint8>& texels, const std::vector<Utility::EnvAliasEntry>& aliasTable )
+{
+    EnvCacheHeader header = {};
+    std::memcpy( header.magic, ENV_CACHE_MAGIC, sizeof( ENV_CACHE_MAGIC ) );
+    header.version = ENV_CACHE_VERSION;
+    header.key = key;
+    header.width = width;
+    header.height = height;
+    header.texelFormat = texelFormat;
+    header.texelsSize = texels.size();
+    header.aliasTableSize = aliasTable.size() * sizeof( Utility::EnvAliasEntry );
+    header.texelsOffset = alignEnvCacheOffset( sizeof( EnvCacheHeader ) );
+    header.aliasTableOffset = alignEnvCacheOffset( header.texelsOffset + header.texelsSize );
+
+    // Written to a temporary file first, so an interrupted write never leaves a truncated cache behind
+    const std::string tempPath = cachePath + ".tmp";
+    {
+        std::ofstream file( tempPath, std::ios::binary | std::ios::trunc );
+        if( !file.is_open() )
+            return;
+
+        const char padding[ ENV_CACHE_ALIGNMENT ] = {};
+        auto writeBlob = [ & ]( uint64 offset, const void* blob, uint64 byteSize )
+            {
+                file.write( padding, static_cast< std::streamsize >( offset - static_cast< uint64 >( file.tellp() ) ) );
+                file.write( static_cast< const char* >( blob ), static_cast< std::streamsize >( byteSize ) );
+            };
 
-    // 2. Marginal PDF & CDF (y 방향)
-    float marginalAccum = 0.0f;
-    for (int y = 0; y < height; ++y) {
-        float rowSum = 0.0f;
-        for (int x = 0; x < width; ++x) {
-            rowSum += luminances[y * width + x];
-        }
-        float pdf = rowSum / luminanceSum;
-        //pdf = std::max(pdf, 1e-6f); // clamp 최소값
-        marginalPdf[y] = pdf;
-        marginalAccum += pdf;
-        marginalCdf[y] = marginalAccum;
+        file.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+        writeBlob( header.texelsOffset, texels.data(), header.texelsSize );
+        writeBlob( header.aliasTableOffset, aliasTable.data(), header.aliasTableSize );
+        if( !file.good() )
+            return;
     }
 
-    // normalize CDF
-    for (int y = 0; y < height; ++y) {
-        marginalCdf[y] /= marginalAccum;
+    std::error_code error;
+    std::filesystem::rename( tempPath, cachePath, error );
+    if( error )
+    {
+        std::cout << "Failed to write environment map cache " << cachePath << ": " << error.message() << "\n";
+        std::filesystem::remove( tempPath, error );
     }
-    marginalCdf[height - 1] = 1.0f; // 강제 클램프
-
-    // 3. Conditional PDF & CDF (x 방향 per row)
-    for (int y = 0; y < height; ++y) {
-        float rowSum = 0.0f;
-        for (int x = 0; x < width; ++x) {
-            rowSum += luminances[y * width + x];
-        }
-
-        rowSum = std::max(rowSum, 1e-6f);
-        float accum = 0.0f;
+}
+}
 
-        // CDF 작성
-        for (int x = 0; x < width; ++x) {
-            int i = y * width + x;
-            float conditionalPdf = luminances[i] / rowSum;
-            //conditionalPdf = std::max( conditionalPdf, 1e-6f); // clamp
-            accum += conditionalPdf;
+// The decoded texels and the alias table are cached next to the HDR as .a3env. A valid cache is mapped and copied
+// straight into the staging buffer, so neither stbi_loadf nor the table build runs again for the same file.
+void A3::VulkanRenderBackend::createEnvironmentMap(std::string_view hdrTexturePath)
+{
+    if (hdrTexturePath.empty())
+        hdrTexturePath = RenderSettings::envMapDefault;
 
-            conditionalCdf[ i ] = accum;
-            totalPdf[ i ] = conditionalPdf * marginalPdf[ y ];
+    const std::string sourcePath( hdrTexturePath );
+    const std::string cachePath = sourcePath + ".a3env";
+    EnvCacheKey cacheKey;
+    const bool bCacheable = makeEnvCacheKey( sourcePath, cacheKey );
+
+    // BC6H is only there with textureCompressionBC, other devices get half floats instead
+    VkFormat texelFormat = RenderSettings::envMapFormat == RenderSettings::EnvMapBC6H ? VK_FORMAT_BC6H_UFLOAT_BLOCK
+        : RenderSettings::envMapFormat == RenderSettings::EnvMapRGBA16F ? VK_FORMAT_R16G16B16A16_SFLOAT : VK_FORMAT_R32G32B32A32_SFLOAT;
+    if (texelFormat == VK_FORMAT_BC6H_UFLOAT_BLOCK) {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, texelFormat, &formatProperties);
+        if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+            std::cout << "BC6H is not supported, the environment map falls back to RGBA16F\n";
+            texelFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
         }
+    }
 
-        // normalize conditional CDF
-        for (int x = 0; x < width; ++x) {
-            int i = y * width + x;
-            conditionalCdf[ i ] /= accum;
-        }
+    uint32 width, height;
+    const void* texelData;
+    const void* aliasTableData;
 
-        // 마지막 CDF 클램프
-        int last = y * width + (width - 1);
-        conditionalCdf[ last ] = 1.0f;
+    MappedFile cacheFile;
+    EnvCacheHeader cacheHeader;
+    std::vector<uint8> texels;
+    std::vector<Utility::EnvAliasEntry> aliasTable;
+    if (bCacheable && loadEnvCache(cacheFile, cachePath, cacheKey, texelFormat, cacheHeader)) {
+        width = cacheHeader.width;
+        height = cacheHeader.height;
+        texelData = cacheFile.getData() + cacheHeader.texelsOffset;
+        aliasTableData = cacheFile.getData() + cacheHeader.aliasTableOffset;
     }
+    else {
+        cacheFile.close();
 
-    constexpr float pi = 3.1415926535897932384626433832795;
+        int sourceWidth, sourceHeight, channels;
+        float* pixels = stbi_loadf(sourcePath.c_str(), &sourceWidth, &sourceHeight, &channels, 0);
+        assert(pixels && channels == 3);
+        width = sourceWidth;
+        height = sourceHeight;
 
-    // ---- Marginal CDF 이진 탐색 (Y 방향) ----
-    for( uint32 indexY = 0; indexY < height; ++indexY )
-    {
-        const float indexYNormalized = (float(indexY) + 0.5) / height;
-        uint32 yLow = 0;
-        uint32 yHigh = height - 1;
-        while( yLow < yHigh )
-        {
-            const uint32 yMid = ( yLow + yHigh ) / 2;
-            const float cdf = marginalCdf[ yMid ];
-            if( cdf < indexYNormalized )
-                yLow = yMid + 1;
-            else
-                yHigh = yMid;
+        if (texelFormat == VK_FORMAT_BC6H_UFLOAT_BLOCK) {
+            Utility::encodeBC6H(texels, pixels, width, height);
         }
-        const uint32 y = yLow;
-
-        // ---- Conditional CDF 이진 탐색 (X 방향) ----
-        for( uint32 indexX = 0; indexX < width; ++indexX )
-        {
-            const uint32 indexXY = indexX + indexY * width;
-            const float indexXNormalized = (float(indexX) + 0.5) / width;
-            uint32 xLow = 0;
-            uint32 xHigh = width - 1;
-            while( xLow < xHigh )
-            {
-                const uint32 xMid = ( xLow + xHigh ) / 2;
-                const float cdf = conditionalCdf[ y * width + xMid ];
-                if( cdf < indexXNormalized )
-                    xLow = xMid + 1;
-                else
-                    xHigh = xMid;
+        else if (texelFormat == VK_FORMAT_R16G16B16A16_SFLOAT) {
+            Utility::encodeRGBA16F(texels, pixels, width, height);
+        }
+        else {
+            texels.resize(getEnvTexelsSize(texelFormat, width, height));
+            float* rgbaPixels = reinterpret_cast<float*>(texels.data());
+            for (uint32 i = 0; i < width * height; ++i) {
+                rgbaPixels[i * 4 + 0] = pixels[i * 3 + 0];
+                rgbaPixels[i * 4 + 1] = pixels[i * 3 + 1];
+                rgbaPixels[i * 4 + 2] = pixels[i * 3 + 2];
+                rgbaPixels[i * 4 + 3] = 1.0f;
             }
-            const uint32 x = xLow;
-
-            // ---- UV to Direction ----
-            const float u = (x + 0.5) / float(width);
-            const float v = (y + 0.5) / float(height);
-            const float phi = 2.0 * pi * u;
-            const float theta = pi * v;
-            const float sinTheta = sin( theta );
-
-            // ---- PDF with solid angle correction ----
-            const float texelPdf = totalPdf[ y * width + x ];
-            EnvData[ indexXY ].pdf = width * height * texelPdf / ( 2.0 * pi * pi * sinTheta );
-
-            EnvData[ indexXY ].dir = Vec3( sinTheta * cos( phi ), cos( theta ), sinTheta * sin( phi ) );
         }
-    }
 
-    // 4. Vulkan Buffer 업로드
-    // Envmap Sampling Image
-    VkDeviceSize imageSize = sizeof( EnvImportanceSampleData ) * EnvData.size();
-
-    std::tie( envImportanceImage, envImportanceMem ) = createImage(
-        { ( uint32 )width, ( uint32 )height },
-        VK_FORMAT_R32G32B32A32_SFLOAT,
-        VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
-
-    auto [stagingBuffer, stagingMem] = createBuffer(
-        imageSize,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+        Utility::buildEnvironmentAliasTable(aliasTable, pixels, width, height);
+        stbi_image_free(pixels);
 
-    void* data;
-    vkMapMemory( device, stagingMem, 0, imageSize, 0, &data );
-    memcpy( data, EnvData.data(), imageSize );
-    vkUnmapMemory( device, stagingMem );
+        if (bCacheable)
+            saveEnvCache(cachePath, cacheKey, width, height, texelFormat, texels, aliasTable);
 
-    VkImageSubresourceRange subresourceRange = {
-        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .baseMipLevel = 0,
-        .levelCount = 1,
-        .baseArrayLayer = 0,
-        .layerCount = 1,
-    };
+        texelData = texels.data();
+        aliasTableData = aliasTable.data();
+    }
 
-    VkImageViewCreateInfo viewInfo{
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image = envImportanceImage,
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
-        .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-        .subresourceRange = subresourceRange,
-    };
-    vkCreateImageView( device, &viewInfo, nullptr, &envImportanceView );
+    const VkDeviceSize imageSize = getEnvTexelsSize(texelFormat, width, height);
+    const VkDeviceSize aliasTableSize = VkDeviceSize(width) * height * sizeof(Utility::EnvAliasEntry);
 
-    // Envmap Hit Image
-    VkDeviceSize imageSizeHit = sizeof(totalPdf[0]) * totalPdf.size();
+    vkQueueWaitIdle(graphicsQueue);
 
-    std::tie(envHitImage, envHitMem) = createImage(
-        { (uint32)width, (uint32)height },
-        VK_FORMAT_R32_SFLOAT,
+    std::tie( envImage, envImageMem ) = createImage(
+        { width, height },
+        texelFormat,
         VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    auto [hitStagingBuffer, hitStagingMem] = createBuffer(
-        imageSizeHit,
+    std::tie( envAliasBuffer, envAliasMem ) = createBuffer(
+        aliasTableSize,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
+
+    // Texels and alias table share one staging buffer and one submit
+    auto [stagingBuffer, stagingMem] = createBuffer(
+        imageSize + aliasTableSize,
         VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    vkMapMemory(device, hitStagingMem, 0, imageSizeHit, 0, &data);
-    memcpy(data, totalPdf.data(), imageSizeHit);
-    vkUnmapMemory(device, hitStagingMem);
+    uint8* data = static_cast< uint8* >( stagingMem.mappedData );
+    memcpy(data, texelData, static_cast<size_t>(imageSize));
+    memcpy(data + imageSize, aliasTableData, static_cast<size_t>(aliasTableSize));
+    cacheFile.close();
 
-    VkImageViewCreateInfo hitViewInfo{
-    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-    .image = envHitImage,
-    .viewType = VK_IMAGE_VIEW_TYPE_2D,
-    .format = VK_FORMAT_R32_SFLOAT,
-    .subresourceRange = subresourceRange,
-    };
-    vkCreateImageView(device, &hitViewInfo, nullptr, &envHitView);
-
-    VkCommandBuffer& cmd = commandBuffers[imageIndex];
+    VkCommandBuffer& cmd = commandBuffers[frameIndex];
     vkResetCommandBuffer(cmd, 0);
 
     VkCommandBufferBeginInfo beginInfo{ .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     vkBeginCommandBuffer(cmd, &beginInfo);
 
-    // Importance(RGBA32F) 업로드 -------------------------------------------------
-    setImageLayout(cmd, envImportanceImage, VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange,
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
-
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.imageSubresource = {
+    VkImageSubresourceRange subresourceRange = {
         .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-        .mipLevel = 0,
+        .baseMipLevel = 0,
+        .levelCount = 1,
         .baseArrayLayer = 0,
         .layerCount = 1,
     };
-    region.imageExtent = { (uint32_t)width, (uint32_t)height, 1 };
-
-    vkCmdCopyBufferToImage(cmd, stagingBuffer, envImportanceImage,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
-    // HitPdf(R32F) 업로드 --------------------------------------------------------
-    setImageLayout(cmd, envHitImage, VK_IMAGE_LAYOUT_UNDEFINED,
+    setImageLayout(cmd, envImage, VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange,
         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-    VkBufferImageCopy hitRegion{};
-    hitRegion.bufferOffset = 0;
-    hitRegion.imageSubresource = {
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    region.imageSubresource = {
         .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
         .mipLevel = 0,
         .baseArrayLayer = 0,
         .layerCount = 1,
     };
-    hitRegion.imageExtent = { (uint32_t)width, (uint32_t)height, 1 };
+    region.imageExtent = { width, height, 1 };
 
-    vkCmdCopyBufferToImage(cmd, hitStagingBuffer, envHitImage,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &hitRegion);
+    vkCmdCopyBufferToImage(cmd, stagingBuffer, envImage,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
 
-    // Shader-read 전환 ----------------------------------------------------------
-    setImageLayout(cmd, envImportanceImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange,
-        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
-    setImageLayout(cmd, envHitImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    setImageLayout(cmd, envImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
         VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, subresourceRange,
         VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
 
-    // 커맨드버퍼 종료 & Submit ----------------------------------------------------
+    VkBufferCopy aliasTableRegion{ .srcOffset = imageSize, .size = aliasTableSize };
+    vkCmdCopyBuffer( cmd, stagingBuffer, envAliasBuffer, 1, &aliasTableRegion );
+
     vkEndCommandBuffer(cmd);
 
     VkSubmitInfo submitInfo{ .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO };
@@ -1306,9 +1322,28 @@ void VulkanRenderBackend::createEnvironmentMapImportanceSampling(float* pixels,
     vkQueueWaitIdle(graphicsQueue);
 
     vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingMem, nullptr);
-    vkDestroyBuffer(device, hitStagingBuffer, nullptr);
-    vkFreeMemory(device, hitStagingMem, nullptr);
+    memoryAllocator.free( stagingMem );
+
+    VkImageViewCreateInfo viewInfo{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = envImage,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = texelFormat,
+        .subresourceRange = subresourceRange,
+    };
+    vkCreateImageView(device, &viewInfo, nullptr, &envImageView );
+
+    VkSamplerCreateInfo samplerInfo{
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .maxLod = FLT_MAX,
+    };
+    vkCreateSampler( device, &samplerInfo, nullptr, &envSampler );
 }
 
 uint32 VulkanRenderBackend::findMemoryType( uint32_t memoryTypeBits, VkMemoryPropertyFlags reqMemProps )
@@ -1330,13 +1365,12 @@ uint32 VulkanRenderBackend::findMemoryType( uint32_t memoryTypeBits, VkMemoryPro
     return memTypeIndex;
 }
 
-std::tuple<VkBuffer, VkDeviceMemory> VulkanRenderBackend::createBuffer(
+std::tuple<VkBuffer, DeviceAllocation> VulkanRenderBackend::createBuffer(
     VkDeviceSize size,
     VkBufferUsageFlags usage,
     VkMemoryPropertyFlags reqMemProps )
 {
     VkBuffer buffer;
-    VkDeviceMemory bufferMemory;
 
     VkBufferCreateInfo bufferInfo{
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -1351,39 +1385,27 @@ std::tuple<VkBuffer, VkDeviceMemory> VulkanRenderBackend::createBuffer(
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements( device, buffer, &memRequirements );
 
-    VkMemoryAllocateInfo allocInfo{
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memRequirements.size,
-        .memoryTypeIndex = findMemoryType( memRequirements.memoryTypeBits, reqMemProps ),
-    };
-
-    if( usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT )
-    {
-        static VkMemoryAllocateFlagsInfo flagsInfo{
-            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
-            .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR,
-        };
-        allocInfo.pNext = &flagsInfo;
-    }
+    // Buffers share blocks now, scratch buffers and shader binding tables need stronger device address alignment than they report
+    memRequirements.alignment = std::max<VkDeviceSize>( { memRequirements.alignment, 256, rtProperties.shaderGroupBaseAlignment } );
 
-    if( vkAllocateMemory( device, &allocInfo, nullptr, &bufferMemory ) != VK_SUCCESS )
-    {
-        throw std::runtime_error( "failed to allocate vertex buffer memory!" );
-    }
+    // Buffer pools are allocated with VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, so device addresses work for any of them
+    const DeviceAllocation bufferMemory = memoryAllocator.allocate(
+        memRequirements,
+        findMemoryType( memRequirements.memoryTypeBits, reqMemProps ),
+        true );
 
-    vkBindBufferMemory( device, buffer, bufferMemory, 0 );
+    vkBindBufferMemory( device, buffer, bufferMemory.memory, bufferMemory.offset );
 
     return { buffer, bufferMemory };
 }
 
-std::tuple<VkImage, VkDeviceMemory> VulkanRenderBackend::createImage(
+std::tuple<VkImage, DeviceAllocation> VulkanRenderBackend::createImage(
     VkExtent2D extent,
     VkFormat format,
     VkImageUsageFlags usage,
     VkMemoryPropertyFlags reqMemProps )
 {
     VkImage image;
-    VkDeviceMemory imageMemory;
 
     VkImageCreateInfo imageInfo{
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
@@ -1405,18 +1427,12 @@ std::tuple<VkImage, VkDeviceMemory> VulkanRenderBackend::createImage(
     VkMemoryRequirements memRequirements;
     vkGetImageMemoryRequirements( device, image, &memRequirements );
 
-    VkMemoryAllocateInfo allocInfo{
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = memRequirements.size,
-        .memoryTypeIndex = findMemoryType( memRequirements.memoryTypeBits, reqMemProps ),
-    };
+    const DeviceAllocation imageMemory = memoryAllocator.allocate(
+        memRequirements,
+        findMemoryType( memRequirements.memoryTypeBits, reqMemProps ),
+        false );
 
-    if( vkAllocateMemory( device, &allocInfo, nullptr, &imageMemory ) != VK_SUCCESS )
-    {
-        throw std::runtime_error( "failed to allocate image memory!" );
-    }
-
-    vkBindImageMemory( device, image, imageMemory, 0 );
+    vkBindImageMemory( device, image, imageMemory.memory, imageMemory.offset );
 
     return { image, imageMemory };
 }
@@ -1481,175 +1497,367 @@ inline VkDeviceAddress VulkanRenderBackend::getDeviceAddressOf( VkAccelerationSt
     return vkGetAccelerationStructureDeviceAddressKHR( device, &info );
 }
 
-// @TODO: Support more than 1 geometry
 IAccelerationStructureRef VulkanRenderBackend::createBLAS( const BLASBuildParams params )
 {
-    VulkanAccelerationStructure* outBlas = new VulkanAccelerationStructure();
-    VkDeviceMemory vertexPositionBufferMem;
-    VkDeviceMemory vertexAttributeBufferMem;
-    VkDeviceMemory indexBufferMem;
-    VkDeviceMemory cumulativeTriangleAreaMem;
-
-    auto& positionData = params.positionData;
-    auto& attributeData = params.attributeData;
-    auto& indexData = params.indexData;
-    auto& cumulativeTriangleAreaData = params.cumulativeTriangleAreaData;
-    auto& transformData = params.transformData;
-
-    std::tie(outBlas->vertexPositionBuffer, vertexPositionBufferMem ) = createBuffer(
-        positionData.size() * sizeof( VertexPosition ),
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | 
-        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | 
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | 
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
-
-    std::tie(outBlas->vertexAttributeBuffer, vertexAttributeBufferMem ) = createBuffer(
-        attributeData.size() * sizeof( VertexAttributes ),
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+    std::vector<IAccelerationStructureRef> blases = createBLASes( { params } );
+    return std::move( blases[ 0 ] );
+}
 
-    std::tie(outBlas->indexBuffer, indexBufferMem ) = createBuffer(
-        indexData.size() * sizeof( uint32 ),
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+// Per mesh build state, kept alive until the batched build has finished on the GPU
+struct PendingBLASBuild
+{
+    VkAccelerationStructureGeometryKHR geometry;
+    VkAccelerationStructureBuildGeometryInfoKHR buildInfo;
+    VkAccelerationStructureBuildRangeInfoKHR rangeInfo;
+    VkDeviceSize scratchOffset;
+};
 
-    std::tie(outBlas->cumulativeTriangleAreaBuffer, cumulativeTriangleAreaMem) = createBuffer(
-        cumulativeTriangleAreaData.size() * sizeof(float),
-        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
-        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+// @TODO: Support more than 1 geometry
+std::vector<IAccelerationStructureRef> VulkanRenderBackend::createBLASes( const std::vector<BLASBuildParams>& paramsList )
+{
+    std::vector<IAccelerationStructureRef> outBlases( paramsList.size() );
+    if( paramsList.empty() )
+        return outBlases;
 
+    // One transform buffer for the whole batch, addressed with VkAccelerationStructureBuildRangeInfoKHR::transformOffset
     auto [geoTransformBuffer, geoTransformBufferMem] = createBuffer(
-        sizeof( Mat3x4 ),
+        paramsList.size() * sizeof( Mat3x4 ),
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
 
-    void* dst;
-
-    vkMapMemory( device, vertexPositionBufferMem, 0, positionData.size() * sizeof( VertexPosition ), 0, &dst );
-    memcpy( dst, positionData.data(), positionData.size() * sizeof( VertexPosition ));
-    vkUnmapMemory( device, vertexPositionBufferMem );
+    std::vector<PendingBLASBuild> builds( paramsList.size() );
+    for( size_t buildIndex = 0; buildIndex < paramsList.size(); ++buildIndex )
+    {
+        const BLASBuildParams& params = paramsList[ buildIndex ];
+        PendingBLASBuild& build = builds[ buildIndex ];
+
+        VulkanAccelerationStructure* outBlas = new VulkanAccelerationStructure();
+        outBlases[ buildIndex ] = IAccelerationStructureRef( outBlas );
+
+        DeviceAllocation vertexPositionBufferMem;
+        DeviceAllocation vertexAttributeBufferMem;
+        DeviceAllocation indexBufferMem;
+        DeviceAllocation cumulativeTriangleAreaMem;
+
+        auto& positionData = params.positionData;
+        auto& attributeData = params.attributeData;
+        auto& indexData = params.indexData;
+        auto& cumulativeTriangleAreaData = params.cumulativeTriangleAreaData;
+        auto& transformData = params.transformData;
+
+        std::tie(outBlas->vertexPositionBuffer, vertexPositionBufferMem ) = createBuffer(
+            positionData.size() * sizeof( VertexPosition ),
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | 
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | 
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | 
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+
+        std::tie(outBlas->vertexAttributeBuffer, vertexAttributeBufferMem ) = createBuffer(
+            attributeData.size() * sizeof( VertexAttributes ),
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+
+        std::tie(outBlas->indexBuffer, indexBufferMem ) = createBuffer(
+            indexData.size() * sizeof( uint32 ),
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+
+        std::tie(outBlas->cumulativeTriangleAreaBuffer, cumulativeTriangleAreaMem) = createBuffer(
+            cumulativeTriangleAreaData.size() * sizeof(float),
+            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-    vkMapMemory( device, vertexAttributeBufferMem, 0, attributeData.size() * sizeof( VertexAttributes ), 0, &dst );
-    memcpy( dst, attributeData.data(), attributeData.size() * sizeof( VertexAttributes ) );
-    vkUnmapMemory( device, vertexAttributeBufferMem );
+        memcpy( vertexPositionBufferMem.mappedData, positionData.data(), positionData.size() * sizeof( VertexPosition ));
+        memcpy( vertexAttributeBufferMem.mappedData, attributeData.data(), attributeData.size() * sizeof( VertexAttributes ) );
+        memcpy( indexBufferMem.mappedData, indexData.data(), indexData.size() * sizeof( uint32 ) );
+        memcpy(cumulativeTriangleAreaMem.mappedData, cumulativeTriangleAreaData.data(), cumulativeTriangleAreaData.size() * sizeof(float));
+        memcpy( ( Mat3x4* )geoTransformBufferMem.mappedData + buildIndex, &transformData, sizeof( Mat3x4 ) );
+
+        build.geometry = {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+            .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+            .geometry = {
+                .triangles = {
+                    .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+                    .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+                    .vertexData = {.deviceAddress = getDeviceAddressOf(outBlas->vertexPositionBuffer ) },
+                    .vertexStride = sizeof( VertexPosition ),
+                    .maxVertex = ( uint32 )positionData.size() - 1,
+                    .indexType = VK_INDEX_TYPE_UINT32,
+                    .indexData = {.deviceAddress = getDeviceAddressOf(outBlas->indexBuffer ) },
+                    .transformData = {.deviceAddress = getDeviceAddressOf( geoTransformBuffer ) },
+                },
+            },
+            .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+        };
 
-    vkMapMemory( device, indexBufferMem, 0, indexData.size() * sizeof( uint32 ), 0, &dst );
-    memcpy( dst, indexData.data(), indexData.size() * sizeof( uint32 ) );
-    vkUnmapMemory( device, indexBufferMem );
+        build.buildInfo = {
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+            .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR
+                | ( RenderSettings::bCompactBLAS ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR : 0 ),
+            .geometryCount = 1,
+            .pGeometries = &build.geometry,
+        };
 
-    vkMapMemory(device, cumulativeTriangleAreaMem, 0, cumulativeTriangleAreaData.size() * sizeof(float), 0, &dst);
-    memcpy(dst, cumulativeTriangleAreaData.data(), cumulativeTriangleAreaData.size() * sizeof(float));
-    vkUnmapMemory(device, cumulativeTriangleAreaMem);
+        build.rangeInfo = {
+            .primitiveCount = ( uint32 )indexData.size() / 3,
+            .transformOffset = ( uint32 )( buildIndex * sizeof( Mat3x4 ) ),
+        };
 
-    vkMapMemory( device, geoTransformBufferMem, 0, sizeof( Mat3x4 ), 0, &dst );
-    memcpy( dst, &transformData, sizeof( Mat3x4 ) );
-    vkUnmapMemory( device, geoTransformBufferMem );
+        VkAccelerationStructureBuildSizesInfoKHR requiredSize{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
+        vkGetAccelerationStructureBuildSizesKHR(
+            device,
+            VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+            &build.buildInfo,
+            &build.rangeInfo.primitiveCount,
+            &requiredSize );
 
-    VkAccelerationStructureGeometryKHR geometry0{
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
-        .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
-        .geometry = {
-            .triangles = {
-                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
-                .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
-                .vertexData = {.deviceAddress = getDeviceAddressOf(outBlas->vertexPositionBuffer ) },
-                .vertexStride = sizeof( VertexPosition ),
-				.maxVertex = ( uint32 )positionData.size() - 1,
-                .indexType = VK_INDEX_TYPE_UINT32,
-                .indexData = {.deviceAddress = getDeviceAddressOf(outBlas->indexBuffer ) },
-                .transformData = {.deviceAddress = getDeviceAddressOf( geoTransformBuffer ) },
-            },
-        },
-        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
-    };
-    VkAccelerationStructureGeometryKHR geometries[] = { geometry0 };
+        std::tie( outBlas->descriptor, outBlas->memory ) = createBuffer(
+            requiredSize.accelerationStructureSize,
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
 
-    uint32 triangleCount0 = indexData.size() / 3;
-    uint32 triangleCounts[] = { triangleCount0 };
+        // Generate BLAS handle
+        {
+            VkAccelerationStructureCreateInfoKHR asCreateInfo{
+                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+                .buffer = outBlas->descriptor,
+                .size = requiredSize.accelerationStructureSize,
+                .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+            };
+            vkCreateAccelerationStructureKHR( device, &asCreateInfo, nullptr, &outBlas->handle );
+        }
 
-    VkAccelerationStructureBuildGeometryInfoKHR buildBlasInfo{
-        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
-        .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
-        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
-        .geometryCount = 1,
-        .pGeometries = geometries,
-    };
+        build.buildInfo.dstAccelerationStructure = outBlas->handle;
+        // Scratch size rounded up so the next build in the shared scratch buffer starts aligned
+        const VkDeviceSize scratchAlignment = asProperties.minAccelerationStructureScratchOffsetAlignment;
+        build.scratchOffset = ( requiredSize.buildScratchSize + scratchAlignment - 1 ) / scratchAlignment * scratchAlignment;
+    }
 
-    VkAccelerationStructureBuildSizesInfoKHR requiredSize{ VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR };
-    vkGetAccelerationStructureBuildSizesKHR(
-        device,
-        VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
-        &buildBlasInfo,
-        triangleCounts,
-        &requiredSize );
+    // Builds are split into groups whose scratch ranges fit in the budget. Groups reuse the same scratch buffer,
+    // so a barrier separates them, a build larger than the budget forms a group of its own.
+    std::vector<size_t> groupEnds;
+    VkDeviceSize scratchBufferSize = 0;
+    {
+        VkDeviceSize groupScratchSize = 0;
+        for( size_t buildIndex = 0; buildIndex < builds.size(); ++buildIndex )
+        {
+            const VkDeviceSize buildScratchSize = builds[ buildIndex ].scratchOffset;
+            if( groupScratchSize > 0 && groupScratchSize + buildScratchSize > RenderSettings::blasScratchBudget )
+            {
+                groupEnds.push_back( buildIndex );
+                groupScratchSize = 0;
+            }
 
-    std::tie( outBlas->descriptor, outBlas->memory ) = createBuffer(
-        requiredSize.accelerationStructureSize,
-        VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
+            builds[ buildIndex ].scratchOffset = groupScratchSize;
+            groupScratchSize += buildScratchSize;
+            scratchBufferSize = std::max( scratchBufferSize, groupScratchSize );
+        }
+        groupEnds.push_back( builds.size() );
+    }
 
     auto [scratchBuffer, scratchBufferMem] = createBuffer(
-        requiredSize.buildScratchSize,
+        scratchBufferSize,
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
+    const VkDeviceAddress scratchAddress = getDeviceAddressOf( scratchBuffer );
 
-    // Generate BLAS handle
+    std::vector<VkAccelerationStructureBuildGeometryInfoKHR> buildInfos( builds.size() );
+    std::vector<VkAccelerationStructureBuildRangeInfoKHR*> buildRangeInfos( builds.size() );
+    for( size_t buildIndex = 0; buildIndex < builds.size(); ++buildIndex )
     {
-        VkAccelerationStructureCreateInfoKHR asCreateInfo{
-            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
-            .buffer = outBlas->descriptor,
-            .size = requiredSize.accelerationStructureSize,
-            .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        builds[ buildIndex ].buildInfo.scratchData.deviceAddress = scratchAddress + builds[ buildIndex ].scratchOffset;
+        buildInfos[ buildIndex ] = builds[ buildIndex ].buildInfo;
+        buildRangeInfos[ buildIndex ] = &builds[ buildIndex ].rangeInfo;
+    }
+
+    // Compacted sizes are written by the build submission, read back once it has finished
+    VkQueryPool compactedSizeQueryPool = VK_NULL_HANDLE;
+    if( RenderSettings::bCompactBLAS )
+    {
+        VkQueryPoolCreateInfo queryPoolInfo{
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+            .queryCount = ( uint32 )builds.size(),
         };
-        vkCreateAccelerationStructureKHR( device, &asCreateInfo, nullptr, &outBlas->handle );
+        vkCreateQueryPool( device, &queryPoolInfo, nullptr, &compactedSizeQueryPool );
     }
 
-    // Build BLAS using GPU operations
+    // Build all BLASes using GPU operations, one submission and one fence wait for the whole batch
     {
-        vkResetCommandBuffer( commandBuffers[ imageIndex ], 0 );
-        vkBeginCommandBuffer( commandBuffers[ imageIndex ], &beginInfo );
+        vkResetCommandBuffer( commandBuffers[ frameIndex ], 0 );
+        vkBeginCommandBuffer( commandBuffers[ frameIndex ], &beginInfo );
         {
-            buildBlasInfo.dstAccelerationStructure = outBlas->handle;
-            buildBlasInfo.scratchData.deviceAddress = getDeviceAddressOf( scratchBuffer );
-            VkAccelerationStructureBuildRangeInfoKHR buildBlasRangeInfo[] =
+            if( compactedSizeQueryPool != VK_NULL_HANDLE )
+                vkCmdResetQueryPool( commandBuffers[ frameIndex ], compactedSizeQueryPool, 0, ( uint32 )builds.size() );
+
+            size_t groupBegin = 0;
+            for( size_t groupEnd : groupEnds )
             {
+                if( groupBegin > 0 )
                 {
-                    .primitiveCount = triangleCounts[ 0 ],
-                    .transformOffset = 0,
+                    VkMemoryBarrier scratchBarrier{
+                        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                        .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                        .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                    };
+                    vkCmdPipelineBarrier(
+                        commandBuffers[ frameIndex ],
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                        0, 1, &scratchBarrier, 0, nullptr, 0, nullptr );
                 }
-            };
 
-            VkAccelerationStructureBuildGeometryInfoKHR buildBlasInfos[] = { buildBlasInfo };
-            VkAccelerationStructureBuildRangeInfoKHR* buildBlasRangeInfos[] = { buildBlasRangeInfo };
-            vkCmdBuildAccelerationStructuresKHR( commandBuffers[ imageIndex ], 1, buildBlasInfos, buildBlasRangeInfos );
+                vkCmdBuildAccelerationStructuresKHR(
+                    commandBuffers[ frameIndex ],
+                    ( uint32 )( groupEnd - groupBegin ),
+                    buildInfos.data() + groupBegin,
+                    buildRangeInfos.data() + groupBegin );
+                groupBegin = groupEnd;
+            }
+
+            if( compactedSizeQueryPool != VK_NULL_HANDLE )
+            {
+                VkMemoryBarrier buildBarrier{
+                    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                    .srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR,
+                    .dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR,
+                };
+                vkCmdPipelineBarrier(
+                    commandBuffers[ frameIndex ],
+                    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                    0, 1, &buildBarrier, 0, nullptr, 0, nullptr );
+
+                std::vector<VkAccelerationStructureKHR> handles( builds.size() );
+                for( size_t buildIndex = 0; buildIndex < builds.size(); ++buildIndex )
+                    handles[ buildIndex ] = builds[ buildIndex ].buildInfo.dstAccelerationStructure;
+
+                vkCmdWriteAccelerationStructuresPropertiesKHR(
+                    commandBuffers[ frameIndex ],
+                    ( uint32 )handles.size(),
+                    handles.data(),
+                    VK_QUERY_TYPE_ACCELERATION_STRUCTURE_COMPACTED_SIZE_KHR,
+                    compactedSizeQueryPool,
+                    0 );
+            }
         }
-        vkEndCommandBuffer( commandBuffers[ imageIndex ] );
+        vkEndCommandBuffer( commandBuffers[ frameIndex ] );
 
-        VkSubmitInfo submitInfo{
-            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .commandBufferCount = 1,
-            .pCommandBuffers = &commandBuffers[ imageIndex ],
-        };
-        vkQueueSubmit( graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE );
-        vkQueueWaitIdle( graphicsQueue );
+        submitAndWait( commandBuffers[ frameIndex ] );
     }
 
-    vkFreeMemory( device, scratchBufferMem, nullptr );
-    vkFreeMemory( device, geoTransformBufferMem, nullptr );
+    memoryAllocator.free( scratchBufferMem );
+    memoryAllocator.free( geoTransformBufferMem );
     vkDestroyBuffer( device, scratchBuffer, nullptr );
     vkDestroyBuffer( device, geoTransformBuffer, nullptr );
 
-    return IAccelerationStructureRef( outBlas );
+    if( compactedSizeQueryPool != VK_NULL_HANDLE )
+    {
+        compactBLASes( outBlases, compactedSizeQueryPool );
+        vkDestroyQueryPool( device, compactedSizeQueryPool, nullptr );
+    }
+
+    return outBlases;
+}
+
+// Copies every BLAS into storage of its compacted size and releases the original one
+void VulkanRenderBackend::compactBLASes( std::vector<IAccelerationStructureRef>& blases, VkQueryPool compactedSizeQueryPool )
+{
+    std::vector<VkDeviceSize> compactedSizes( blases.size() );
+    vkGetQueryPoolResults(
+        device,
+        compactedSizeQueryPool,
+        0,
+        ( uint32 )blases.size(),
+        compactedSizes.size() * sizeof( VkDeviceSize ),
+        compactedSizes.data(),
+        sizeof( VkDeviceSize ),
+        VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT );
+
+    struct OriginalBLAS
+    {
+        VkBuffer descriptor;
+        DeviceAllocation memory;
+        VkAccelerationStructureKHR handle;
+    };
+    std::vector<OriginalBLAS> originals( blases.size() );
+    VkDeviceSize originalBytes = 0;
+    VkDeviceSize compactedBytes = 0;
+
+    vkResetCommandBuffer( commandBuffers[ frameIndex ], 0 );
+    vkBeginCommandBuffer( commandBuffers[ frameIndex ], &beginInfo );
+    for( size_t blasIndex = 0; blasIndex < blases.size(); ++blasIndex )
+    {
+        VulkanAccelerationStructure* blas = static_cast< VulkanAccelerationStructure* >( blases[ blasIndex ].get() );
+        originals[ blasIndex ].descriptor = blas->descriptor;
+        originals[ blasIndex ].memory = blas->memory;
+        originals[ blasIndex ].handle = blas->handle;
+
+        std::tie( blas->descriptor, blas->memory ) = createBuffer(
+            compactedSizes[ blasIndex ],
+            VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
+
+        VkAccelerationStructureCreateInfoKHR asCreateInfo{
+            .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+            .buffer = blas->descriptor,
+            .size = compactedSizes[ blasIndex ],
+            .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+        };
+        vkCreateAccelerationStructureKHR( device, &asCreateInfo, nullptr, &blas->handle );
+
+        VkCopyAccelerationStructureInfoKHR copyInfo{
+            .sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR,
+            .src = originals[ blasIndex ].handle,
+            .dst = blas->handle,
+            .mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR,
+        };
+        vkCmdCopyAccelerationStructureKHR( commandBuffers[ frameIndex ], &copyInfo );
+
+        originalBytes += originals[ blasIndex ].memory.size;
+        compactedBytes += blas->memory.size;
+    }
+    vkEndCommandBuffer( commandBuffers[ frameIndex ] );
+
+    submitAndWait( commandBuffers[ frameIndex ] );
+
+    for( const OriginalBLAS& original : originals )
+    {
+        vkDestroyAccelerationStructureKHR( device, original.handle, nullptr );
+        vkDestroyBuffer( device, original.descriptor, nullptr );
+        memoryAllocator.free( original.memory );
+    }
+
+    blasOriginalBytes = originalBytes;
+    blasCompactedBytes = compactedBytes;
+}
+
+void VulkanRenderBackend::submitAndWait( VkCommandBuffer commandBuffer )
+{
+    VkFenceCreateInfo fenceInfo{ .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+    VkFence fence;
+    vkCreateFence( device, &fenceInfo, nullptr, &fence );
+
+    VkSubmitInfo submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffer,
+    };
+    vkQueueSubmit( graphicsQueue, 1, &submitInfo, fence );
+    vkWaitForFences( device, 1, &fence, VK_TRUE, UINT64_MAX );
+    vkDestroyFence( device, fence, nullptr );
 }
 
 struct ObjectDesc
@@ -1673,7 +1881,7 @@ void VulkanRenderBackend::createTLAS( const std::vector<BLASBatch*>& batches )
         objectBufferCount += batch->transforms.size();
     }
     const uint64 objectDescBufferSize = objectBufferCount * sizeof(ObjectDesc);
-    VkDeviceMemory objectBufferMem;
+    DeviceAllocation objectBufferMem;
     std::tie(objectBuffer, objectBufferMem) = createBuffer(
         objectDescBufferSize,
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT |
@@ -1682,7 +1890,7 @@ void VulkanRenderBackend::createTLAS( const std::vector<BLASBatch*>& batches )
         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
     
-    vkMapMemory(device, objectBufferMem, 0, objectDescBufferSize, 0, &dst);
+    dst = objectBufferMem.mappedData;
     for( int32 batchIndex = 0, objectIndex = 0; batchIndex < batches.size(); ++batchIndex )
     {
         BLASBatch* batch = batches[ batchIndex ];
@@ -1711,18 +1919,26 @@ void VulkanRenderBackend::createTLAS( const std::vector<BLASBatch*>& batches )
             memcpy((ObjectDesc*)dst + objectIndex, &objectDesc, sizeof(ObjectDesc));
         }
     }
-    vkUnmapMemory(device, objectBufferMem);
 
     const int64 instanceDataByteSize = instanceData.size() * sizeof( VkAccelerationStructureInstanceKHR );
 
-    auto [instanceBuffer, instanceBufferMem] = createBuffer(
+    if( tlasInstanceBuffer != VK_NULL_HANDLE )
+    {
+        memoryAllocator.free( tlasInstanceBufferMem );
+        vkDestroyBuffer( device, tlasInstanceBuffer, nullptr );
+        memoryAllocator.free( tlasScratchBufferMem );
+        vkDestroyBuffer( device, tlasScratchBuffer, nullptr );
+    }
+
+    std::tie( tlasInstanceBuffer, tlasInstanceBufferMem ) = createBuffer(
         instanceDataByteSize,
         VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
 
-    vkMapMemory( device, instanceBufferMem, 0, instanceDataByteSize, 0, &dst );
+    dst = tlasInstanceBufferMem.mappedData;
     memcpy( dst, instanceData.data(), instanceDataByteSize );
-    vkUnmapMemory( device, instanceBufferMem );
+    tlasInstances = static_cast< VkAccelerationStructureInstanceKHR* >( dst );
+    tlasInstanceCount = static_cast< uint32 >( instanceData.size() );
 
     VkAccelerationStructureGeometryKHR instances{
         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
@@ -1730,7 +1946,7 @@ void VulkanRenderBackend::createTLAS( const std::vector<BLASBatch*>& batches )
         .geometry = {
             .instances = {
                 .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
-                .data = {.deviceAddress = getDeviceAddressOf( instanceBuffer ) },
+                .data = {.deviceAddress = getDeviceAddressOf( tlasInstanceBuffer ) },
             },
         },
         .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
@@ -1741,7 +1957,7 @@ void VulkanRenderBackend::createTLAS( const std::vector<BLASBatch*>& batches )
     VkAccelerationStructureBuildGeometryInfoKHR buildTlasInfo{
         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
         .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
-        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR,
         .geometryCount = 1,     // It must be 1 with .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR as shown in the vulkan spec.
         .pGeometries = &instances,
     };
@@ -1759,8 +1975,9 @@ void VulkanRenderBackend::createTLAS( const std::vector<BLASBatch*>& batches )
         VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
 
-    auto [scratchBuffer, scratchBufferMem] = createBuffer(
-        requiredSize.buildScratchSize,
+    // Sized for both the initial build and later updates
+    std::tie( tlasScratchBuffer, tlasScratchBufferMem ) = createBuffer(
+        std::max( requiredSize.buildScratchSize, requiredSize.updateScratchSize ),
         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
 
@@ -1777,31 +1994,87 @@ void VulkanRenderBackend::createTLAS( const std::vector<BLASBatch*>& batches )
 
     // Build TLAS using GPU operations
     {
-        vkResetCommandBuffer( commandBuffers[ imageIndex ], 0 );
-        vkBeginCommandBuffer( commandBuffers[ imageIndex ], &beginInfo );
+        vkResetCommandBuffer( commandBuffers[ frameIndex ], 0 );
+        vkBeginCommandBuffer( commandBuffers[ frameIndex ], &beginInfo );
         {
             buildTlasInfo.dstAccelerationStructure = tlas;
-            buildTlasInfo.scratchData.deviceAddress = getDeviceAddressOf( scratchBuffer );
+            buildTlasInfo.scratchData.deviceAddress = getDeviceAddressOf( tlasScratchBuffer );
 
             VkAccelerationStructureBuildRangeInfoKHR buildTlasRangeInfo = { .primitiveCount = instanceCount };
             VkAccelerationStructureBuildRangeInfoKHR* buildTlasRangeInfo_[] = { &buildTlasRangeInfo };
-            vkCmdBuildAccelerationStructuresKHR( commandBuffers[ imageIndex ], 1, &buildTlasInfo, buildTlasRangeInfo_ );
+            vkCmdBuildAccelerationStructuresKHR( commandBuffers[ frameIndex ], 1, &buildTlasInfo, buildTlasRangeInfo_ );
         }
-        vkEndCommandBuffer( commandBuffers[ imageIndex ] );
+        vkEndCommandBuffer( commandBuffers[ frameIndex ] );
 
         VkSubmitInfo submitInfo{
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
             .commandBufferCount = 1,
-            .pCommandBuffers = &commandBuffers[ imageIndex ],
+            .pCommandBuffers = &commandBuffers[ frameIndex ],
         };
         vkQueueSubmit( graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE );
         vkQueueWaitIdle( graphicsQueue );
     }
 
-    vkFreeMemory( device, scratchBufferMem, nullptr );
-    vkFreeMemory( device, instanceBufferMem, nullptr );
-    vkDestroyBuffer( device, scratchBuffer, nullptr );
-    vkDestroyBuffer( device, instanceBuffer, nullptr );
+}
+
+// The BLASes, instance order and custom indices are unchanged, so the TLAS is refit in place
+// and the descriptor sets of the pipeline keep pointing at the same handle
+void VulkanRenderBackend::updateTLAS( const std::vector<BLASBatch*>& batches )
+{
+    // The previous frame may still be tracing against the TLAS
+    vkQueueWaitIdle( graphicsQueue );
+
+    uint32 instanceCount = 0;
+    for( int32 batchIndex = 0; batchIndex < batches.size(); ++batchIndex )
+    {
+        BLASBatch* batch = batches[ batchIndex ];
+        for( int32 instanceIndex = 0; instanceIndex < batch->transforms.size(); ++instanceIndex, ++instanceCount )
+        {
+            assert( instanceCount < tlasInstanceCount );
+            memcpy( &tlasInstances[ instanceCount ].transform, &batch->transforms[ instanceIndex ], sizeof( Mat3x4 ) ); // VkAccelerationStructureInstanceKHR::transform
+        }
+    }
+
+    VkAccelerationStructureGeometryKHR instances{
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+        .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+        .geometry = {
+            .instances = {
+                .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+                .data = {.deviceAddress = getDeviceAddressOf( tlasInstanceBuffer ) },
+            },
+        },
+        .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+    };
+
+    VkAccelerationStructureBuildGeometryInfoKHR updateTlasInfo{
+        .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+        .type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR,
+        .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR,
+        .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR,
+        .srcAccelerationStructure = tlas,
+        .dstAccelerationStructure = tlas,
+        .geometryCount = 1,
+        .pGeometries = &instances,
+        .scratchData = {.deviceAddress = getDeviceAddressOf( tlasScratchBuffer ) },
+    };
+
+    vkResetCommandBuffer( commandBuffers[ frameIndex ], 0 );
+    vkBeginCommandBuffer( commandBuffers[ frameIndex ], &beginInfo );
+    {
+        VkAccelerationStructureBuildRangeInfoKHR updateTlasRangeInfo = { .primitiveCount = tlasInstanceCount };
+        VkAccelerationStructureBuildRangeInfoKHR* updateTlasRangeInfo_[] = { &updateTlasRangeInfo };
+        vkCmdBuildAccelerationStructuresKHR( commandBuffers[ frameIndex ], 1, &updateTlasInfo, updateTlasRangeInfo_ );
+    }
+    vkEndCommandBuffer( commandBuffers[ frameIndex ] );
+
+    VkSubmitInfo submitInfo{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &commandBuffers[ frameIndex ],
+    };
+    vkQueueSubmit( graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE );
+    vkQueueWaitIdle( graphicsQueue );
 }
 
 void VulkanRenderBackend::createOutImage()
@@ -1832,22 +2105,22 @@ void VulkanRenderBackend::createOutImage()
     };
     vkCreateImageView( device, &ci0, nullptr, &outImageView );
 
-    vkResetCommandBuffer( commandBuffers[ imageIndex ], 0 );
-    vkBeginCommandBuffer( commandBuffers[ imageIndex ], &beginInfo );
+    vkResetCommandBuffer( commandBuffers[ frameIndex ], 0 );
+    vkBeginCommandBuffer( commandBuffers[ frameIndex ], &beginInfo );
     {
         setImageLayout(
-            commandBuffers[ imageIndex ],
+            commandBuffers[ frameIndex ],
             outImage,
             VK_IMAGE_LAYOUT_UNDEFINED,
             VK_IMAGE_LAYOUT_GENERAL,
             subresourceRange );
     }
-    vkEndCommandBuffer( commandBuffers[ imageIndex ] );
+    vkEndCommandBuffer( commandBuffers[ frameIndex ] );
 
     VkSubmitInfo submitInfo{
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
         .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffers[ imageIndex ],
+        .pCommandBuffers = &commandBuffers[ frameIndex ],
     };
     vkQueueSubmit( graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE );
     vkQueueWaitIdle( graphicsQueue );
@@ -1878,22 +2151,22 @@ void VulkanRenderBackend::createAccumulationImage()
     };
     vkCreateImageView( device, &ci0, nullptr, &accumulationImageView );
 
-    vkResetCommandBuffer( commandBuffers[ imageIndex ], 0 );
-    vkBeginCommandBuffer( commandBuffers[ imageIndex ], &beginInfo );
+    vkResetCommandBuffer( commandBuffers[ frameIndex ], 0 );
+    vkBeginCommandBuffer( commandBuffers[ frameIndex ], &beginInfo );
     {
         setImageLayout(
-            commandBuffers[ imageIndex ],
+            commandBuffers[ frameIndex ],
             accumulationImage,
             VK_IMAGE_LAYOUT_UNDEFINED,
             VK_IMAGE_LAYOUT_GENERAL,
             subresourceRange );
     }
-    vkEndCommandBuffer( commandBuffers[ imageIndex ] );
+    vkEndCommandBuffer( commandBuffers[ frameIndex ] );
 
     VkSubmitInfo submitInfo{
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
         .commandBufferCount = 1,
-        .pCommandBuffers = &commandBuffers[ imageIndex ],
+        .pCommandBuffers = &commandBuffers[ frameIndex ],
     };
     vkQueueSubmit( graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE );
     vkQueueWaitIdle( graphicsQueue );
@@ -1901,151 +2174,110 @@ void VulkanRenderBackend::createAccumulationImage()
 
 #include "CameraObject.h"
 #include "Scene.h"
-void VulkanRenderBackend::createUniformBuffer()
+namespace
 {
-    {
-        struct Data
-        {
-            float cameraPos[3];
-            float yFov_degree;
-            float exposure;
-            uint32 frameCount;
-            uint32 padding[2];
-        } dataSrc;
-
-        std::tie(cameraBuffer, cameraBufferMem) = createBuffer(
-            sizeof(dataSrc),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-        CameraObject* co = tempScenePointer->getCamera();
-        const Vec3& pos = co->getWorldPosition();
-        float cameraPos[3] = { pos.x, pos.y, pos.z };
-        float fov = co->getFov();
-        float exposure = co->getExposure();
-
-        void* dst;
-        vkMapMemory(device, cameraBufferMem, 0, sizeof(dataSrc), 0, &dst);
-        *(Data*)dst = { cameraPos[0], cameraPos[1], cameraPos[2], fov, exposure, currentFrameCount };
-        vkUnmapMemory(device, cameraBufferMem);
-    }
-
-    {
-        imguiParam dataSrc = *tempScenePointer->getImguiParam();
+struct CameraConstants
+{
+    float cameraPos[3];
+    float yFov_degree;
+    float exposure;
+    uint32 frameCount;
+    uint32 padding[2];
+};
 
-        std::tie(imguiBuffer, imguiBufferMem) = createBuffer(
-            sizeof(dataSrc),
-            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+struct LightHeaderData
+{
+    uint32 lightCount;
+    uint32 pad1;
+    uint32 pad2;
+    uint32 pad3;
+    // LightData array follows
+};
 
-        void* dst;
-        vkMapMemory(device, imguiBufferMem, 0, sizeof(dataSrc), 0, &dst);
-        memcpy(dst, &dataSrc, sizeof(imguiParam));
-        vkUnmapMemory(device, imguiBufferMem);
-    }
+VkDeviceSize alignFrameConstant( VkDeviceSize value, VkDeviceSize alignment )
+{
+    return ( value + alignment - 1 ) / alignment * alignment;
+}
 }
 
-void VulkanRenderBackend::createLightBuffer()
+void VulkanRenderBackend::createUniformBuffer()
 {
-    struct LightHeaderData
-    {
-        uint32 lightIdx[RenderSettings::maxLightCounts]; // 16 lights max
-        uint32 lightCount;
-        uint32 pad1;
-        uint32 pad2;
-        uint32 pad3;
-        // LightData array follows
-    };
-
-    // Create an initial light buffer with space for up to 16 lights
-    const size_t maxLights = RenderSettings::maxLightCounts;
-    const size_t lightDataSize = sizeof(LightData);
-    const size_t bufferSize = sizeof(LightHeaderData) + lightDataSize * maxLights; // header + lights
-    
-    std::tie( lightBuffer, lightBufferMem ) = createBuffer(
-        bufferSize,
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties( physicalDevice, &deviceProperties );
+    const VkDeviceSize alignment = std::max( deviceProperties.limits.minUniformBufferOffsetAlignment,
+                                             deviceProperties.limits.minStorageBufferOffsetAlignment );
+
+    // Layout of one slice, every range starts at a valid dynamic offset
+    cameraConstants = { VK_NULL_HANDLE, 0, sizeof( CameraConstants ) };
+    imguiConstants = { VK_NULL_HANDLE, alignFrameConstant( cameraConstants.offset + cameraConstants.range, alignment ), sizeof( imguiParam ) };
+    // The light sections are sized for the scene, so there is no fixed light count
+    lightCapacity = std::max<uint32>( static_cast< uint32 >( tempScenePointer->collectMeshObjects().size() ), 1 );
+    lightConstants = { VK_NULL_HANDLE, alignFrameConstant( imguiConstants.offset + imguiConstants.range, alignment ),
+                       sizeof( LightHeaderData ) + sizeof( LightData ) * lightCapacity };
+    instanceLightConstants = { VK_NULL_HANDLE, alignFrameConstant( lightConstants.offset + lightConstants.range, alignment ),
+                               sizeof( uint32 ) * lightCapacity };
+    frameConstantSliceSize = alignFrameConstant( instanceLightConstants.offset + instanceLightConstants.range, alignment );
+
+    std::tie( frameConstantBuffer, frameConstantBufferMem ) = createBuffer(
+        frameConstantSliceSize * RenderSettings::maxFramesInFlight,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
-    
-    // Initialize with zero lights
-    void* dst;
-    vkMapMemory( device, lightBufferMem, 0, bufferSize, 0, &dst );
-    memset( dst, 0, bufferSize );
-    vkUnmapMemory( device, lightBufferMem );
+    memset( frameConstantBufferMem.mappedData, 0, frameConstantSliceSize * RenderSettings::maxFramesInFlight );
+
+    cameraConstants.buffer = frameConstantBuffer;
+    imguiConstants.buffer = frameConstantBuffer;
+    lightConstants.buffer = frameConstantBuffer;
+    instanceLightConstants.buffer = frameConstantBuffer;
+
+    frameImguiParam = *tempScenePointer->getImguiParam();
+    frameLights.clear();
 }
 
 void VulkanRenderBackend::updateLightBuffer( const std::vector<LightData>& lights )
 {
-    auto& lightIndex = tempScenePointer->getLightIndex();
-
-    struct LightHeaderData
-    {
-        uint32 lightIdx[RenderSettings::maxLightCounts]; // 16 lights max
-        uint32 lightCount;
-        uint32 pad1;
-        uint32 pad2;
-        uint32 pad3;
-        // LightData array follows
-    };
-    
-    const size_t headerSize = sizeof(LightHeaderData);
-    const size_t lightSize = sizeof(LightData) * lights.size();
-    const size_t bufferSize = headerSize + lightSize;
-    
-    void* dst;
-    vkMapMemory( device, lightBufferMem, 0, bufferSize, 0, &dst );
-    
-    // Write header
-    LightHeaderData* header = (LightHeaderData*)dst;
-    for (int i = 0; i < lights.size(); ++i)
-        header->lightIdx[i] = lightIndex[i];
-    header->lightCount = static_cast<uint32>(lights.size());
-    header->pad1 = 0;
-    header->pad2 = 0;
-    header->pad3 = 0;
-    
-    // Write light data
-    LightData* dstLights = (LightData*)(static_cast<uint8_t*>(dst) + headerSize);
+    frameLights = lights;
+}
 
-    std::memcpy(dstLights, lights.data(), lightSize);
-    
-    vkUnmapMemory( device, lightBufferMem );
+void A3::VulkanRenderBackend::updateImguiBuffer()
+{
+    frameImguiParam = *tempScenePointer->getImguiParam();
 }
 
-void VulkanRenderBackend::updateCameraBuffer()
+// Called once the fence of frameSlot has been waited, so the GPU no longer reads the slice
+void VulkanRenderBackend::writeFrameConstants( uint32 frameSlot )
 {
-    {
-        struct Data
-        {
-            float cameraPos[3];
-            float yFov_degree;
-            float exposure;
-            uint32 frameCount;
-            uint32 padding[2];
-        } dataSrc;
+    uint8* slice = static_cast< uint8* >( frameConstantBufferMem.mappedData ) + frameSlot * frameConstantSliceSize;
 
+    {
         CameraObject* co = tempScenePointer->getCamera();
         const Vec3& pos = co->getWorldPosition();
-        float cameraPos[3] = { pos.x, pos.y, pos.z };
-        float fov = co->getFov();
-        float exposure = co->getExposure();
 
-        void* dst;
-        vkMapMemory(device, cameraBufferMem, 0, sizeof(dataSrc), 0, &dst);
-        *(Data*)dst = { cameraPos[0], cameraPos[1], cameraPos[2], fov, exposure, currentFrameCount };
-        vkUnmapMemory(device, cameraBufferMem);
+        CameraConstants* camera = reinterpret_cast< CameraConstants* >( slice + cameraConstants.offset );
+        *camera = { pos.x, pos.y, pos.z, co->getFov(), co->getExposure(), currentFrameCount };
     }
-}
 
-void A3::VulkanRenderBackend::updateImguiBuffer()
-{
+    memcpy( slice + imguiConstants.offset, &frameImguiParam, sizeof( imguiParam ) );
+
     {
-        imguiParam dataSrc = *tempScenePointer->getImguiParam();
+        const uint32 lightCount = std::min<uint32>( static_cast< uint32 >( frameLights.size() ), lightCapacity );
+
+        LightHeaderData* header = reinterpret_cast< LightHeaderData* >( slice + lightConstants.offset );
+        header->lightCount = lightCount;
+        header->pad1 = 0;
+        header->pad2 = 0;
+        header->pad3 = 0;
+
+        // Maps the instance of a hit back to its light
+        uint32* instanceLights = reinterpret_cast< uint32* >( slice + instanceLightConstants.offset );
+        std::fill_n( instanceLights, lightCapacity, INVALID_LIGHT_INDEX );
+        for( uint32 i = 0; i < lightCount; ++i )
+        {
+            if( frameLights[ i ].instanceIndex < lightCapacity )
+                instanceLights[ frameLights[ i ].instanceIndex ] = i;
+        }
 
-        void* dst;
-        vkMapMemory(device, imguiBufferMem, 0, sizeof(dataSrc), 0, &dst);
-        memcpy(dst, &dataSrc, sizeof(imguiParam));
-        vkUnmapMemory(device, imguiBufferMem);
+        LightData* dstLights = reinterpret_cast< LightData* >( slice + lightConstants.offset + sizeof( LightHeaderData ) );
+        std::memcpy( dstLights, frameLights.data(), sizeof( LightData ) * lightCount );
     }
 }
 
@@ -2086,6 +2318,8 @@ VkDescriptorType getVulkanShaderDescriptorType( EShaderResourceDescriptor type )
         case SRD_StorageBuffer:         return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
         case SRD_StorageImage:          return VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
         case SRD_UniformBuffer:         return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        case SRD_UniformBufferDynamic:  return VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+        case SRD_StorageBufferDynamic:  return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
         case SRD_ImageSampler:          return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     }
 
@@ -2105,7 +2339,14 @@ IRenderPipelineRef VulkanRenderBackend::createRayTracingPipeline( const Raytraci
     //==========================================================
     // Pipeline layout
     //==========================================================
-    std::vector<VkDescriptorSetLayoutBinding> bindings( 10 );
+    uint32 bindingCount = 0;
+    for( const ShaderDesc& shaderDesc : psoDesc.shaders )
+    {
+        for( const ShaderResourceDescriptor& descriptor : shaderDesc.descriptors )
+            bindingCount = std::max( bindingCount, descriptor.index + 1 );
+    }
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings( bindingCount );
     for( const ShaderDesc& shaderDesc : psoDesc.shaders )
     {
         for( const ShaderResourceDescriptor& descriptor : shaderDesc.descriptors )
@@ -2118,6 +2359,15 @@ IRenderPipelineRef VulkanRenderBackend::createRayTracingPipeline( const Raytraci
         }
     }
 
+    // Binding numbers no shader declares would alias binding 0, the layout only gets the declared ones
+    std::erase_if( bindings, []( const VkDescriptorSetLayoutBinding& binding ) { return binding.descriptorCount == 0; } );
+
+    for( const VkDescriptorSetLayoutBinding& binding : bindings )
+    {
+        if( binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC )
+            ++outPipeline->dynamicBufferCount;
+    }
+
     VkDescriptorSetLayoutCreateInfo descriptorLayoutCreateInfo
     {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
@@ -2140,6 +2390,10 @@ IRenderPipelineRef VulkanRenderBackend::createRayTracingPipeline( const Raytraci
     std::vector<VkPipelineShaderStageCreateInfo> stages( psoDesc.shaders.size() );
     std::vector<VkRayTracingShaderGroupCreateInfoKHR> groups;
 
+    // constant_id is the index in ShaderDesc::specializationConstants
+    std::vector<std::vector<VkSpecializationMapEntry>> specializationEntries( stages.size() );
+    std::vector<VkSpecializationInfo> specializationInfos( stages.size() );
+
     int closestHitStage = -1, anyHitStage = -1;
 
     for( uint32 index = 0; index < stages.size(); ++index )
@@ -2155,6 +2409,22 @@ IRenderPipelineRef VulkanRenderBackend::createRayTracingPipeline( const Raytraci
             .pName = "main",
         };
 
+        if( !desc.specializationConstants.empty() )
+        {
+            std::vector<VkSpecializationMapEntry>& entries = specializationEntries[ index ];
+            for( uint32 constantId = 0; constantId < desc.specializationConstants.size(); ++constantId )
+                entries.push_back( { constantId, constantId * ( uint32 )sizeof( uint32 ), sizeof( uint32 ) } );
+
+            specializationInfos[ index ] = VkSpecializationInfo
+            {
+                .mapEntryCount = ( uint32 )entries.size(),
+                .pMapEntries = entries.data(),
+                .dataSize = desc.specializationConstants.size() * sizeof( uint32 ),
+                .pData = desc.specializationConstants.data(),
+            };
+            stages[ index ].pSpecializationInfo = &specializationInfos[ index ];
+        }
+
         if (desc.type == SS_ClosestHit) { closestHitStage = index; continue; }
         if (desc.type == SS_AnyHit) { anyHitStage = index; continue; }
 
@@ -2186,10 +2456,10 @@ IRenderPipelineRef VulkanRenderBackend::createRayTracingPipeline( const Raytraci
         .pStages = stages.data(),
         .groupCount = ( uint32 )groups.size(),
         .pGroups = groups.data(),
-        .maxPipelineRayRecursionDepth = 31,
+        .maxPipelineRayRecursionDepth = 1, // Bounces loop in the ray generation shader, only primary traceRayEXT calls
         .layout = outPipeline->pipelineLayout,
     };
-    vkCreateRayTracingPipelinesKHR( device, VK_NULL_HANDLE, VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &outPipeline->pipeline );
+    vkCreateRayTracingPipelinesKHR( device, VK_NULL_HANDLE, pipelineCache, 1, &pipelineCreateInfo, nullptr, &outPipeline->pipeline );
 
     //==========================================================
     // Descriptor set 
@@ -2223,18 +2493,19 @@ IRenderPipelineRef VulkanRenderBackend::createRayTracingPipeline( const Raytraci
         }
 
         // @TODO: Move to scene level
-        std::vector<VkBuffer> storageBuffers = 
+        std::vector<VkDescriptorBufferInfo> storageBuffers = 
         { 
-            nullptr, nullptr,
-            cameraBuffer, objectBuffer,
-            lightBuffer, nullptr, nullptr, imguiBuffer
+            {}, {},
+            cameraConstants, { objectBuffer, 0, VK_WHOLE_SIZE },
+            lightConstants, {}, {}, imguiConstants,
+            { envAliasBuffer, 0, VK_WHOLE_SIZE }, {}, instanceLightConstants
         };
 
         std::vector<VkWriteDescriptorSet> validDescriptors;
         
-        for( int32 index = 0; index < bindings.size(); ++index )
+        for( const VkDescriptorSetLayoutBinding& binding : bindings )
         {
-            const VkDescriptorSetLayoutBinding& binding = bindings[ index ];
+            const uint32 index = binding.binding;
 
             VkWriteDescriptorSet descriptor{};
             descriptor.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -2271,23 +2542,18 @@ IRenderPipelineRef VulkanRenderBackend::createRayTracingPipeline( const Raytraci
 
                 descriptor.pImageInfo = &writeDescriptorSets.images.back();
             }
-            else if( binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER )
+            else if( binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER || binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                  || binding.descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC || binding.descriptorType == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC )
             {
-                VkBuffer buffer = storageBuffers[ index ];
-                if (buffer == nullptr) {
-                    printf("WARNING: Storage buffer at index %d is null (binding %d)\n", index, binding.binding);
+                const VkDescriptorBufferInfo bufferInfo = index < storageBuffers.size() ? storageBuffers[ index ] : VkDescriptorBufferInfo{};
+                if (bufferInfo.buffer == nullptr) {
+                    printf("WARNING: Storage buffer at binding %u is null\n", index);
                     // Skip this descriptor for now
                     continue;
                 }
                 
-                writeDescriptorSets.buffers.emplace_back(
-                    VkDescriptorBufferInfo
-                    {
-                        .buffer = buffer,
-                        .offset = 0,
-                        .range = VK_WHOLE_SIZE
-                    }
-                );
+                // Frame constants are ranges of the first slice, the dynamic offset selects the slice of the frame
+                writeDescriptorSets.buffers.emplace_back( bufferInfo );
 
                 descriptor.pBufferInfo = &writeDescriptorSets.buffers.back();
             }
@@ -2296,7 +2562,7 @@ IRenderPipelineRef VulkanRenderBackend::createRayTracingPipeline( const Raytraci
                 writeDescriptorSets.images.emplace_back(
                     VkDescriptorImageInfo{
                         .sampler = envSampler,
-                        .imageView = index == 6 ? envImageView : index == 8 ? envImportanceView : envHitView, // @TODO: decouple index based logic
+                        .imageView = envImageView,
                         .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
                     }
                 );
@@ -2332,52 +2598,50 @@ IRenderPipelineRef VulkanRenderBackend::createRayTracingPipeline( const Raytraci
             return ( value + ( decltype( value ) )alignment - 1 ) & ~( ( decltype( value ) )alignment - 1 );
         };
     const uint32 handleSize = RenderSettings::shaderGroupHandleSize;
-    const uint32 groupCount = static_cast<uint32>( groups.size() ); // 1 raygen, 2 miss, 1 hit group
+    const uint32 groupCount = static_cast<uint32>( groups.size() ); // 1 raygen, the miss shaders, 1 hit group
+    const uint32 missCount = groupCount - 2;
     std::vector<ShaderGroupHandle> handles( groupCount );
     vkGetRayTracingShaderGroupHandlesKHR( device, outPipeline->pipeline, 
                                           0, groupCount, 
                                           handleSize*groupCount, 
                                           handles.data() );
     ShaderGroupHandle rgenHandle = handles[ 0 ];
-    ShaderGroupHandle missHandle = handles[ 1 ];
-    ShaderGroupHandle shadowMissHandle = handles[ 2 ];
-    ShaderGroupHandle hitgHandle = handles[ 3 ];
+    ShaderGroupHandle hitgHandle = handles[ groupCount - 1 ];
 
     const uint32 rgenStride = alignTo( handleSize, rtProperties.shaderGroupHandleAlignment );
-    rgenSbt = { 0, rgenStride, rgenStride };
+    outPipeline->rgenSbt = { 0, rgenStride, rgenStride };
 
-    const uint64 missOffset = alignTo( rgenSbt.size, rtProperties.shaderGroupBaseAlignment );
+    const uint64 missOffset = alignTo( outPipeline->rgenSbt.size, rtProperties.shaderGroupBaseAlignment );
     const uint32 missStride = alignTo( handleSize, rtProperties.shaderGroupHandleAlignment );
-    missSbt = { 0, missStride, missStride * 2 };
+    outPipeline->missSbt = { 0, missStride, missStride * missCount };
 
     std::vector<MeshObject*> objects = tempScenePointer->collectMeshObjects();
     const uint32 hitgCustomDataSize = sizeof( HitgCustomData );
     const uint32 geometryCount = objects.size();
-    const uint64 hitgOffset = alignTo( missOffset + missSbt.size, rtProperties.shaderGroupBaseAlignment );
+    const uint64 hitgOffset = alignTo( missOffset + outPipeline->missSbt.size, rtProperties.shaderGroupBaseAlignment );
     const uint32 hitgStride = alignTo( handleSize + hitgCustomDataSize, rtProperties.shaderGroupHandleAlignment );
-    hitgSbt = { 0, hitgStride, hitgStride * geometryCount };
+    outPipeline->hitgSbt = { 0, hitgStride, hitgStride * geometryCount };
 
-    const uint64 sbtSize = hitgOffset + hitgSbt.size;
-    std::tie( sbtBuffer, sbtBufferMem ) = createBuffer(
+    const uint64 sbtSize = hitgOffset + outPipeline->hitgSbt.size;
+    std::tie( outPipeline->sbtBuffer, outPipeline->sbtBufferMem ) = createBuffer(
         sbtSize,
         VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
 
-    auto sbtAddress = getDeviceAddressOf( sbtBuffer );
+    auto sbtAddress = getDeviceAddressOf( outPipeline->sbtBuffer );
     if( sbtAddress != alignTo( sbtAddress, rtProperties.shaderGroupBaseAlignment ) )
     {
         throw std::runtime_error( "It will not be happened!" );
     }
-    rgenSbt.deviceAddress = sbtAddress;
-    missSbt.deviceAddress = sbtAddress + missOffset;
-    hitgSbt.deviceAddress = sbtAddress + hitgOffset;
+    outPipeline->rgenSbt.deviceAddress = sbtAddress;
+    outPipeline->missSbt.deviceAddress = sbtAddress + missOffset;
+    outPipeline->hitgSbt.deviceAddress = sbtAddress + hitgOffset;
 
-    uint8* dst;
-    vkMapMemory( device, sbtBufferMem, 0, sbtSize, 0, ( void** )&dst );
+    uint8* dst = static_cast< uint8* >( outPipeline->sbtBufferMem.mappedData );
     {
         *( ShaderGroupHandle* )dst = rgenHandle;
-        *( ShaderGroupHandle* )( dst + missOffset + 0 * missStride ) = missHandle;
-        *( ShaderGroupHandle* )( dst + missOffset + 1 * missStride ) = shadowMissHandle;
+        for( uint32 missIndex = 0; missIndex < missCount; ++missIndex )
+            *( ShaderGroupHandle* )( dst + missOffset + missIndex * missStride ) = handles[ 1 + missIndex ];
 
         for (size_t i = 0; i < geometryCount; ++i)
         {
@@ -2390,7 +2654,6 @@ IRenderPipelineRef VulkanRenderBackend::createRayTracingPipeline( const Raytraci
             *(HitgCustomData*)(dst + hitgOffset + i * hitgStride + handleSize) = mat;
         }
     }
-    vkUnmapMemory( device, sbtBufferMem );
 
     return IRenderPipelineRef( outPipeline );
 }
@@ -2429,7 +2692,7 @@ void VulkanRenderBackend::saveCurrentImage(const std::string& filename)
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPools[imageIndex];
+    allocInfo.commandPool = commandPools[frameIndex];
     allocInfo.commandBufferCount = 1;
     
     VkCommandBuffer cmdBuffer;
@@ -2514,11 +2777,10 @@ void VulkanRenderBackend::saveCurrentImage(const std::string& filename)
     vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
     vkQueueWaitIdle(graphicsQueue);
     
-    vkFreeCommandBuffers(device, commandPools[imageIndex], 1, &cmdBuffer);
+    vkFreeCommandBuffers(device, commandPools[frameIndex], 1, &cmdBuffer);
     
     // Map buffer and save to file
-    void* data;
-    vkMapMemory(device, stagingBufferMem, 0, imageSize, 0, &data);
+    void* data = stagingBufferMem.mappedData;
     
     // Convert BGRA to RGBA for stb_image_write
     uint8_t* pixels = (uint8_t*)data;
@@ -2550,9 +2812,7 @@ void VulkanRenderBackend::saveCurrentImage(const std::string& filename)
         printf("Failed to save image: %s\n", path.c_str());
     }
     
-    vkUnmapMemory(device, stagingBufferMem);
-    
     // Cleanup
     vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMem, nullptr);
+    memoryAllocator.free( stagingBufferMem );
 }
@@ -13,6 +13,8 @@
 #include "RenderSettings.h"
 #include "RenderBackend.h"
 #include "Matrix.h"
+#include "Scene.h"
+#include "DeviceMemoryAllocator.h"
 
 #ifdef NDEBUG
 const bool ON_DEBUG = false;
@@ -39,20 +41,22 @@ public:
     virtual void rebuildAccelerationStructure() override;
 
     //@TODO: Move to renderer
-    const class Scene* tempScenePointer = nullptr;
-    uint32 currentFrameCount = 0;
     virtual IAccelerationStructureRef createBLAS(const BLASBuildParams params) override;
+    virtual std::vector<IAccelerationStructureRef> createBLASes( const std::vector<BLASBuildParams>& params ) override;
     virtual void createTLAS( const std::vector<BLASBatch*>& batches ) override;
+    virtual void updateTLAS( const std::vector<BLASBatch*>& batches ) override;
     virtual IShaderModuleRef createShaderModule( const ShaderDesc& desc ) override;
+    void initializeShaderCompiler();
+    void finalizeShaderCompiler();
     virtual IRenderPipelineRef createRayTracingPipeline( const RaytracingPSODesc& psoDesc, RaytracingPSO* pso ) override;
     virtual void updateLightBuffer( const std::vector<LightData>& lights ) override;
     void createOutImage();
     void createAccumulationImage();
     void createUniformBuffer();
-    void createLightBuffer();
-    void updateCameraBuffer();
-    void updateImguiBuffer();
+    void writeFrameConstants( uint32 frameSlot );
+    virtual void updateImguiBuffer() override;
     void saveCurrentImage(const std::string& filename);
+    DeviceMemoryStats getMemoryStats() const { return memoryAllocator.getStats(); }
     //////////////////////////
 
 private:
@@ -64,8 +68,9 @@ private:
     void createSwapChain();
     void createImguiRenderPass( int32 screenWidth, int32 screenHeight );
     void createCommandCenter();
+    void createPipelineCache();
+    void savePipelineCache();
     void createEnvironmentMap(std::string_view hdrTexturePath);
-    void createEnvironmentMapImportanceSampling(float* pixels, int width, int height);
 
     void loadDeviceExtensionFunctions( VkDevice device );
 
@@ -81,12 +86,12 @@ private:
 
     uint32 findMemoryType( uint32_t memoryTypeBits, VkMemoryPropertyFlags reqMemProps );
 
-    std::tuple<VkBuffer, VkDeviceMemory> createBuffer(
+    std::tuple<VkBuffer, DeviceAllocation> createBuffer(
         VkDeviceSize size,
         VkBufferUsageFlags usage,
         VkMemoryPropertyFlags reqMemProps );
 
-    std::tuple<VkImage, VkDeviceMemory> createImage(
+    std::tuple<VkImage, DeviceAllocation> createImage(
         VkExtent2D extent,
         VkFormat format,
         VkImageUsageFlags usage,
@@ -105,6 +110,10 @@ private:
 
     VkDeviceAddress getDeviceAddressOf( VkAccelerationStructureKHR as );
 
+    void compactBLASes( std::vector<IAccelerationStructureRef>& blases, VkQueryPool compactedSizeQueryPool );
+
+    void submitAndWait( VkCommandBuffer commandBuffer );
+
 private:
     PFN_vkGetBufferDeviceAddressKHR vkGetBufferDeviceAddressKHR;
     PFN_vkCreateAccelerationStructureKHR vkCreateAccelerationStructureKHR;
@@ -112,11 +121,14 @@ private:
     PFN_vkGetAccelerationStructureBuildSizesKHR vkGetAccelerationStructureBuildSizesKHR;
     PFN_vkGetAccelerationStructureDeviceAddressKHR vkGetAccelerationStructureDeviceAddressKHR;
     PFN_vkCmdBuildAccelerationStructuresKHR vkCmdBuildAccelerationStructuresKHR;
+    PFN_vkCmdWriteAccelerationStructuresPropertiesKHR vkCmdWriteAccelerationStructuresPropertiesKHR;
+    PFN_vkCmdCopyAccelerationStructureKHR vkCmdCopyAccelerationStructureKHR;
     PFN_vkCreateRayTracingPipelinesKHR vkCreateRayTracingPipelinesKHR;
     PFN_vkGetRayTracingShaderGroupHandlesKHR vkGetRayTracingShaderGroupHandlesKHR;
     PFN_vkCmdTraceRaysKHR vkCmdTraceRaysKHR;
 
     VkPhysicalDeviceRayTracingPipelinePropertiesKHR  rtProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR };
+    VkPhysicalDeviceAccelerationStructurePropertiesKHR asProperties = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR };
 
     VkAllocationCallbacks* allocator;
 
@@ -127,6 +139,11 @@ private:
     VkPhysicalDevice physicalDevice;
     VkDevice device;
 
+    DeviceMemoryAllocator memoryAllocator;
+
+    // Shared by every pipeline creation, persisted to RenderSettings::pipelineCachePath
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+
     VkQueue graphicsQueue; // assume allowing graphics and present
     uint32 queueFamilyIndex;
 
@@ -137,60 +154,71 @@ private:
     const VkFormat swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;// VK_FORMAT_R16G16B16A16_SFLOAT;    // intentionally chosen to match a specific format
     const VkExtent2D swapChainImageExtent = { .width = RenderSettings::screenWidth, .height = RenderSettings::screenHeight };
 
+    // Indexed by frameIndex, reused once the fence of that frame in flight is signaled
     std::vector<VkCommandPool> commandPools;
-    std::vector<VkCommandBuffer> commandBuffers;
-
+    std::vector<VkCommandBuffer> commandBuffers;        // Ray tracing pass and one time submits
+    std::vector<VkCommandBuffer> imguiCommandBuffers;
     std::vector<VkSemaphore> imageAvailableSemaphores;
     std::vector<VkSemaphore> rtFinishedSemaphores;
+    std::vector<VkFence> fences;                        // Signaled by the last submit of the frame
+
+    // Indexed by imageIndex, presentation waits on the semaphore of the image it shows
     std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkFence> fences;
-    uint32 semaphoreIndex;
-    uint32 imageIndex;
+
+    uint32 frameIndex = 0;
+    uint32 imageIndex = 0;
 
     VkBuffer tlasBuffer;
-    VkDeviceMemory tlasBufferMem;
+    DeviceAllocation tlasBufferMem;
     VkAccelerationStructureKHR tlas;
 
+    // Kept alive after createTLAS for in-place updates
+    VkBuffer tlasInstanceBuffer = VK_NULL_HANDLE;
+    DeviceAllocation tlasInstanceBufferMem;
+    VkAccelerationStructureInstanceKHR* tlasInstances = nullptr;
+    uint32 tlasInstanceCount = 0;
+    VkBuffer tlasScratchBuffer = VK_NULL_HANDLE;
+    DeviceAllocation tlasScratchBufferMem;
+
+    // BLAS storage before and after the last compaction, shown in the imgui stats
+    VkDeviceSize blasOriginalBytes = 0;
+    VkDeviceSize blasCompactedBytes = 0;
+
     VkImage envImage;
-    VkDeviceMemory envImageMem;
+    DeviceAllocation envImageMem;
     VkImageView envImageView;
     VkSampler envSampler;
 
-    VkImage envImportanceImage;
-    VkDeviceMemory envImportanceMem;
-    VkImageView envImportanceView;
-
-    VkImage envHitImage;
-    VkDeviceMemory envHitMem;
-    VkImageView envHitView;
+    // Alias table over the environment map texels for importance sampling
+    VkBuffer envAliasBuffer = VK_NULL_HANDLE;
+    DeviceAllocation envAliasMem;
 
     VkImage outImage;
-    VkDeviceMemory outImageMem;
+    DeviceAllocation outImageMem;
     VkImageView outImageView;
     
     VkImage accumulationImage;
-    VkDeviceMemory accumulationImageMem;
+    DeviceAllocation accumulationImageMem;
     VkImageView accumulationImageView;
 
-    VkBuffer cameraBuffer;
-    VkDeviceMemory cameraBufferMem;
-    
-    VkBuffer lightBuffer;
-    VkDeviceMemory lightBufferMem;
-
-    VkBuffer imguiBuffer;
-    VkDeviceMemory imguiBufferMem;
+    // Camera, imgui parameters and lights of every frame in flight share one persistently mapped buffer.
+    // Each frame in flight owns a slice which is rewritten once per frame after its fence and bound with dynamic offsets.
+    VkBuffer frameConstantBuffer;
+    DeviceAllocation frameConstantBufferMem;
+    VkDeviceSize frameConstantSliceSize = 0;
+    VkDescriptorBufferInfo cameraConstants{};   // Offset and range inside a slice
+    VkDescriptorBufferInfo imguiConstants{};
+    VkDescriptorBufferInfo lightConstants{};
+    VkDescriptorBufferInfo instanceLightConstants{};
+    uint32 lightCapacity = 0;     // Every mesh object of the scene may be a light
+
+    // Latest values handed over by the renderer, copied into the slice of the frame being recorded
+    imguiParam frameImguiParam;
+    std::vector<LightData> frameLights;
 
     VkDescriptorPool descriptorPool;
     VkBuffer objectBuffer;
 
-    VkBuffer sbtBuffer;
-    VkDeviceMemory sbtBufferMem;
-    VkStridedDeviceAddressRegionKHR rgenSbt{};
-    VkStridedDeviceAddressRegionKHR missSbt{};
-    VkStridedDeviceAddressRegionKHR hitgSbt{};
-    VkStridedDeviceAddressRegionKHR callSbt{};
-
     VkCommandBufferBeginInfo beginInfo = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
     VkImageCopy copyRegion = {
@@ -2,6 +2,7 @@
 
 #include "RenderResource.h"
 #include "Shader.h"
+#include "DeviceMemoryAllocator.h"
 #include <vulkan/vulkan.h>
 
 namespace A3
@@ -11,7 +12,6 @@ struct VulkanAccelerationStructure : public IAccelerationStructure
 public:
     VulkanAccelerationStructure()
         : descriptor( nullptr )
-        , memory( nullptr )
         , handle( nullptr )
     {}
 
@@ -20,7 +20,7 @@ public:
 
 public:
     VkBuffer                    descriptor;
-    VkDeviceMemory              memory;
+    DeviceAllocation            memory;
     VkAccelerationStructureKHR  handle;
 
     VkBuffer vertexPositionBuffer;
@@ -55,5 +55,16 @@ public:
     VkDescriptorSet         descriptorSet;
     VkPipelineLayout        pipelineLayout;
     VkPipeline              pipeline;
+
+    // Dynamic uniform/storage buffers of the layout, each one gets the frame constant slice offset when bound
+    uint32                  dynamicBufferCount = 0;
+
+    // Every pipeline has its own shader group handles, so it keeps its own shader binding table
+    VkBuffer                        sbtBuffer = VK_NULL_HANDLE;
+    DeviceAllocation                sbtBufferMem;
+    VkStridedDeviceAddressRegionKHR rgenSbt{};
+    VkStridedDeviceAddressRegionKHR missSbt{};
+    VkStridedDeviceAddressRegionKHR hitgSbt{};
+    VkStridedDeviceAddressRegionKHR callSbt{};
 };
 }
\ No newline at end of file
@@ -0,0 +1,307 @@
+#include "WideBVH.h"
+#include "WideBVHTraversal.h"
+#include "MeshResource.h"
+#include <algorithm>
+#include <cassert>
+
+#ifndef _MSC_VER
+#include <cpuid.h>
+#endif
+
+using namespace A3;
+
+namespace
+{
+constexpr uint32 MAX_LEAF_TRIANGLES = 4;   // Subtrees up to one triangle pack are merged into a single leaf
+
+// Tests the 8 children as two 4-wide halves
+struct BoxTestSSE
+{
+    static uint32 test( const BVH8Node& node, const TraversalRay& ray, float tMax, float* outTNear )
+    {
+        const __m128 ox = _mm_set1_ps( ray.origin[ 0 ] );
+        const __m128 oy = _mm_set1_ps( ray.origin[ 1 ] );
+        const __m128 oz = _mm_set1_ps( ray.origin[ 2 ] );
+        const __m128 ix = _mm_set1_ps( ray.invDir[ 0 ] );
+        const __m128 iy = _mm_set1_ps( ray.invDir[ 1 ] );
+        const __m128 iz = _mm_set1_ps( ray.invDir[ 2 ] );
+        const __m128 rayTMin = _mm_set1_ps( ray.tMin );
+        const __m128 rayTMax = _mm_set1_ps( tMax );
+
+        uint32 mask = 0;
+        for( uint32 half = 0; half < 2; ++half )
+        {
+            const uint32 offset = half * 4;
+            const __m128 nearX = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[ ray.nearPlane[ 0 ] ] + offset ), ox ), ix );
+            const __m128 nearY = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[ ray.nearPlane[ 1 ] ] + offset ), oy ), iy );
+            const __m128 nearZ = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[ ray.nearPlane[ 2 ] ] + offset ), oz ), iz );
+            const __m128 farX = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[ ray.farPlane[ 0 ] ] + offset ), ox ), ix );
+            const __m128 farY = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[ ray.farPlane[ 1 ] ] + offset ), oy ), iy );
+            const __m128 farZ = _mm_mul_ps( _mm_sub_ps( _mm_load_ps( node.bounds[ ray.farPlane[ 2 ] ] + offset ), oz ), iz );
+
+            const __m128 tNear = _mm_max_ps( _mm_max_ps( nearX, nearY ), _mm_max_ps( nearZ, rayTMin ) );
+            const __m128 tFar = _mm_min_ps( _mm_min_ps( farX, farY ), _mm_min_ps( farZ, rayTMax ) );
+            _mm_store_ps( outTNear + offset, tNear );
+            mask |= static_cast< uint32 >( _mm_movemask_ps( _mm_cmple_ps( tNear, tFar ) ) ) << offset;
+        }
+        return mask;
+    }
+};
+
+bool isAVX2Supported()
+{
+#ifdef _MSC_VER
+    int32 info[ 4 ];
+    __cpuid( info, 0 );
+    if( info[ 0 ] < 7 )
+        return false;
+
+    // AVX, FMA and OS support for saving the YMM registers
+    __cpuid( info, 1 );
+    const bool bOSXSave = ( info[ 2 ] & ( 1 << 27 ) ) != 0;
+    const bool bAVX = ( info[ 2 ] & ( 1 << 28 ) ) != 0;
+    const bool bFMA = ( info[ 2 ] & ( 1 << 12 ) ) != 0;
+    if( !bOSXSave || !bAVX || !bFMA || ( _xgetbv( 0 ) & 0x6 ) != 0x6 )
+        return false;
+
+    __cpuidex( info, 7, 0 );
+    return ( info[ 1 ] & ( 1 << 5 ) ) != 0;
+#else
+    return __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" );
+#endif
+}
+
+// Only used by trees too deep for the fixed stack, grows to the deepest tree a thread has traversed
+WideStackEntry* getHeapStack( uint32 size )
+{
+    thread_local std::vector<WideStackEntry> heapStack;
+    if( heapStack.size() < size )
+        heapStack.resize( size );
+    return heapStack.data();
+}
+}
+
+bool A3::intersectWideBVH_SSE( const BVH8Node* nodes, const TrianglePack4* packs, const WideRay& ray, WideStackEntry* stack, WideHit& outHit )
+{
+    return intersectWide<BoxTestSSE>( nodes, packs, ray, stack, outHit );
+}
+
+bool A3::occludedWideBVH_SSE( const BVH8Node* nodes, const TrianglePack4* packs, const WideRay& ray, WideStackEntry* stack )
+{
+    return occludedWide<BoxTestSSE>( nodes, packs, ray, stack );
+}
+
+void WideBVH::build( const MeshResource& mesh )
+{
+    build( mesh.positions, mesh.indices );
+}
+
+struct WideBVH::CollapseContext
+{
+    const std::vector<BVHNode>& binaryNodes;
+    const std::vector<uint32>& triangleIndices;
+    const std::vector<VertexPosition>& positions;
+    const std::vector<uint32>& indices;
+
+    // Range of triangleIndices covered by each binary subtree, the builder partitions in place so it is contiguous
+    std::vector<uint32> subtreeFirst;
+    std::vector<uint32> subtreeCount;
+
+    bool isLeaf( uint32 binaryIndex ) const
+    {
+        return binaryNodes[ binaryIndex ].isLeaf() || subtreeCount[ binaryIndex ] <= MAX_LEAF_TRIANGLES;
+    }
+};
+
+void WideBVH::build( const std::vector<VertexPosition>& positions, const std::vector<uint32>& indices )
+{
+    nodes.clear();
+    trianglePacks.clear();
+    bounds = AABB();
+    depth = 0;
+
+    BVH bvh;
+    bvh.build( positions, indices );
+    const std::vector<BVHNode>& binaryNodes = bvh.getNodes();
+    if( binaryNodes.empty() )
+        return;
+
+    CollapseContext context{ binaryNodes, bvh.getTriangleIndices(), positions, indices };
+    context.subtreeFirst.resize( binaryNodes.size() );
+    context.subtreeCount.resize( binaryNodes.size() );
+
+    // Children always come after their parent in the depth-first layout
+    for( uint32 index = static_cast< uint32 >( binaryNodes.size() ); index-- > 0; )
+    {
+        const BVHNode& node = binaryNodes[ index ];
+        if( node.isLeaf() )
+        {
+            context.subtreeFirst[ index ] = node.rightOrFirst;
+            context.subtreeCount[ index ] = node.triangleCount;
+        }
+        else
+        {
+            context.subtreeFirst[ index ] = context.subtreeFirst[ index + 1 ];
+            context.subtreeCount[ index ] = context.subtreeCount[ index + 1 ] + context.subtreeCount[ node.rightOrFirst ];
+        }
+    }
+
+    bounds = bvh.getBounds();
+    nodes.reserve( binaryNodes.size() / 4 + 1 );
+    trianglePacks.reserve( binaryNodes.size() / 2 + 1 );
+    collapse( context, 0, 1 );
+}
+
+ESimdLevel WideBVH::getSimdLevel()
+{
+    static const ESimdLevel level = isAVX2Supported() ? SL_AVX2 : SL_SSE;
+    return level;
+}
+
+bool WideBVH::intersect( const WideRay& ray, WideHit& outHit ) const
+{
+    if( nodes.empty() )
+        return false;
+
+    static const auto kernel = getSimdLevel() == SL_AVX2 ? intersectWideBVH_AVX2 : intersectWideBVH_SSE;
+    if( getStackSize() > WIDE_BVH_STACK_SIZE )
+        return kernel( nodes.data(), trianglePacks.data(), ray, getHeapStack( getStackSize() ), outHit );
+
+    WideStackEntry stack[ WIDE_BVH_STACK_SIZE ];
+    return kernel( nodes.data(), trianglePacks.data(), ray, stack, outHit );
+}
+
+bool WideBVH::occluded( const WideRay& ray ) const
+{
+    if( nodes.empty() )
+        return false;
+
+    static const auto kernel = getSimdLevel() == SL_AVX2 ? occludedWideBVH_AVX2 : occludedWideBVH_SSE;
+    if( getStackSize() > WIDE_BVH_STACK_SIZE )
+        return kernel( nodes.data(), trianglePacks.data(), ray, getHeapStack( getStackSize() ) );
+
+    WideStackEntry stack[ WIDE_BVH_STACK_SIZE ];
+    return kernel( nodes.data(), trianglePacks.data(), ray, stack );
+}
+
+uint32 WideBVH::collapse( const CollapseContext& context, uint32 binaryIndex, uint32 nodeDepth )
+{
+    const std::vector<BVHNode>& binaryNodes = context.binaryNodes;
+    depth = std::max( depth, nodeDepth );
+
+    // Keep opening the largest inner child until all slots are used, so one wide node replaces about three binary levels
+    uint32 children[ WIDE_BVH_WIDTH ];
+    uint32 childCount = 0;
+    if( context.isLeaf( binaryIndex ) )
+    {
+        children[ childCount++ ] = binaryIndex;
+    }
+    else
+    {
+        children[ childCount++ ] = binaryIndex + 1;
+        children[ childCount++ ] = binaryNodes[ binaryIndex ].rightOrFirst;
+    }
+
+    while( childCount < WIDE_BVH_WIDTH )
+    {
+        int32 bestSlot = -1;
+        float bestArea = -1.0f;
+        for( uint32 slot = 0; slot < childCount; ++slot )
+        {
+            if( context.isLeaf( children[ slot ] ) )
+                continue;
+
+            const BVHNode& child = binaryNodes[ children[ slot ] ];
+            const float area = AABB{ child.boundsMin, child.boundsMax }.surfaceArea();
+            if( area > bestArea )
+            {
+                bestArea = area;
+                bestSlot = slot;
+            }
+        }
+
+        if( bestSlot < 0 )
+            break;
+
+        const uint32 opened = children[ bestSlot ];
+        children[ bestSlot ] = opened + 1;
+        children[ childCount++ ] = binaryNodes[ opened ].rightOrFirst;
+    }
+
+    const uint32 wideIndex = static_cast< uint32 >( nodes.size() );
+    nodes.emplace_back();
+
+    for( uint32 slot = 0; slot < WIDE_BVH_WIDTH; ++slot )
+    {
+        if( slot >= childCount )
+        {
+            // Inverted bounds, the near plane is always behind the far plane so the slot is never hit
+            BVH8Node& node = nodes[ wideIndex ];
+            for( uint32 axis = 0; axis < 3; ++axis )
+            {
+                node.bounds[ axis ][ slot ] = FLT_MAX;
+                node.bounds[ axis + 3 ][ slot ] = -FLT_MAX;
+            }
+            node.children[ slot ] = WIDE_BVH_EMPTY;
+            continue;
+        }
+
+        // Recursion grows nodes, so the node is only looked up after the child is emitted
+        const uint32 encoded = context.isLeaf( children[ slot ] )
+            ? emitLeaf( context, children[ slot ] )
+            : collapse( context, children[ slot ], nodeDepth + 1 );
+
+        const BVHNode& child = binaryNodes[ children[ slot ] ];
+        BVH8Node& node = nodes[ wideIndex ];
+        node.bounds[ 0 ][ slot ] = child.boundsMin.x;
+        node.bounds[ 1 ][ slot ] = child.boundsMin.y;
+        node.bounds[ 2 ][ slot ] = child.boundsMin.z;
+        node.bounds[ 3 ][ slot ] = child.boundsMax.x;
+        node.bounds[ 4 ][ slot ] = child.boundsMax.y;
+        node.bounds[ 5 ][ slot ] = child.boundsMax.z;
+        node.children[ slot ] = encoded;
+    }
+
+    return wideIndex;
+}
+
+uint32 WideBVH::emitLeaf( const CollapseContext& context, uint32 binaryIndex )
+{
+    const uint32 first = context.subtreeFirst[ binaryIndex ];
+    const uint32 count = context.subtreeCount[ binaryIndex ];
+    const uint32 firstPack = static_cast< uint32 >( trianglePacks.size() );
+    const uint32 packCount = ( count + 3 ) / 4;
+    assert( packCount <= 8 && firstPack <= WIDE_BVH_PACK_INDEX_MASK );
+
+    for( uint32 packIndex = 0; packIndex < packCount; ++packIndex )
+    {
+        TrianglePack4& pack = trianglePacks.emplace_back();
+        for( uint32 lane = 0; lane < 4; ++lane )
+        {
+            const uint32 leafIndex = packIndex * 4 + lane;
+            if( leafIndex >= count )
+            {
+                pack.triangleIndices[ lane ] = WIDE_BVH_EMPTY;
+                continue;
+            }
+
+            const uint32 triangleIndex = context.triangleIndices[ first + leafIndex ];
+            const VertexPosition& p0 = context.positions[ context.indices[ triangleIndex * 3 + 0 ] ];
+            const VertexPosition& p1 = context.positions[ context.indices[ triangleIndex * 3 + 1 ] ];
+            const VertexPosition& p2 = context.positions[ context.indices[ triangleIndex * 3 + 2 ] ];
+
+            pack.v0[ 0 ][ lane ] = p0.x;
+            pack.v0[ 1 ][ lane ] = p0.y;
+            pack.v0[ 2 ][ lane ] = p0.z;
+            pack.e1[ 0 ][ lane ] = p1.x - p0.x;
+            pack.e1[ 1 ][ lane ] = p1.y - p0.y;
+            pack.e1[ 2 ][ lane ] = p1.z - p0.z;
+            pack.e2[ 0 ][ lane ] = p2.x - p0.x;
+            pack.e2[ 1 ][ lane ] = p2.y - p0.y;
+            pack.e2[ 2 ][ lane ] = p2.z - p0.z;
+            pack.triangleIndices[ lane ] = triangleIndex;
+        }
+    }
+
+    return WIDE_BVH_LEAF_BIT | ( ( packCount - 1 ) << WIDE_BVH_PACK_COUNT_SHIFT ) | firstPack;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "EngineTypes.h"
+#include "BVH.h"
+#include <vector>
+
+namespace A3
+{
+struct MeshResource;
+struct VertexPosition;
+
+constexpr uint32 WIDE_BVH_WIDTH = 8;
+
+// Traversal stack kept on the call stack, deeper trees fall back to a per-thread heap stack
+constexpr uint32 WIDE_BVH_STACK_SIZE = 256;
+
+// Child bounds are stored SoA, one row per plane ( minX, minY, minZ, maxX, maxY, maxZ ),
+// so a single AVX2 register holds the same plane of all 8 children
+struct alignas( 32 ) BVH8Node
+{
+    float bounds[ 6 ][ WIDE_BVH_WIDTH ];
+    uint32 children[ WIDE_BVH_WIDTH ];
+};
+static_assert( sizeof( BVH8Node ) == 224, "BVH8Node must stay 224 bytes" );
+
+// Child encoding of BVH8Node::children
+constexpr uint32 WIDE_BVH_EMPTY = 0xFFFFFFFF;
+constexpr uint32 WIDE_BVH_LEAF_BIT = 0x80000000;
+constexpr uint32 WIDE_BVH_PACK_COUNT_SHIFT = 28;   // Bits 28..30 hold the pack count - 1 of a leaf
+constexpr uint32 WIDE_BVH_PACK_INDEX_MASK = 0x0FFFFFFF;
+
+// Four triangles in SoA layout, precomputed for Moller-Trumbore.
+// Unused lanes are degenerate ( zero edges ) and never report a hit.
+struct alignas( 16 ) TrianglePack4
+{
+    float v0[ 3 ][ 4 ];
+    float e1[ 3 ][ 4 ];
+    float e2[ 3 ][ 4 ];
+    uint32 triangleIndices[ 4 ];
+};
+
+struct WideRay
+{
+    float origin[ 3 ];
+    float direction[ 3 ];
+    float tMin;
+    float tMax;
+};
+
+struct WideHit
+{
+    float t;
+    float u;
+    float v;
+    uint32 triangleIndex;
+};
+
+struct WideStackEntry
+{
+    uint32 child;
+    float tNear;
+};
+
+enum ESimdLevel
+{
+    SL_SSE,
+    SL_AVX2,
+};
+
+// 8-wide BVH collapsed from the binary SAH BVH, for CPU ray casts over MeshResource triangles.
+// Traversal tests all 8 children of a node at once ( AVX2, or two SSE halves ) and 4 triangles per leaf pack,
+// the kernel is selected once at runtime from the capabilities of the CPU.
+class WideBVH
+{
+public:
+    void build( const MeshResource& mesh );
+    void build( const std::vector<VertexPosition>& positions, const std::vector<uint32>& indices );
+
+    // Closest hit in [ray.tMin, ray.tMax], barycentrics match the GPU hit attributes
+    bool intersect( const WideRay& ray, WideHit& outHit ) const;
+    bool occluded( const WideRay& ray ) const;
+
+    const std::vector<BVH8Node>& getNodes() const { return nodes; }
+    const std::vector<TrianglePack4>& getTrianglePacks() const { return trianglePacks; }
+    AABB getBounds() const { return bounds; }
+
+    // Every level pops one node and pushes at most WIDE_BVH_WIDTH children, so this bounds the traversal stack
+    uint32 getStackSize() const { return ( WIDE_BVH_WIDTH - 1 ) * depth + 1; }
+
+    static ESimdLevel getSimdLevel();
+
+private:
+    struct CollapseContext;
+
+    uint32 collapse( const CollapseContext& context, uint32 binaryIndex, uint32 nodeDepth );
+    uint32 emitLeaf( const CollapseContext& context, uint32 binaryIndex );
+
+private:
+    std::vector<BVH8Node> nodes;
+    std::vector<TrianglePack4> trianglePacks;
+    AABB bounds;
+    uint32 depth = 0;   // Levels of wide nodes
+};
+}
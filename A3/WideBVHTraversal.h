@@ -0,0 +1,231 @@
+#pragma once
+
+// Traversal kernels of WideBVH, shared by WideBVH.cpp ( SSE ) and WideBVH_AVX2.cpp ( compiled with /arch:AVX2 ).
+// Only include this from those two files. Everything below the entry points lives in an unnamed namespace and
+// uses intrinsics and plain arithmetic only, so no inline function compiled for AVX2 can be picked by the linker
+// for the SSE path.
+
+#include "WideBVH.h"
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace A3
+{
+// stack must hold WideBVH::getStackSize() entries
+bool intersectWideBVH_SSE( const BVH8Node* nodes, const TrianglePack4* packs, const WideRay& ray, WideStackEntry* stack, WideHit& outHit );
+bool occludedWideBVH_SSE( const BVH8Node* nodes, const TrianglePack4* packs, const WideRay& ray, WideStackEntry* stack );
+
+bool intersectWideBVH_AVX2( const BVH8Node* nodes, const TrianglePack4* packs, const WideRay& ray, WideStackEntry* stack, WideHit& outHit );
+bool occludedWideBVH_AVX2( const BVH8Node* nodes, const TrianglePack4* packs, const WideRay& ray, WideStackEntry* stack );
+}
+
+namespace
+{
+using namespace A3;
+
+struct TraversalRay
+{
+    float origin[ 3 ];
+    float direction[ 3 ];
+    float invDir[ 3 ];
+    uint32 nearPlane[ 3 ];  // Row of BVH8Node::bounds the ray enters through on each axis
+    uint32 farPlane[ 3 ];
+    float tMin;
+};
+
+inline uint32 findFirstBit( uint32 mask )
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward( &index, mask );
+    return index;
+#else
+    return __builtin_ctz( mask );
+#endif
+}
+
+inline TraversalRay setupRay( const WideRay& ray )
+{
+    TraversalRay result;
+    for( uint32 axis = 0; axis < 3; ++axis )
+    {
+        float d = ray.direction[ axis ];
+        if( d < 1e-20f && d > -1e-20f )
+            d = d < 0.0f ? -1e-20f : 1e-20f;
+
+        result.origin[ axis ] = ray.origin[ axis ];
+        result.direction[ axis ] = ray.direction[ axis ];
+        result.invDir[ axis ] = 1.0f / d;
+        result.nearPlane[ axis ] = d < 0.0f ? axis + 3 : axis;
+        result.farPlane[ axis ] = d < 0.0f ? axis : axis + 3;
+    }
+    result.tMin = ray.tMin;
+    return result;
+}
+
+// Moller-Trumbore on 4 triangles, same tests as the scalar version of CPURenderBackend
+inline uint32 intersectPack( const TrianglePack4& pack, const TraversalRay& ray, float tMax, __m128& outT, __m128& outU, __m128& outV )
+{
+    const __m128 dx = _mm_set1_ps( ray.direction[ 0 ] );
+    const __m128 dy = _mm_set1_ps( ray.direction[ 1 ] );
+    const __m128 dz = _mm_set1_ps( ray.direction[ 2 ] );
+
+    const __m128 e1x = _mm_load_ps( pack.e1[ 0 ] );
+    const __m128 e1y = _mm_load_ps( pack.e1[ 1 ] );
+    const __m128 e1z = _mm_load_ps( pack.e1[ 2 ] );
+    const __m128 e2x = _mm_load_ps( pack.e2[ 0 ] );
+    const __m128 e2y = _mm_load_ps( pack.e2[ 1 ] );
+    const __m128 e2z = _mm_load_ps( pack.e2[ 2 ] );
+
+    const __m128 pvx = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+    const __m128 pvy = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+    const __m128 pvz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+    const __m128 det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, pvx ), _mm_mul_ps( e1y, pvy ) ), _mm_mul_ps( e1z, pvz ) );
+    const __m128 absDet = _mm_andnot_ps( _mm_set1_ps( -0.0f ), det );
+    __m128 valid = _mm_cmpge_ps( absDet, _mm_set1_ps( 1e-12f ) );
+    if( _mm_movemask_ps( valid ) == 0 )
+        return 0;
+
+    const __m128 invDet = _mm_div_ps( _mm_set1_ps( 1.0f ), det );
+    const __m128 tvx = _mm_sub_ps( _mm_set1_ps( ray.origin[ 0 ] ), _mm_load_ps( pack.v0[ 0 ] ) );
+    const __m128 tvy = _mm_sub_ps( _mm_set1_ps( ray.origin[ 1 ] ), _mm_load_ps( pack.v0[ 1 ] ) );
+    const __m128 tvz = _mm_sub_ps( _mm_set1_ps( ray.origin[ 2 ] ), _mm_load_ps( pack.v0[ 2 ] ) );
+
+    const __m128 u = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( tvx, pvx ), _mm_mul_ps( tvy, pvy ) ), _mm_mul_ps( tvz, pvz ) ), invDet );
+
+    const __m128 qvx = _mm_sub_ps( _mm_mul_ps( tvy, e1z ), _mm_mul_ps( tvz, e1y ) );
+    const __m128 qvy = _mm_sub_ps( _mm_mul_ps( tvz, e1x ), _mm_mul_ps( tvx, e1z ) );
+    const __m128 qvz = _mm_sub_ps( _mm_mul_ps( tvx, e1y ), _mm_mul_ps( tvy, e1x ) );
+    const __m128 v = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qvx ), _mm_mul_ps( dy, qvy ) ), _mm_mul_ps( dz, qvz ) ), invDet );
+    const __m128 t = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qvx ), _mm_mul_ps( e2y, qvy ) ), _mm_mul_ps( e2z, qvz ) ), invDet );
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps( 1.0f );
+    valid = _mm_and_ps( valid, _mm_and_ps( _mm_cmpge_ps( u, zero ), _mm_cmple_ps( u, one ) ) );
+    valid = _mm_and_ps( valid, _mm_and_ps( _mm_cmpge_ps( v, zero ), _mm_cmple_ps( _mm_add_ps( u, v ), one ) ) );
+    valid = _mm_and_ps( valid, _mm_and_ps( _mm_cmpge_ps( t, _mm_set1_ps( ray.tMin ) ), _mm_cmple_ps( t, _mm_set1_ps( tMax ) ) ) );
+
+    outT = t;
+    outU = u;
+    outV = v;
+    return static_cast< uint32 >( _mm_movemask_ps( valid ) );
+}
+
+template<typename BoxTest>
+bool intersectWide( const BVH8Node* nodes, const TrianglePack4* packs, const WideRay& wideRay, WideStackEntry* stack, WideHit& outHit )
+{
+    const TraversalRay ray = setupRay( wideRay );
+    float closestT = wideRay.tMax;
+    bool bHit = false;
+
+    uint32 stackSize = 0;
+    stack[ stackSize++ ] = { 0, ray.tMin };
+
+    alignas( 32 ) float tNear[ WIDE_BVH_WIDTH ];
+    while( stackSize > 0 )
+    {
+        const WideStackEntry entry = stack[ --stackSize ];
+        if( entry.tNear > closestT )
+            continue;
+
+        if( !( entry.child & WIDE_BVH_LEAF_BIT ) )
+        {
+            const BVH8Node& node = nodes[ entry.child ];
+            uint32 mask = BoxTest::test( node, ray, closestT, tNear );
+
+            // Sort the hit children far to near, so the nearest one is popped first
+            uint32 hitChildren[ WIDE_BVH_WIDTH ];
+            float hitT[ WIDE_BVH_WIDTH ];
+            uint32 hitCount = 0;
+            while( mask != 0 )
+            {
+                const uint32 slot = findFirstBit( mask );
+                mask &= mask - 1;
+
+                uint32 position = hitCount++;
+                while( position > 0 && hitT[ position - 1 ] < tNear[ slot ] )
+                {
+                    hitT[ position ] = hitT[ position - 1 ];
+                    hitChildren[ position ] = hitChildren[ position - 1 ];
+                    --position;
+                }
+                hitT[ position ] = tNear[ slot ];
+                hitChildren[ position ] = node.children[ slot ];
+            }
+
+            for( uint32 index = 0; index < hitCount; ++index )
+                stack[ stackSize++ ] = { hitChildren[ index ], hitT[ index ] };
+            continue;
+        }
+
+        const uint32 firstPack = entry.child & WIDE_BVH_PACK_INDEX_MASK;
+        const uint32 packCount = ( ( entry.child & ~WIDE_BVH_LEAF_BIT ) >> WIDE_BVH_PACK_COUNT_SHIFT ) + 1;
+        for( uint32 packIndex = firstPack; packIndex < firstPack + packCount; ++packIndex )
+        {
+            __m128 t, u, v;
+            uint32 mask = intersectPack( packs[ packIndex ], ray, closestT, t, u, v );
+            if( mask == 0 )
+                continue;
+
+            alignas( 16 ) float laneT[ 4 ], laneU[ 4 ], laneV[ 4 ];
+            _mm_store_ps( laneT, t );
+            _mm_store_ps( laneU, u );
+            _mm_store_ps( laneV, v );
+            while( mask != 0 )
+            {
+                const uint32 lane = findFirstBit( mask );
+                mask &= mask - 1;
+                if( laneT[ lane ] <= closestT )
+                {
+                    closestT = laneT[ lane ];
+                    outHit = { laneT[ lane ], laneU[ lane ], laneV[ lane ], packs[ packIndex ].triangleIndices[ lane ] };
+                    bHit = true;
+                }
+            }
+        }
+    }
+
+    return bHit;
+}
+
+template<typename BoxTest>
+bool occludedWide( const BVH8Node* nodes, const TrianglePack4* packs, const WideRay& wideRay, WideStackEntry* stack )
+{
+    const TraversalRay ray = setupRay( wideRay );
+    const float tMax = wideRay.tMax;
+
+    uint32 stackSize = 0;
+    stack[ stackSize++ ] = { 0, 0.0f };
+
+    alignas( 32 ) float tNear[ WIDE_BVH_WIDTH ];
+    while( stackSize > 0 )
+    {
+        const uint32 child = stack[ --stackSize ].child;
+        if( !( child & WIDE_BVH_LEAF_BIT ) )
+        {
+            const BVH8Node& node = nodes[ child ];
+            uint32 mask = BoxTest::test( node, ray, tMax, tNear );
+            while( mask != 0 )
+            {
+                stack[ stackSize++ ] = { node.children[ findFirstBit( mask ) ], 0.0f };
+                mask &= mask - 1;
+            }
+            continue;
+        }
+
+        const uint32 firstPack = child & WIDE_BVH_PACK_INDEX_MASK;
+        const uint32 packCount = ( ( child & ~WIDE_BVH_LEAF_BIT ) >> WIDE_BVH_PACK_COUNT_SHIFT ) + 1;
+        for( uint32 packIndex = firstPack; packIndex < firstPack + packCount; ++packIndex )
+        {
+            __m128 t, u, v;
+            if( intersectPack( packs[ packIndex ], ray, tMax, t, u, v ) != 0 )
+                return true;
+        }
+    }
+
+    return false;
+}
+}
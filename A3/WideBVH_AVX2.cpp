@@ -0,0 +1,43 @@
+// Compiled with /arch:AVX2, only called after WideBVH::getSimdLevel() has confirmed AVX2 and FMA support
+#include "WideBVHTraversal.h"
+
+using namespace A3;
+
+namespace
+{
+// Tests all 8 children with one register per plane
+struct BoxTestAVX2
+{
+    static uint32 test( const BVH8Node& node, const TraversalRay& ray, float tMax, float* outTNear )
+    {
+        const __m256 ox = _mm256_set1_ps( ray.origin[ 0 ] );
+        const __m256 oy = _mm256_set1_ps( ray.origin[ 1 ] );
+        const __m256 oz = _mm256_set1_ps( ray.origin[ 2 ] );
+        const __m256 ix = _mm256_set1_ps( ray.invDir[ 0 ] );
+        const __m256 iy = _mm256_set1_ps( ray.invDir[ 1 ] );
+        const __m256 iz = _mm256_set1_ps( ray.invDir[ 2 ] );
+
+        const __m256 nearX = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[ ray.nearPlane[ 0 ] ] ), ox ), ix );
+        const __m256 nearY = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[ ray.nearPlane[ 1 ] ] ), oy ), iy );
+        const __m256 nearZ = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[ ray.nearPlane[ 2 ] ] ), oz ), iz );
+        const __m256 farX = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[ ray.farPlane[ 0 ] ] ), ox ), ix );
+        const __m256 farY = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[ ray.farPlane[ 1 ] ] ), oy ), iy );
+        const __m256 farZ = _mm256_mul_ps( _mm256_sub_ps( _mm256_load_ps( node.bounds[ ray.farPlane[ 2 ] ] ), oz ), iz );
+
+        const __m256 tNear = _mm256_max_ps( _mm256_max_ps( nearX, nearY ), _mm256_max_ps( nearZ, _mm256_set1_ps( ray.tMin ) ) );
+        const __m256 tFar = _mm256_min_ps( _mm256_min_ps( farX, farY ), _mm256_min_ps( farZ, _mm256_set1_ps( tMax ) ) );
+        _mm256_store_ps( outTNear, tNear );
+        return static_cast< uint32 >( _mm256_movemask_ps( _mm256_cmp_ps( tNear, tFar, _CMP_LE_OQ ) ) );
+    }
+};
+}
+
+bool A3::intersectWideBVH_AVX2( const BVH8Node* nodes, const TrianglePack4* packs, const WideRay& ray, WideStackEntry* stack, WideHit& outHit )
+{
+    return intersectWide<BoxTestAVX2>( nodes, packs, ray, stack, outHit );
+}
+
+bool A3::occludedWideBVH_AVX2( const BVH8Node* nodes, const TrianglePack4* packs, const WideRay& ray, WideStackEntry* stack )
+{
+    return occludedWide<BoxTestAVX2>( nodes, packs, ray, stack );
+}
@@ -20,7 +20,6 @@ layout(buffer_reference, scalar) buffer cumulativeTriangleAreaBuffer { float t[]
 
 layout(binding = 4, std430) readonly buffer LightBuffer
 {
-    uint lightIndex[16];
     uint lightCount;
     uint pad1;
     uint pad2;
@@ -28,6 +27,12 @@ layout(binding = 4, std430) readonly buffer LightBuffer
     LightData lights[];
 } gLightBuffer;
 
+// Light of every instance, 0xFFFFFFFF for instances that do not emit
+layout(binding = 10, std430) readonly buffer InstanceLightBuffer
+{
+    uint lightIndex[];
+} gInstanceLights;
+
 layout( binding = 5, rgba32f ) uniform image2D accumulationImage;
 layout( binding = 6 ) uniform sampler2D environmentMap;
 layout( binding = 7 ) uniform imguiParam {
@@ -35,7 +40,10 @@ layout( binding = 7 ) uniform imguiParam {
 	uint numSamples;
     uint isProgressive;
     float envmapRotDeg;
+    uint rouletteMinDepth;
 } gImguiParam;
 
-layout( binding = 8 ) uniform sampler2D envImportanceData;
-layout( binding = 9 ) uniform sampler2D envHitPdf;
\ No newline at end of file
+layout( binding = 8, scalar ) readonly buffer EnvAliasTable
+{
+    EnvAliasEntry entries[];
+} gEnvAliasTable;
\ No newline at end of file
@@ -1,36 +1,45 @@
-float getLightArea() 
+const uint INVALID_LIGHT_INDEX = 0xFFFFFFFFu;
+
+// Picks a light in proportion to its power through the alias table, a single light consumes no random numbers
+uint sampleLightIndex(inout uint rngState)
 {
-	ObjectDesc lightObjDesc = gObjectDescs.desc[gLightBuffer.lightIndex[0]];
-	cumulativeTriangleAreaBuffer sum = cumulativeTriangleAreaBuffer(lightObjDesc.cumulativeTriangleAreaAddress);
+	const uint lightCount = gLightBuffer.lightCount;
+	if (lightCount <= 1)
+		return 0;
 
-	return sum.t[gLightBuffer.lights[0].triangleCount];
+	uint lightIdx = min(uint(random(rngState) * lightCount), lightCount - 1);
+	if (random(rngState) >= gLightBuffer.lights[lightIdx].selectionThreshold)
+		lightIdx = gLightBuffer.lights[lightIdx].selectionAlias;
+	return lightIdx;
 }
 
-uint binarySearchTriangleIdx(const float lightArea, inout uint rngState) 
+uint binarySearchTriangleIdx(const uint lightIdx, const float lightArea, inout uint rngState) 
 {
-	ObjectDesc lightObjDesc = gObjectDescs.desc[gLightBuffer.lightIndex[0]];
+	ObjectDesc lightObjDesc = gObjectDescs.desc[gLightBuffer.lights[lightIdx].instanceIndex];
 	cumulativeTriangleAreaBuffer sum = cumulativeTriangleAreaBuffer(lightObjDesc.cumulativeTriangleAreaAddress);
 	float target = random(rngState) * lightArea;
 
 	uint l = 1;
-	uint r = gLightBuffer.lights[0].triangleCount;
+	uint r = gLightBuffer.lights[lightIdx].triangleCount;
 	while (l <= r) {
 		uint mid = l + ((r - l) / 2);
 		if (sum.t[mid - 1] < target && target <= sum.t[mid])
-			return mid;
+			return mid - 1;
 		else if (target > sum.t[mid]) l = mid + 1;
 		else r = mid - 1;
 	}
+	return 0;
 }
 
-void uniformSamplePointOnTriangle(uint triangleIdx, 
+void uniformSamplePointOnTriangle(uint lightIdx,
+								  uint triangleIdx, 
 								  out vec3 pointOnTriangle, 
 								  out vec3 normalOnTriangle, 
 								  out vec3 pointOnTriangleWorld, 
 								  out vec3 normalOnTriangleWorld, 
                                   inout uint rngState) 
 {
-	ObjectDesc lightObjDesc = gObjectDescs.desc[gLightBuffer.lightIndex[0]];
+	ObjectDesc lightObjDesc = gObjectDescs.desc[gLightBuffer.lights[lightIdx].instanceIndex];
 
 	IndexBuffer lightIndexBuffer = IndexBuffer(lightObjDesc.indexDeviceAddress);
 	uint base = triangleIdx * 3u;
@@ -60,7 +69,7 @@ void uniformSamplePointOnTriangle(uint triangleIdx,
 	pointOnTriangle = (w * p0 + u * p1 + v * p2).xyz;
 	normalOnTriangle = normalize(w * n0 + u * n1 + v * n2).xyz;
 
-    mat4 localToWorld = transpose(gLightBuffer.lights[0].transform);
+    mat4 localToWorld = transpose(gLightBuffer.lights[lightIdx].transform);
     pointOnTriangleWorld = (localToWorld * vec4(pointOnTriangle, 1.0f)).xyz;
 	normalOnTriangleWorld = normalize(localToWorld * vec4(normalOnTriangle, 0.0f)).xyz;
 }    
\ No newline at end of file
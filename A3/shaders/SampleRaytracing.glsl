@@ -7,8 +7,7 @@
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
 
 #define PI 3.1415926535897932384626433832795
-#define ENV_MISS_IDX 0
-#define SHADOW_MISS_IDX 1
+#define MISS_IDX 0
 #define MIRROR_ROUGH 0.015
 #define INF_CLAMP 1e30
 
@@ -18,524 +17,329 @@
 #include "shaders/NEELightSampling.glsl"
 #include "shaders/BRDF.glsl"
 
-#if RAY_GENERATION_SHADER
 //=========================
-//   RAY GENERATION SHADER
+//   INTEGRATOR OPTIONS
 //=========================
-layout(location = 0) rayPayloadEXT RayPayload gPayload;
-void main()
-{
-    const vec3 cameraX = vec3( 1, 0, 0 );
-    const vec3 cameraY = vec3( 0, -1, 0 );
-    const vec3 cameraZ = vec3( 0, 0, -1 );
-    const float aspect_y = tan( radians( g.yFov_degree ) * 0.5 );
-    const float aspect_x = aspect_y * float( gl_LaunchSizeEXT.x ) / float( gl_LaunchSizeEXT.y );
-    
-    // Better random seed generation
-    uint pixelIndex = gl_LaunchIDEXT.y * gl_LaunchSizeEXT.x + gl_LaunchIDEXT.x;
-    uint seed = pixelIndex;
-    if (gImguiParam.isProgressive != 0u)
-        seed = pixelIndex + g.currentFrame * 1664525u;
-    uint rngState = pcg_hash(seed);
-    
-    // Anti-aliasing jitter
-    float r1 = random(rngState);
-    float r2 = random(rngState);
-    
-    const vec2 screenCoord = vec2( gl_LaunchIDEXT.xy ) + vec2( r1, r2 );
-    const vec2 ndc = screenCoord / vec2( gl_LaunchSizeEXT.xy ) * 2.0 - 1.0;
-    vec3 rayDir = ndc.x * aspect_x * cameraX + ndc.y * aspect_y * cameraY + cameraZ;
-    
-    // Initialize payload for path tracing
-    gPayload.radiance = vec3( 0.0 );
-    gPayload.depth = 0;
-    gPayload.desiredPosition = vec3( 0.0 );
-    gPayload.rngState = rngState;
-    gPayload.rayDirection = normalize(rayDir);
-    gPayload.pdfBRDF = 0.0;
-    gPayload.visibility = 1.0;
-    
-    // Single ray per pixel per frame
-    traceRayEXT(
-       topLevelAS,
-       gl_RayFlagsOpaqueEXT, 0xff,
-       0, 1, ENV_MISS_IDX,
-       g.cameraPos, 0.0, rayDir, 100.0,
-       0 );
-    
-    vec3 currentSample = gPayload.radiance;
-    
-    vec3 finalColor = currentSample;
-    if ( gImguiParam.isProgressive != 0u ) {
-        // Progressive accumulation
-        vec3 previousAccumulation = vec3(0.0);
-        if (g.currentFrame > 1) {
-            previousAccumulation = imageLoad(accumulationImage, ivec2(gl_LaunchIDEXT.xy)).rgb;
-        }
-        
-        // Proper incremental average
-        vec3 accumulated = (previousAccumulation * float(g.currentFrame - 1) + currentSample) / float(g.currentFrame);
-        
-        // Store in accumulation buffer
-        imageStore(accumulationImage, ivec2(gl_LaunchIDEXT.xy), vec4(accumulated, 1.0));
-        finalColor = accumulated;
-    }
-
-    vec3 finalfinalColor = pow(1.0 - exp(-g.exposure * finalColor), vec3(1/2.2, 1/2.2, 1/2.2)); // simple gamma correction
-
-    // bool isinfcolor = isinf(finalfinalColor.x) || isinf(finalfinalColor.y) || isinf(finalfinalColor.z);
-    // if (isinfcolor) finalfinalColor = vec3(1.0);
-    // else finalfinalColor = vec3(0.0);
+// Specialization constants, one SPIR-V module per stage serves every integrator. The values are set per pipeline,
+// constant_id matches ESpecializationConstant and the branches on them are folded by the driver.
+#define LIGHT_SAMPLING_BRUTE_FORCE 0
+#define LIGHT_SAMPLING_NEE 1
+#define LIGHT_SELECTION_LIGHT_ONLY 0
+#define LIGHT_SELECTION_ENV_MAP 1
 
-    // bool isnancolor = isnan(finalfinalColor.x) || isnan(finalfinalColor.y) || isnan(finalfinalColor.z);
-    // if (isnancolor) finalfinalColor = vec3(1.0);
-    // else finalfinalColor = vec3(0.0);
-
-    imageStore( image, ivec2( gl_LaunchIDEXT.xy ), vec4( finalfinalColor, 1.0 ) );
-}
-#endif
+layout( constant_id = 0 ) const uint LIGHT_SAMPLING_MODE = LIGHT_SAMPLING_BRUTE_FORCE;
+layout( constant_id = 1 ) const uint LIGHT_SELECTION = LIGHT_SELECTION_LIGHT_ONLY;
 
-#if BRUTE_FORCE_LIGHT_ONLY_CLOSEST_HIT_SHADER
+#if RAY_GENERATION_SHADER
 //=========================
-//   BRUTE FORCE LIGHT ONLY CLOSEST HIT SHADER
+//   RAY GENERATION SHADER
 //=========================
+// Iterative path tracer. The bounce loop lives here with the path throughput, closest hit only returns the surface
+// and shadow rays are ray queries, so the pipeline never recurses.
+layout(location = 0) rayPayloadEXT HitPayload gHit;
 
-layout( shaderRecordEXT ) buffer CustomData
+// Sampled continuation of the path at a surface
+struct BounceSample
 {
-   vec3 color;
-   float metallic;
-   float roughness;
-} gCustomData;
-
-layout(location = 0) rayPayloadInEXT RayPayload gPayload;
-hitAttributeEXT vec2 attribs;
+    vec3 rayDir;
+    vec3 throughput;    // brdf * cos / pdf, including the MIS weight between the GGX and cosine strategies
+    float pdfBRDF;      // pdf handed to the environment MIS on a miss
+};
 
-void main()
+bool isVisible(vec3 origin, vec3 rayDir, float tMin, float tMax)
 {
-    ObjectDesc objDesc = gObjectDescs.desc[gl_InstanceCustomIndexEXT];
+    rayQueryEXT rayQuery;
+    rayQueryInitializeEXT(rayQuery, topLevelAS, gl_RayFlagsOpaqueEXT | gl_RayFlagsTerminateOnFirstHitEXT, 0xff, origin, tMin, rayDir, tMax);
+    while (rayQueryProceedEXT(rayQuery)) {}
 
-    IndexBuffer indexBuffer = IndexBuffer(objDesc.indexDeviceAddress);
-    uint base = gl_PrimitiveID * 3u;
-    uvec3 index = uvec3(indexBuffer.i[base + 0], 
-                        indexBuffer.i[base + 1], 
-                        indexBuffer.i[base + 2]);
+    return rayQueryGetIntersectionTypeEXT(rayQuery, true) == gl_RayQueryCommittedIntersectionNoneEXT;
+}
 
-    PositionBuffer positionBuffer = PositionBuffer(objDesc.vertexPositionDeviceAddress);
-    vec3 p0 = positionBuffer.p[index.x].xyz;
-    vec3 p1 = positionBuffer.p[index.y].xyz;
-    vec3 p2 = positionBuffer.p[index.z].xyz;
+// Picks GGX VNDF or cosine hemisphere sampling with a roughness dependent probability
+BounceSample sampleBounce(vec3 worldNormal, vec3 viewDir, vec3 color, float metallic, float roughness, inout uint rngState)
+{
+    const float alpha = roughness * roughness;
+    const float prob = mix(0.2, 0.8, roughness);
+    const float probGGX = (1 - prob);
+    const float probCos = prob;
 
-    float u = attribs.x;
-    float v = attribs.y;
-    float w = 1.0 - u - v;
-    vec3 position = w * p0 + u * p1 + v * p2;
+    vec3 rayDir = vec3(0.0);
+    vec3 halfDir = vec3(0.0);
 
-    AttributeBuffer attrBuf = AttributeBuffer(objDesc.vertexAttributeDeviceAddress);
-    vec3 n0 = normalize(attrBuf.a[index.x].norm.xyz);
-    vec3 n1 = normalize(attrBuf.a[index.y].norm.xyz);
-    vec3 n2 = normalize(attrBuf.a[index.z].norm.xyz);
-    vec3 normal = normalize(w * n0 + u * n1 + v * n2);
+    float a = random(rngState);
+    float r3 = random(rngState);
+    float r4 = random(rngState);
+    vec2 seed = vec2(r3, r4);
 
-    vec3 worldPos = (gl_ObjectToWorldEXT * vec4(position, 1.0)).xyz;
-    vec3 worldNormal = normalize(transpose(inverse(mat3(gl_ObjectToWorldEXT))) * normal);
+    bool isGGX = (a >= prob);
+    float pdfGGXVal = 0.0;
+    float pdfCosineVal = 0.0;
 
-    LightData light = gLightBuffer.lights[0];
+    if (isGGX) {
+        mat3 TBN = computeTBN(worldNormal);
+        vec3 viewDirLocal = normalize(transpose(TBN) * viewDir); // viewDir -> world2local
+        vec3 halfDirLocal = sampleGGXVNDF(viewDirLocal, alpha, alpha, seed);
+        halfDir = normalize(TBN * halfDirLocal);  // halfDir local -> world
+        rayDir = reflect(-viewDir, halfDir);
 
-    const vec3 lightEmittance = vec3(light.emittance); // emittance per point
+        pdfGGXVal = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
+        pdfCosineVal = max(dot(worldNormal, rayDir), 1e-6) / PI;
+    }
+    else {
+        rayDir = RandomCosineHemisphere(worldNormal, seed);
+        pdfCosineVal = max(dot(worldNormal, rayDir), 1e-6) / PI;
 
-    const vec3 color = gCustomData.color;
-    const float metallic = clamp(gCustomData.metallic, 0.0, 1.0);
-    const float roughness = clamp(gCustomData.roughness, MIRROR_ROUGH, 1.0);
-    const float alpha = roughness * roughness;
+        halfDir = normalize(viewDir + rayDir);
+        pdfGGXVal = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
+    }
 
-    const float prob = mix(0.2, 0.8, roughness);
-    const float probGGX = (1 - prob);
-    const float probCos = prob;    
-
-    vec3 emit = vec3(0.0);
-    if (gl_InstanceCustomIndexEXT == gLightBuffer.lightIndex[0])
-        emit = lightEmittance;
-
-    uint tempDepth = gPayload.depth;
-    uint numSampleByDepth = (gPayload.depth == 0 ? gImguiParam.numSamples : 1);
-
-    vec3 temp = vec3(0.0);
-    if (gPayload.depth < gImguiParam.maxDepth) {
-        for (uint i=0; i < numSampleByDepth; ++i) {
-            const vec3 viewDir = -gPayload.rayDirection;
-            vec3 rayDir = vec3(0.0);
-            vec3 halfDir = vec3(0.0);
-
-            float pdfSel = 1.0;
-            float weight = 1.0;
-            vec3 brdf = vec3(0.0);
-
-            float a = random(gPayload.rngState);
-            float r3 = random(gPayload.rngState);
-            float r4 = random(gPayload.rngState);
-            vec2 seed = vec2(r3, r4);
-
-            bool isGGX = (a >= prob);
-            float pdfGGXVal = 0.0;
-            float pdfCosineVal = 0.0;
-
-            if (isGGX) {
-                mat3 TBN = computeTBN(worldNormal);
-                vec3 viewDirLocal = normalize(transpose(TBN) * viewDir); // viewDir -> world2local
-                vec3 halfDirLocal = sampleGGXVNDF(viewDirLocal, alpha, alpha, seed);
-                halfDir = normalize(TBN * halfDirLocal);  // halfDir local -> world
-                rayDir = reflect(-viewDir, halfDir);
-
-                pdfGGXVal = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
-                pdfCosineVal = max(dot(worldNormal, rayDir), 1e-6) / PI;
-            } else {
-                rayDir = RandomCosineHemisphere(worldNormal, seed);
-                pdfCosineVal = max(dot(worldNormal, rayDir), 1e-6) / PI;
-
-                halfDir = normalize(viewDir + rayDir);
-                pdfGGXVal = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
-            }
+    const vec3 brdf = calculateBRDF(worldNormal, viewDir, rayDir, halfDir, color, metallic, alpha);
+    const float cos_p = max(dot(worldNormal, rayDir), 1e-6);
 
-            pdfGGXVal = probGGX * pdfGGXVal;
-            pdfCosineVal = probCos * pdfCosineVal;
-
-            weight = isGGX ? powerHeuristic(pdfGGXVal, pdfCosineVal) 
-                            : powerHeuristic(pdfCosineVal, pdfGGXVal);   
-            pdfSel = isGGX ? pdfGGXVal : pdfCosineVal;
-            // Cook-Torrance BRDF
-            brdf = calculateBRDF(worldNormal, viewDir, rayDir, halfDir, color, metallic, alpha);
-
-            gPayload.rayDirection = rayDir;
-            gPayload.depth++;
-            traceRayEXT(
-                topLevelAS,                         // topLevel
-                gl_RayFlagsOpaqueEXT, 0xff,         // rayFlags, cullMask
-                0, 1, SHADOW_MISS_IDX,              // sbtRecordOffset, sbtRecordStride, missIndex
-                worldPos, 0.0001, rayDir, 100.0,  	// origin, tmin, direction, tmax
-                0);                                 // payload 
-            gPayload.depth = tempDepth;
-
-            const float cos_p = max(dot(worldNormal, rayDir), 1e-6);
-            temp += brdf * gPayload.radiance * cos_p * weight / pdfSel;
-        }
-        temp *= 1.0 / float(numSampleByDepth);
+    BounceSample bounce;
+    bounce.rayDir = rayDir;
+    if (LIGHT_SAMPLING_MODE == LIGHT_SAMPLING_BRUTE_FORCE && LIGHT_SELECTION == LIGHT_SELECTION_ENV_MAP) {
+        // Mixture pdf of both strategies
+        bounce.pdfBRDF = probGGX * pdfGGXVal + probCos * pdfCosineVal;
+        bounce.throughput = brdf * cos_p / bounce.pdfBRDF;
     }
-    gPayload.radiance = emit + temp;
-}
-#endif
-
-#if NEE_LIGHT_ONLY_CLOSEST_HIT_SHADER
-//=========================
-//   NEE LIGHT ONLY CLOSEST HIT SHADER
-//=========================
+    else {
+        pdfGGXVal = probGGX * pdfGGXVal;
+        pdfCosineVal = probCos * pdfCosineVal;
 
-layout( shaderRecordEXT ) buffer CustomData
-{
-   vec3 color;
-   float metallic;
-   float roughness;
-} gCustomData;
+        const float weight = isGGX ? powerHeuristic(pdfGGXVal, pdfCosineVal)
+                                   : powerHeuristic(pdfCosineVal, pdfGGXVal);
+        bounce.pdfBRDF = isGGX ? pdfGGXVal : pdfCosineVal;
+        bounce.throughput = brdf * cos_p * weight / bounce.pdfBRDF;
+    }
 
-layout(location = 0) rayPayloadInEXT RayPayload gPayload;
-hitAttributeEXT vec2 attribs;
+    return bounce;
+}
 
-void main()
+// One light sample on an area light picked by power, MIS weighted against the BRDF strategies
+vec3 sampleLightDirect(vec3 worldPos, vec3 worldNormal, vec3 viewDir, vec3 color, float metallic, float roughness, inout uint rngState)
 {
-    ObjectDesc objDesc = gObjectDescs.desc[gl_InstanceCustomIndexEXT];
+    const float alpha = roughness * roughness;
+    const float prob = mix(0.2, 0.8, roughness);
+    const float probGGX = (1 - prob);
+    const float probCos = prob;
 
-    IndexBuffer indexBuffer = IndexBuffer(objDesc.indexDeviceAddress);
+    if (gLightBuffer.lightCount == 0)
+        return vec3(0.0);
 
-    uint base = gl_PrimitiveID * 3u;
-    uvec3 index = uvec3(indexBuffer.i[base + 0], 
-                        indexBuffer.i[base + 1], 
-                        indexBuffer.i[base + 2]);
+    const uint lightIdx = sampleLightIndex(rngState);
+    const vec3 lightEmittance = vec3(gLightBuffer.lights[lightIdx].emittance);
+    const float lightArea = gLightBuffer.lights[lightIdx].area;
+    uint triangleIdx = binarySearchTriangleIdx(lightIdx, lightArea, rngState);
 
-    PositionBuffer positionBuffer = PositionBuffer(objDesc.vertexPositionDeviceAddress);
-    vec3 p0 = positionBuffer.p[index.x].xyz;
-    vec3 p1 = positionBuffer.p[index.y].xyz;
-    vec3 p2 = positionBuffer.p[index.z].xyz;
+    vec3 pointOnTriangle, normalOnTriangle, pointOnTriangleWorld, normalOnTriangleWorld;
+    uniformSamplePointOnTriangle(lightIdx,
+                                 triangleIdx,
+                                 pointOnTriangle,
+                                 normalOnTriangle,
+                                 pointOnTriangleWorld,
+                                 normalOnTriangleWorld,
+                                 rngState);
 
-    float u = attribs.x;
-    float v = attribs.y;
-    float w = 1.0 - u - v;
-    vec3 position = w * p0 + u * p1 + v * p2;
+    const vec3 r = pointOnTriangleWorld - worldPos;
+    const float distance = length(r);
+    const vec3 shadowRayDir = r / distance;
 
-    AttributeBuffer attrBuf = AttributeBuffer(objDesc.vertexAttributeDeviceAddress);
-    vec3 n0 = normalize(attrBuf.a[index.x].norm.xyz);
-    vec3 n1 = normalize(attrBuf.a[index.y].norm.xyz);
-    vec3 n2 = normalize(attrBuf.a[index.z].norm.xyz);
-    vec3 normal = normalize(w * n0 + u * n1 + v * n2);
+    // The sampled point is visible when nothing is hit before reaching it
+    const float visibility = isVisible(worldPos, shadowRayDir, 0.001, max(distance - 0.001, 0.001)) ? 1.0 : 0.0;
 
-    vec3 worldPos = (gl_ObjectToWorldEXT * vec4(position, 1.0)).xyz;
-    vec3 worldNormal = normalize(transpose(inverse(mat3(gl_ObjectToWorldEXT))) * normal);
+    const float cos_q = max(dot(normalOnTriangleWorld, -shadowRayDir), 1e-6);
+    const float cos_p = max(dot(worldNormal, shadowRayDir), 1e-6);
+    const float pdfLight = gLightBuffer.lights[lightIdx].selectionPdf * dot(r, r) / (cos_q * lightArea);
 
-    LightData light = gLightBuffer.lights[0];
+    // Cook-Torrance BRDF
+    vec3 halfDir = normalize(viewDir + shadowRayDir);
+    vec3 brdf = calculateBRDF(worldNormal, viewDir, shadowRayDir, halfDir, color, metallic, alpha);
 
-	const float eps = 1e-4;
-    const vec3 lightEmittance = vec3(light.emittance);
-    const float lightArea = getLightArea();
+    float pdfGGX = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
+    float pdfCos = cos_p / PI;
+    float pdfBRDF = probGGX * pdfGGX + probCos * pdfCos;
 
-    if (gl_InstanceCustomIndexEXT == gLightBuffer.lightIndex[0]) {
-        if (gPayload.depth == 0)
-            gPayload.radiance = lightEmittance;
-        else
-            gPayload.radiance = vec3(0.0);
-        return;
-    }
+    float w = powerHeuristic(pdfLight, pdfBRDF);
 
-	if (gPayload.depth >= gImguiParam.maxDepth) {
-        gPayload.radiance = vec3(0.0);
-		return;
-    }
+    return brdf * lightEmittance * visibility * cos_p * w / pdfLight;
+}
 
-    const vec3 color = gCustomData.color;
-    const float metallic = clamp(gCustomData.metallic, 0.0, 1.0);
-    const float roughness = clamp(gCustomData.roughness, MIRROR_ROUGH, 1.0);
+// One importance sampled environment direction, MIS weighted against the BRDF strategies
+vec3 sampleEnvironmentDirect(vec3 worldPos, vec3 worldNormal, vec3 viewDir, vec3 color, float metallic, float roughness, inout uint rngState)
+{
+    const float eps = 1e-4;
     const float alpha = roughness * roughness;
-
     const float prob = mix(0.2, 0.8, roughness);
     const float probGGX = (1 - prob);
     const float probCos = prob;
 
-    const vec3 viewDir = -gPayload.rayDirection;
+    float pdfEnv;
+    vec3 rayDir = sampleEnvDirection(rngState, pdfEnv);
 
-	//////////////////////////////////////////////////////////////// Direct Light
+    const float visibility = isVisible(worldPos, rayDir, eps, 100.0) ? 1.0 : 0.0;
+    const vec3 emit = getEmitFromEnvmap(rayDir);
 
-	vec3 tempRadianceD = vec3(0.0);
-	const uint numSampleByDepth = (gPayload.depth == 0 ? gImguiParam.numSamples : 1);
-	for (int i=0; i < numSampleByDepth; ++i) {
-        // NEE Sampling
-		uint triangleIdx = binarySearchTriangleIdx(lightArea, gPayload.rngState);
+    float cos_p = max(dot(worldNormal, rayDir), 1e-6);
+    // Cook-Torrance BRDF
+    vec3 halfDir = normalize(viewDir + rayDir);
+    vec3 brdf = calculateBRDF(worldNormal, viewDir, rayDir, halfDir, color, metallic, alpha);
 
-		vec3 pointOnTriangle, normalOnTriangle, pointOnTriangleWorld, normalOnTriangleWorld;
-		uniformSamplePointOnTriangle(triangleIdx, 
-									 pointOnTriangle, 
-									 normalOnTriangle, 
-									 pointOnTriangleWorld, 
-									 normalOnTriangleWorld, 
-                                     gPayload.rngState);
+    float pdfGGX = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
+    float pdfCos = cos_p / PI;
+    float pdfBRDF = probGGX * pdfGGX + probCos * pdfCos;
 
-		vec3 shadowRayDir = normalize(pointOnTriangleWorld - worldPos);
+    float w = powerHeuristic(pdfEnv, pdfBRDF);
 
-        gPayload.desiredPosition = vec3(0.0);
-        traceRayEXT(
-            topLevelAS,                          // topLevel
-            gl_RayFlagsNoOpaqueEXT | gl_RayFlagsSkipClosestHitShaderEXT, // rayFlags
-            0xff,                                // cullMask
-            0, 1, SHADOW_MISS_IDX,               // sbtRecordOffset, sbtRecordStride, missIndex
-            worldPos, 0.001f, shadowRayDir, 100.0,  // origin, tmin, direction, tmax
-            0);                                  // payload
-
-        float visibility = 0.0;    
-        if (length(gPayload.desiredPosition - pointOnTriangleWorld) < 0.0001)
-            visibility = 1.0;
-
-		const vec3 r = pointOnTriangleWorld - worldPos;
-		const float cos_q = max(dot(normalOnTriangleWorld, -shadowRayDir), 1e-6);
-        const float cos_p = max(dot(worldNormal, shadowRayDir), 1e-6);
-        const float pdfLight = dot(r, r) / (cos_q * lightArea);
-
-        // Cook-Torrance BRDF
-        vec3 halfDir = normalize(viewDir + shadowRayDir);
-        vec3 brdf = calculateBRDF(worldNormal, viewDir, shadowRayDir, halfDir, color, metallic, alpha);
-
-        float pdfGGX = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
-        float pdfCos = cos_p / PI;
-        float pdfBRDF = probGGX * pdfGGX + probCos * pdfCos;
-
-        float w = powerHeuristic(pdfLight, pdfBRDF);
-
-        tempRadianceD += brdf * lightEmittance * visibility * cos_p * w / pdfLight;
-	}
-	tempRadianceD *= (1 / float(numSampleByDepth)); // average
-
-	//////////////////////////////////////////////////////////////// Indirect Light
-
-	uint tempDepth = gPayload.depth;
-	vec3 tempRadianceI = vec3(0.0);
-
-	for (uint i=0; i < numSampleByDepth; ++i)
-	{
-        vec3 rayDir = vec3(0.0);
-        vec3 halfDir = vec3(0.0);
-
-        float pdfSel = 1.0;
-        float weight = 1.0;
-        vec3 brdf = vec3(0.0);
-
-        float a = random(gPayload.rngState);
-        float r3 = random(gPayload.rngState);
-        float r4 = random(gPayload.rngState);
-        vec2 seed = vec2(r3, r4);
-
-        bool isGGX = (a >= prob);
-        float pdfGGXVal = 0.0;
-        float pdfCosineVal = 0.0;
-
-        if (isGGX) {
-            mat3 TBN = computeTBN(worldNormal);
-            vec3 viewDirLocal = normalize(transpose(TBN) * viewDir); // viewDir -> world2local
-            vec3 halfDirLocal = sampleGGXVNDF(viewDirLocal, alpha, alpha, seed);
-            halfDir = normalize(TBN * halfDirLocal);  // halfDir local -> world
-            rayDir = reflect(-viewDir, halfDir);
-
-            pdfGGXVal = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
-            pdfCosineVal = max(dot(worldNormal, rayDir), 1e-6) / PI;
-        } 
-        else {
-            rayDir = RandomCosineHemisphere(worldNormal, seed);
-            pdfCosineVal = max(dot(worldNormal, rayDir), 1e-6) / PI;
-
-            halfDir = normalize(viewDir + rayDir);
-            pdfGGXVal = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
-        }
+    float charFunc = 0.0;
+    if (dot(viewDir, worldNormal) > 0.0) charFunc = 1.0;
 
-        pdfGGXVal = probGGX * pdfGGXVal;
-        pdfCosineVal = probCos * pdfCosineVal;
-
-        weight = isGGX ? powerHeuristic(pdfGGXVal, pdfCosineVal) 
-                        : powerHeuristic(pdfCosineVal, pdfGGXVal);   
+    return brdf * emit * cos_p * visibility * charFunc * w / pdfEnv;
+}
 
-        pdfSel = isGGX ? pdfGGXVal : pdfCosineVal;
-        brdf = calculateBRDF(worldNormal, viewDir, rayDir, halfDir, color, metallic, alpha);
+// Radiance of one path starting with the camera ray
+vec3 tracePath(vec3 rayOrigin, vec3 rayDir, inout uint rngState)
+{
+    vec3 radiance = vec3(0.0);
+    vec3 throughput = vec3(1.0);
+    float pdfBRDF = 0.0;
+    float tMin = 0.0;
 
-        gPayload.rayDirection = rayDir;
-        gPayload.depth++;
+    for (uint depth = 0; ; ++depth) {
         traceRayEXT(
             topLevelAS,                         // topLevel
             gl_RayFlagsOpaqueEXT, 0xff,         // rayFlags, cullMask
-            0, 1, SHADOW_MISS_IDX,              // sbtRecordOffset, sbtRecordStride, missIndex
-            worldPos, 0.0001, rayDir, 100.0,  	// origin, tmin, direction, tmax
-            0);                                 // payload 
-        gPayload.depth = tempDepth;
-
-        const float cos_p = max(dot(worldNormal, rayDir), 1e-6);
-        tempRadianceI += brdf * gPayload.radiance * cos_p * weight / pdfSel;
-	}
-	tempRadianceI *= (1.0 / float(numSampleByDepth));
-    
-	gPayload.radiance = tempRadianceD + tempRadianceI;
-}
-#endif
+            0, 1, MISS_IDX,                     // sbtRecordOffset, sbtRecordStride, missIndex
+            rayOrigin, tMin, rayDir, 100.0,     // origin, tmin, direction, tmax
+            0);                                 // payload
+
+        if (gHit.hitT < 0.0) {
+            if (LIGHT_SELECTION == LIGHT_SELECTION_ENV_MAP && depth < gImguiParam.maxDepth) {
+                const vec3 Le = getEmitFromEnvmap(rayDir);
+
+                float weight = 1.0;
+                // get envmap pdf for MIS
+                if (depth > 0) {
+                    const vec2 uv = getUVfromRay(rayDir);
+                    const float pdfEnv = getEnvPdf(uv.x, uv.y);
+                    weight = powerHeuristic(pdfBRDF, pdfEnv);
+                }
+                radiance += throughput * weight * Le;
+            }
+            break;
+        }
 
-#if BRUTE_FORCE_ENV_MAP_CLOSEST_HIT_SHADER
-//=========================
-//   BRUTE FORCE ENVIRONMENT MAP CLOSEST HIT SHADER
-//=========================
+        const vec3 worldPos = gHit.position;
+        const vec3 worldNormal = gHit.normal;
+        const vec3 viewDir = -rayDir;
+        const vec3 color = gHit.color;
+        const float metallic = clamp(gHit.metallic, 0.0, 1.0);
+        const float roughness = clamp(gHit.roughness, MIRROR_ROUGH, 1.0);
+
+        if (LIGHT_SELECTION == LIGHT_SELECTION_LIGHT_ONLY) {
+            const uint hitLightIdx = gInstanceLights.lightIndex[gHit.instanceIndex];
+            const bool isLight = (hitLightIdx != INVALID_LIGHT_INDEX);
+            const vec3 lightEmittance = isLight ? vec3(gLightBuffer.lights[hitLightIdx].emittance) : vec3(0.0);
+
+            if (LIGHT_SAMPLING_MODE == LIGHT_SAMPLING_NEE) {
+                // Emitters are only seen directly by the camera, later bounces reach them through light sampling
+                if (isLight) {
+                    if (depth == 0)
+                        radiance += throughput * lightEmittance;
+                    break;
+                }
+            }
+            else if (isLight) {
+                radiance += throughput * lightEmittance;
+            }
+        }
 
-layout( shaderRecordEXT ) buffer CustomData
-{
-   vec3 color;
-   float metallic;
-   float roughness;
-} gCustomData;
+        if (depth >= gImguiParam.maxDepth)
+            break;
 
-layout(location = 0) rayPayloadInEXT RayPayload gPayload;
-hitAttributeEXT vec2 attribs;
+        if (LIGHT_SAMPLING_MODE == LIGHT_SAMPLING_NEE) {
+            if (LIGHT_SELECTION == LIGHT_SELECTION_LIGHT_ONLY)
+                radiance += throughput * sampleLightDirect(worldPos, worldNormal, viewDir, color, metallic, roughness, rngState);
+            else
+                radiance += throughput * sampleEnvironmentDirect(worldPos, worldNormal, viewDir, color, metallic, roughness, rngState);
+        }
+
+        const BounceSample bounce = sampleBounce(worldNormal, viewDir, color, metallic, roughness, rngState);
+        throughput *= bounce.throughput;
+        pdfBRDF = bounce.pdfBRDF;
+
+        // Russian roulette, dim paths stop early and the survivors are scaled up so the estimate stays unbiased
+        if (depth + 1 >= gImguiParam.rouletteMinDepth) {
+            const float survival = min(max(throughput.r, max(throughput.g, throughput.b)), 0.95);
+            if (random(rngState) >= survival)
+                break;
+            throughput /= survival;
+        }
+        rayOrigin = worldPos;
+        rayDir = bounce.rayDir;
+        tMin = 0.0001;
+    }
+
+    return radiance;
+}
 
 void main()
 {
-    ObjectDesc objDesc = gObjectDescs.desc[gl_InstanceCustomIndexEXT];
+    const vec3 cameraX = vec3( 1, 0, 0 );
+    const vec3 cameraY = vec3( 0, -1, 0 );
+    const vec3 cameraZ = vec3( 0, 0, -1 );
+    const float aspect_y = tan( radians( g.yFov_degree ) * 0.5 );
+    const float aspect_x = aspect_y * float( gl_LaunchSizeEXT.x ) / float( gl_LaunchSizeEXT.y );
 
-    IndexBuffer indexBuffer = IndexBuffer(objDesc.indexDeviceAddress);
-    uint base = gl_PrimitiveID * 3u;
-    uvec3 index = uvec3(indexBuffer.i[base + 0], 
-                        indexBuffer.i[base + 1], 
-                        indexBuffer.i[base + 2]);
+    // Better random seed generation
+    uint pixelIndex = gl_LaunchIDEXT.y * gl_LaunchSizeEXT.x + gl_LaunchIDEXT.x;
+    uint seed = pixelIndex;
+    if (gImguiParam.isProgressive != 0u)
+        seed = pixelIndex + g.currentFrame * 1664525u;
+    uint rngState = pcg_hash(seed);
 
-    PositionBuffer positionBuffer = PositionBuffer(objDesc.vertexPositionDeviceAddress);
-    vec3 p0 = positionBuffer.p[index.x].xyz;
-    vec3 p1 = positionBuffer.p[index.y].xyz;
-    vec3 p2 = positionBuffer.p[index.z].xyz;
+    // Anti-aliasing jitter
+    float r1 = random(rngState);
+    float r2 = random(rngState);
 
-    float u = attribs.x;
-    float v = attribs.y;
-    float w = 1.0 - u - v;
-    vec3 position = w * p0 + u * p1 + v * p2;
+    const vec2 screenCoord = vec2( gl_LaunchIDEXT.xy ) + vec2( r1, r2 );
+    const vec2 ndc = screenCoord / vec2( gl_LaunchSizeEXT.xy ) * 2.0 - 1.0;
+    vec3 rayDir = normalize( ndc.x * aspect_x * cameraX + ndc.y * aspect_y * cameraY + cameraZ );
 
-    AttributeBuffer attrBuf = AttributeBuffer(objDesc.vertexAttributeDeviceAddress);
-    vec3 n0 = normalize(attrBuf.a[index.x].norm.xyz);
-    vec3 n1 = normalize(attrBuf.a[index.y].norm.xyz);
-    vec3 n2 = normalize(attrBuf.a[index.z].norm.xyz);
-    vec3 normal = normalize(w * n0 + u * n1 + v * n2);
+    // Every sample is a full path through the same camera ray
+    const uint numSamples = max( gImguiParam.numSamples, 1u );
+    vec3 currentSample = vec3( 0.0 );
+    for( uint i = 0; i < numSamples; ++i )
+        currentSample += tracePath( g.cameraPos, rayDir, rngState );
+    currentSample /= float( numSamples );
 
-    vec3 worldPos = (gl_ObjectToWorldEXT * vec4(position, 1.0)).xyz;
-    vec3 worldNormal = normalize(transpose(inverse(mat3(gl_ObjectToWorldEXT))) * normal);
+    vec3 finalColor = currentSample;
+    if ( gImguiParam.isProgressive != 0u ) {
+        // Progressive accumulation
+        vec3 previousAccumulation = vec3(0.0);
+        if (g.currentFrame > 1) {
+            previousAccumulation = imageLoad(accumulationImage, ivec2(gl_LaunchIDEXT.xy)).rgb;
+        }
 
-    const vec3 color = gCustomData.color;
-    const float metallic = clamp(gCustomData.metallic, 0.0, 1.0);
-    const float roughness = clamp(gCustomData.roughness, MIRROR_ROUGH, 1.0);
-    const float alpha = roughness * roughness;
-    const vec3 viewDir = -gPayload.rayDirection;
-    
-    // Adaptive probability based on roughness
-    const float prob = mix(0.2, 0.8, roughness);
-    const float probGGX = (1 - prob);
-    const float probCos = prob;
+        // Proper incremental average
+        vec3 accumulated = (previousAccumulation * float(g.currentFrame - 1) + currentSample) / float(g.currentFrame);
 
-    vec3 temp = vec3(0.0);
-    uint numSampleByDepth = (gPayload.depth == 0 ? gImguiParam.numSamples : 1);
-    if (gPayload.depth < gImguiParam.maxDepth) {
-        for (uint i=0; i < numSampleByDepth; ++i) {
-            vec3 rayDir = vec3(0.0);
-            vec3 halfDir = vec3(0.0);
-
-            float a = random(gPayload.rngState);
-            float r3 = random(gPayload.rngState);
-            float r4 = random(gPayload.rngState);
-            vec2 seed = vec2(r3, r4);
-
-            bool isGGX = (a >= prob);
-            float pdfGGXVal = 0.0;
-            float pdfCosineVal = 0.0;
-
-            if (isGGX) {
-                mat3 TBN = computeTBN(worldNormal);
-                vec3 viewDirLocal = normalize(transpose(TBN) * viewDir);
-                vec3 halfDirLocal = sampleGGXVNDF(viewDirLocal, alpha, alpha, seed);
-                halfDir = normalize(TBN * halfDirLocal);
-                rayDir = reflect(-viewDir, halfDir);
-
-                pdfGGXVal = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
-                pdfCosineVal = max(dot(worldNormal, rayDir), 1e-6) / PI;
-            } 
-            else {
-                rayDir = RandomCosineHemisphere(worldNormal, seed);
-                pdfCosineVal = max(dot(worldNormal, rayDir), 1e-6) / PI;
-
-                halfDir = normalize(viewDir + rayDir);
-                pdfGGXVal = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
-            }
-  
-            const float pdfBRDF = probGGX * pdfGGXVal + probCos * pdfCosineVal;
-            const vec3 brdf = calculateBRDF(worldNormal, viewDir, rayDir, halfDir, color, metallic, alpha);
-
-            gPayload.rayDirection = rayDir;
-            gPayload.pdfBRDF = pdfBRDF;
-            gPayload.depth++;
-            traceRayEXT(
-                topLevelAS,                         // topLevel
-                gl_RayFlagsOpaqueEXT, 0xff,         // rayFlags, cullMask
-                0, 1, ENV_MISS_IDX,                 // sbtRecordOffset, sbtRecordStride, missIndex
-                worldPos, 0.0001, rayDir, 100.0,  	// origin, tmin, direction, tmax
-                0);                                 // payload 
-            gPayload.depth--;
-
-            const float cos_p = max(dot(worldNormal, rayDir), 1e-6);
-            temp += brdf * gPayload.radiance * cos_p / pdfBRDF;
-        }
-        temp *= 1.0 / float(numSampleByDepth);
+        // Store in accumulation buffer
+        imageStore(accumulationImage, ivec2(gl_LaunchIDEXT.xy), vec4(accumulated, 1.0));
+        finalColor = accumulated;
     }
-    gPayload.radiance = temp;
-}
 
+    vec3 finalfinalColor = pow(1.0 - exp(-g.exposure * finalColor), vec3(1/2.2, 1/2.2, 1/2.2)); // simple gamma correction
+
+    imageStore( image, ivec2( gl_LaunchIDEXT.xy ), vec4( finalfinalColor, 1.0 ) );
+}
 #endif
 
-#if NEE_ENV_MAP_CLOSEST_HIT_SHADER
+#if CLOSEST_HIT_SHADER
 //=========================
-//   NEE ENVIRONMENT MAP CLOSEST HIT SHADER
+//   CLOSEST HIT SHADER
 //=========================
-
+// Only reports the surface, shading happens in the ray generation shader
 layout( shaderRecordEXT ) buffer CustomData
 {
    vec3 color;
@@ -543,26 +347,17 @@ layout( shaderRecordEXT ) buffer CustomData
    float roughness;
 } gCustomData;
 
-layout(location = 0) rayPayloadInEXT RayPayload gPayload;
+layout(location = 0) rayPayloadInEXT HitPayload gHit;
 hitAttributeEXT vec2 attribs;
 
-/////////////////////////////////////////////////////////////////////////////////////////////
-
 void main()
 {
-    if( gPayload.depth >= gImguiParam.maxDepth )
-    {
-        gPayload.radiance = vec3( 0.0 );
-        return;
-    }
-
     ObjectDesc objDesc = gObjectDescs.desc[gl_InstanceCustomIndexEXT];
 
     IndexBuffer indexBuffer = IndexBuffer(objDesc.indexDeviceAddress);
-
     uint base = gl_PrimitiveID * 3u;
-    uvec3 index = uvec3(indexBuffer.i[base + 0], 
-                        indexBuffer.i[base + 1], 
+    uvec3 index = uvec3(indexBuffer.i[base + 0],
+                        indexBuffer.i[base + 1],
                         indexBuffer.i[base + 2]);
 
     PositionBuffer positionBuffer = PositionBuffer(objDesc.vertexPositionDeviceAddress);
@@ -581,193 +376,25 @@ void main()
     vec3 n2 = normalize(attrBuf.a[index.z].norm.xyz);
     vec3 normal = normalize(w * n0 + u * n1 + v * n2);
 
-    vec3 worldPos = (gl_ObjectToWorldEXT * vec4(position, 1.0)).xyz;
-    vec3 worldNormal = normalize(transpose(inverse(mat3(gl_ObjectToWorldEXT))) * normal);
-
-    const float eps = 1e-4;
-
-    const vec3 color = gCustomData.color;
-    const float metallic = clamp(gCustomData.metallic, 0.0, 1.0);
-    const float roughness = clamp(gCustomData.roughness, MIRROR_ROUGH, 1.0);
-    const float alpha = roughness * roughness;
-
-    const float prob = mix(0.2, 0.8, roughness);
-    const float probGGX = (1 - prob);
-    const float probCos = prob;
-
-    const vec3 viewDir = -gPayload.rayDirection;
-
-	//////////////////////////////////////////////////////////////// Direct Light
-	
-	vec3 tempRadianceD = vec3(0.0);
-	uint numSampleByDepth = (gPayload.depth == 0 ? gImguiParam.numSamples : 1);
-
-	for (uint i=0; i < numSampleByDepth; ++i)
-	{
-        float pdfEnv;
-        vec3 rayDir = sampleEnvDirection(gPayload.rngState, pdfEnv);
-        
-		gPayload.rayDirection = rayDir;
-        gPayload.visibility = 1.0;
-		traceRayEXT(
-			topLevelAS,                         // topLevel
-			gl_RayFlagsNoOpaqueEXT | gl_RayFlagsSkipClosestHitShaderEXT,    // rayFlags
-            0xff,                               // cullMask
-			0, 1, SHADOW_MISS_IDX,              // sbtRecordOffset, sbtRecordStride, missIndex // miss shader should do nothing
-			worldPos, eps, rayDir, 100.0,  		// origin, tmin, direction, tmax
-			0);                                 // gPayload 
-
-        const vec3 emit = getEmitFromEnvmap(rayDir);
-
-        float cos_p = max(dot(worldNormal, rayDir), 1e-6);
-        // Cook-Torrance BRDF
-        vec3 halfDir = normalize(viewDir + rayDir);
-        vec3 brdf = calculateBRDF(worldNormal, viewDir, rayDir, halfDir, color, metallic, alpha);
-
-        float pdfGGX = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
-        float pdfCos = cos_p / PI;
-        float pdfBRDF = probGGX * pdfGGX + probCos * pdfCos;
-
-        float w = powerHeuristic(pdfEnv, pdfBRDF);
-
-        float charFunc = 0.0;
-        if (dot(viewDir, worldNormal) > 0.0) charFunc = 1.0;
-
-        tempRadianceD += brdf * emit * cos_p * gPayload.visibility * charFunc * w / pdfEnv;
-	}
-	tempRadianceD *= (1.0 / float(numSampleByDepth)); 
-	
-	//////////////////////////////////////////////////////////////// Indirect Light
-
-	vec3 tempRadianceI = vec3(0.0);
-
-	for (uint i=0; i < numSampleByDepth; ++i)
-	{
-        vec3 rayDir = vec3(0.0);
-        vec3 halfDir = vec3(0.0);
-
-        float a = random(gPayload.rngState);
-        float r3 = random(gPayload.rngState);
-        float r4 = random(gPayload.rngState);
-        vec2 seed = vec2(r3, r4);
-
-        bool isGGX = (a >= prob);
-        float pdfGGXVal = 0.0;
-        float pdfCosineVal = 0.0;
-        float cos_p = 0.0;
-
-        if (isGGX) {
-            mat3 TBN = computeTBN(worldNormal);
-            vec3 viewDirLocal = normalize(transpose(TBN) * viewDir); // viewDir -> world2local
-            vec3 halfDirLocal = sampleGGXVNDF(viewDirLocal, alpha, alpha, seed);
-            halfDir = normalize(TBN * halfDirLocal);  // halfDir local -> world
-            rayDir = reflect(-viewDir, halfDir);
-            cos_p = max(dot(worldNormal, rayDir), 1e-6);
-
-            pdfGGXVal = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
-            pdfCosineVal = cos_p / PI;
-        } 
-        else {
-            rayDir = RandomCosineHemisphere(worldNormal, seed);
-            cos_p = max(dot(worldNormal, rayDir), 1e-6);
-            pdfCosineVal = cos_p / PI;
-
-            halfDir = normalize(viewDir + rayDir);
-            pdfGGXVal = pdfGGXVNDF(worldNormal, viewDir, halfDir, alpha);
-        }
-
-        pdfGGXVal = probGGX * pdfGGXVal;
-        pdfCosineVal = probCos * pdfCosineVal;
-
-        const float weight = isGGX ? powerHeuristic(pdfGGXVal, pdfCosineVal) 
-                                   : powerHeuristic(pdfCosineVal, pdfGGXVal);   
-
-        const float pdfBRDF = isGGX ? pdfGGXVal : pdfCosineVal;
-        const vec3 brdf = calculateBRDF(worldNormal, viewDir, rayDir, halfDir, color, metallic, alpha);
-
-		gPayload.rayDirection = rayDir;
-        gPayload.pdfBRDF = pdfBRDF;
-		gPayload.depth++;
-		traceRayEXT(
-			topLevelAS,                         // topLevel
-			gl_RayFlagsOpaqueEXT, 0xff,         // rayFlags, cullMask
-			0, 1, ENV_MISS_IDX,                 // sbtRecordOffset, sbtRecordStride, missIndex
-			worldPos, eps, rayDir, 100.0,  		// origin, tmin, direction, tmax
-			0);                                 // gPayload 
-		gPayload.depth--;
-
-        tempRadianceI += brdf * gPayload.radiance * cos_p * weight / pdfBRDF; // radiance weighted for the last bounce
-	}
-	tempRadianceI *= (1.0 / float(numSampleByDepth)); 
-    
-	gPayload.radiance = tempRadianceD + tempRadianceI;
+    gHit.position = (gl_ObjectToWorldEXT * vec4(position, 1.0)).xyz;
+    gHit.normal = normalize(transpose(inverse(mat3(gl_ObjectToWorldEXT))) * normal);
+    gHit.color = gCustomData.color;
+    gHit.metallic = gCustomData.metallic;
+    gHit.roughness = gCustomData.roughness;
+    gHit.instanceIndex = gl_InstanceCustomIndexEXT;
+    gHit.hitT = gl_HitTEXT;
 }
 #endif
 
-#if ANY_HIT_SHADER
+#if MISS_SHADER
 //=========================
-//   SHADOW MISS SHADER
+//   MISS SHADER
 //=========================
-layout(location = 0) rayPayloadInEXT RayPayload gPayload;
-
-void main()
-{
-    // for local lights
-    vec3 worldPos = gl_WorldRayOriginEXT + gl_WorldRayDirectionEXT * gl_HitTEXT;
-    gPayload.desiredPosition = worldPos;
+// The environment is evaluated by the ray generation shader
+layout(location = 0) rayPayloadInEXT HitPayload gHit;
 
-    // for envmap
-    gPayload.visibility = 0.0;
-}
-#endif
-
-#if SHADOW_MISS_SHADER
-//=========================
-//   SHADOW MISS SHADER
-//=========================
-layout(location = 0) rayPayloadInEXT RayPayload gPayload;
 void main()
 {
-    gPayload.radiance = vec3(0.0);
+    gHit.hitT = -1.0;
 }
-
 #endif
-
-#if LIGHT_ONLY_ENVIRONMENT_MISS_SHADER
-//=========================
-//   LIGHT ONLY ENVIRONMENT MISS SHADER
-//=========================
-layout(location = 0) rayPayloadInEXT RayPayload gPayload;
-
-void main()
-{
-    gPayload.radiance = vec3(0.0);
-}
-#endif
-
-#if ENV_MAP_ENVIRONMENT_MISS_SHADER
-//=========================
-//   ENV MAP ENVIRONMENT MISS SHADER
-//=========================
-layout(location = 0) rayPayloadInEXT RayPayload gPayload;
-
-void main()
-{
-	if (gPayload.depth >= gImguiParam.maxDepth) {
-        gPayload.radiance = vec3(0.0);
-		return;
-    }
-    
-    const vec3 Le = getEmitFromEnvmap(gPayload.rayDirection);
-
-    float weight = 1.0;
-    // get envmap pdf for MIS
-    if (gPayload.depth > 0)
-    {
-        const vec2 uv = getUVfromRay(gPayload.rayDirection);
-        const float pdfEnv = getEnvPdf(uv.x, uv.y);
-        weight = powerHeuristic(gPayload.pdfBRDF, pdfEnv);
-    }
-    gPayload.radiance = weight * Le;
-}
-#endif
\ No newline at end of file
@@ -151,8 +151,20 @@ mat3 rotateY(float angle) {
 
 /////////////////////////////////////////////////////////////////////////////////////////////
 
+// Texels are sampled uniformly inside, so the solid angle pdf only differs by the sin(theta) of the equirectangular mapping
+float envSolidAnglePdf(float texelPdf, float v, uint texelCount) {
+    const float sinTheta = max(sin(PI * v), 1e-6);
+    return texelPdf * float(texelCount) / (2.0 * PI * PI * sinTheta);
+}
+
 float getEnvPdf(float x, float y) {
-    return texture(envHitPdf, vec2(x, y)).r;
+    ivec2 texSize = textureSize(environmentMap, 0);
+    uint width = texSize.x;
+    uint height = texSize.y;
+
+    uint texelX = min(uint(x * width), width - 1);
+    uint texelY = min(uint(y * height), height - 1);
+    return envSolidAnglePdf(gEnvAliasTable.entries[texelY * width + texelX].pdf, y, width * height);
 }
 
 vec3 sampleEnvDirection(inout uint rngState, out float pdf)
@@ -160,18 +172,26 @@ vec3 sampleEnvDirection(inout uint rngState, out float pdf)
     ivec2 texSize = textureSize(environmentMap, 0);
     uint width = texSize.x;
     uint height = texSize.y;
+    uint texelCount = width * height;
 
-    float x = random(rngState);
-    float y = random(rngState);
-    vec4 pixelValue = texture(envImportanceData, vec2(x, y));
-    pdf = pixelValue.w;
+    // Pick a bucket uniformly, then keep its texel or take its alias
+    uint texel = min(uint(random(rngState) * texelCount), texelCount - 1);
+    EnvAliasEntry entry = gEnvAliasTable.entries[texel];
+    if (random(rngState) >= entry.threshold) {
+        texel = entry.alias;
+        entry.pdf = gEnvAliasTable.entries[texel].pdf;
+    }
 
-    vec3 dir = pixelValue.xyz;
-    float rot = gImguiParam.envmapRotDeg * (PI / 180.0);
-    dir = rotateY(-rot) * dir;
+    float u = (float(texel % width) + random(rngState)) / float(width);
+    float v = (float(texel / width) + random(rngState)) / float(height);
+    pdf = envSolidAnglePdf(entry.pdf, v, texelCount);
 
-    // @TODO: pre-calculate on cpu
-    return normalize( dir );
+    float phi = 2.0 * PI * u;
+    float theta = PI * v;
+    vec3 dir = vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+
+    float rot = gImguiParam.envmapRotDeg * (PI / 180.0);
+    return rotateY(-rot) * dir;
 }
 
 vec2 getUVfromRay(vec3 rayDir) {
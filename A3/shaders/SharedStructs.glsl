@@ -1,12 +1,13 @@
-struct RayPayload
+// Surface reported by the closest hit shader, hitT < 0 marks a miss
+struct HitPayload
 {
-    vec3 rayDirection;
-    vec3 radiance;
-    vec3 desiredPosition;
-    uint depth;
-    uint rngState;
-    float pdfBRDF;
-    float visibility;
+    vec3 position;
+    vec3 normal;
+    vec3 color;
+    float metallic;
+    float roughness;
+    uint instanceIndex;
+    float hitT;
 };
 
 // struct ShadowPayload
@@ -19,6 +20,12 @@ struct LightData
     mat4 transform;
     float emittance;
     uint triangleCount;
+    uint instanceIndex;         // Instance of the light in the TLAS
+    float area;                 // World space area, the sum of all triangles
+    float selectionPdf;         // Probability of picking this light, proportional to its power
+    float selectionThreshold;   // Alias table bucket of the light selection
+    uint selectionAlias;
+    uint padding;
 };
 
 struct VertexAttributes
@@ -35,7 +42,9 @@ struct ObjectDesc
    uint64_t cumulativeTriangleAreaAddress;
 };
 
-struct EnvImportanceSampleData {
-    vec3 dir;
+// One bucket per environment map texel, see Utility::buildEnvironmentAliasTable
+struct EnvAliasEntry {
+    float threshold;
+    uint alias;
     float pdf;
 };
\ No newline at end of file